@@ -92,3 +92,25 @@ g_array_append_val_(ARRAY *a, const void *p)
     memcpy(d, p, a->eltsize);
     return 0;
 }
+
+
+ARRAY *
+g_array_set_size(ARRAY *a, unsigned int len)
+{
+    unsigned int old = a->len;
+    if (a->error) {
+	return a;
+    }
+    while ((unsigned int)a->len < len) {
+	if (arr_enlarge(a) == NULL) {
+	    /* a->error is set, keep the array as it was */
+	    a->len = old;
+	    return a;
+	}
+    }
+    if (len > old) {
+	memset((char *)a->data + a->eltsize * old, 0, (len - old) * a->eltsize);
+    }
+    a->len = len;
+    return a;
+}
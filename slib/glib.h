@@ -331,6 +331,7 @@ void *g_ptr_array_remove_index(ARRAY *a, unsigned int i);
 ARRAY *g_array_new(int z, int c, int eltsize);
 void g_array_free(ARRAY *a, int free_seg);
 int g_array_append_val_(ARRAY *a, const void *p);
+ARRAY *g_array_set_size(ARRAY *a, unsigned int len);
 
 /*****************************************************************************/
 
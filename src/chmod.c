@@ -251,18 +251,39 @@ static void do_chmod (struct stat *sf)
 static void apply_mask (struct stat *sf)
 {
     char *fname;
+#ifdef USE_VFS
+    int batch;
+#endif				/* USE_VFS */
 
     need_update = end_chmod = 1;
+#ifdef USE_VFS
+    /* A remote vfs may send the changes in batches */
+    batch = mc_setctl (current_panel->cwd, VFS_SETCTL_BATCH_BEGIN, NULL);
+#endif				/* USE_VFS */
     do_chmod (sf);
 
     do {
 	fname = next_file ();
 	if (mc_stat (fname, sf) != 0)
-	    return;
+	    break;
 	c_stat = sf->st_mode;
 
 	do_chmod (sf);
     } while (current_panel->marked);
+
+#ifdef USE_VFS
+    if (batch) {
+	GList *failed = NULL, *l;
+
+	mc_setctl (current_panel->cwd, VFS_SETCTL_BATCH_END, &failed);
+	for (l = failed; l; l = l->next) {
+	    message (1, MSG_ERROR, _(" Cannot chmod \"%s\" \n %s "),
+		     (char *) l->data, unix_error_string (E_REMOTE));
+	    g_free (l->data);
+	}
+	g_list_free (failed);
+    }
+#endif				/* USE_VFS */
 }
 
 void chmod_cmd (void)
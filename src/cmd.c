@@ -26,9 +26,6 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#ifdef HAVE_MMAP
-#   include <sys/mman.h>
-#endif
 #ifdef USE_NETCODE
 #include <netdb.h>
 #endif
@@ -45,6 +42,7 @@
 #include "cons.saver.h"		/* console_flag */
 #include "tty.h"		/* LINES */
 #include "dialog.h"		/* Widget */
+#include "color.h"		/* dialog_colors */
 #include "view.h"		/* mc_internal_viewer() */
 #include "wtools.h"		/* message() */
 #include "widget.h"		/* push_history() */
@@ -62,10 +60,6 @@
 #include "profile.h"		/* PROFILE_NAME */
 #include "execute.h"		/* toggle_panels() */
 
-#ifndef MAP_FILE
-#   define MAP_FILE 0
-#endif
-
 #ifdef USE_INTERNAL_EDIT
 #   include "../edit/edit.h"
 #endif
@@ -771,80 +765,200 @@ void reselect_vfs (void)
 }
 #endif /* USE_VFS */
 
-static int compare_files (char *name1, char *name2, off_t size)
-{
-    int file1, file2;
-    int result = -1;		/* Different by default */
-
-    file1 = open (name1, O_RDONLY);
-    if (file1 >= 0){
-	file2 = open (name2, O_RDONLY);
-	if (file2 >= 0){
-#ifdef HAVE_MMAP
-	    char *data1, *data2;
-	    /* Ugly if jungle */
-	    data1 = mmap (0, size, PROT_READ, MAP_FILE | MAP_PRIVATE, file1, 0);
-	    if (data1 != (char*) -1){
-		data2 = mmap (0, size, PROT_READ, MAP_FILE | MAP_PRIVATE, file2, 0);
-		if (data2 != (char*) -1){
-		    rotate_dash ();
-		    result = memcmp (data1, data2, size);
-		    munmap (data2, size);
-		}
-		munmap (data1, size);
-	    }
-#else
-	    /* Don't have mmap() :( Even more ugly :) */
-	    char buf1[BUFSIZ], buf2[BUFSIZ];
-	    int n1, n2;
-	    rotate_dash ();
-	    do
-	    {
-		while((n1 = read(file1,buf1,BUFSIZ)) == -1 && errno == EINTR);
-		while((n2 = read(file2,buf2,BUFSIZ)) == -1 && errno == EINTR);
-	    } while (n1 == n2 && n1 == BUFSIZ && !memcmp(buf1,buf2,BUFSIZ));
-	    result = (n1 != n2) || memcmp(buf1,buf2,n1);
-#endif /* !HAVE_MMAP */
-	    close (file2);
+#define COMPARE_CHUNK	(64 * 1024)	/* bytes read at a time */
+
+/* Progress of the content phase, shown only if it takes a while */
+struct compare_ui {
+    Dlg_head *dlg;
+    WLabel *label;
+    WGauge *gauge;
+    double done, total;
+    time_t start;
+};
+
+/* Update the progress dialog.  Returns 1 if the user gave up. */
+static int
+compare_ui_update (struct compare_ui *ui, const char *name)
+{
+    Gpm_Event event;
+    int c;
+
+    if (ui->dlg == NULL) {
+	const char *b_name = _("&Abort");
+
+	if (time (NULL) - ui->start < 1)
+	    return 0;
+	ui->dlg = create_dlg (0, 0, 9, 58, dialog_colors, NULL, NULL,
+			      _(" Compare directories "), DLG_CENTER);
+	add_widget (ui->dlg, button_new (6, (58 - strlen (b_name) - 4) / 2,
+					 B_CANCEL, NORMAL_BUTTON, b_name,
+					 NULL));
+	add_widget (ui->dlg, ui->gauge = gauge_new (4, 3, 1, 1024, 0));
+	add_widget (ui->dlg, ui->label = label_new (2, 3, ""));
+	init_dlg (ui->dlg);
+    }
+
+    label_set_text (ui->label, name_trunc (name, 52));
+    gauge_set_value (ui->gauge, 1024,
+		     ui->total ? (int) (ui->done * 1024 / ui->total) : 0);
+
+    event.x = -1;		/* Don't show the GPM cursor */
+    c = get_event (&event, 0, 0);
+    if (c == EV_NONE)
+	return 0;
+
+    ui->dlg->ret_value = 0;
+    dlg_process_event (ui->dlg, c, &event);
+    return ui->dlg->ret_value == B_CANCEL;
+}
+
+static int
+compare_read (int fd, char *buf, int len)
+{
+    int n, got = 0;
+
+    while (got < len) {
+	n = mc_read (fd, buf + got, len - got);
+	if (n < 0)
+	    return -1;
+	if (n == 0)
+	    break;
+	got += n;
+    }
+    return got;
+}
+
+/*
+ * Compare two files chunk by chunk, stopping at the first difference.
+ * Returns 0 if they are equal, 1 if they differ or cannot be read,
+ * -1 if the user aborted.
+ */
+static int
+compare_files (const char *name1, const char *name2, struct compare_ui *ui)
+{
+    int file1, file2, n1, n2;
+    int result = 1;		/* Different by default */
+    char *buf;
+
+    file1 = mc_open (name1, O_RDONLY);
+    if (file1 < 0)
+	return result;
+    file2 = mc_open (name2, O_RDONLY);
+    if (file2 < 0) {
+	mc_close (file1);
+	return result;
+    }
+
+    buf = g_malloc (2 * COMPARE_CHUNK);
+    for (;;) {
+	if (compare_ui_update (ui, name1)) {
+	    result = -1;
+	    break;
+	}
+	n1 = compare_read (file1, buf, COMPARE_CHUNK);
+	n2 = compare_read (file2, buf + COMPARE_CHUNK, COMPARE_CHUNK);
+	if (n1 < 0 || n1 != n2 || memcmp (buf, buf + COMPARE_CHUNK, n1))
+	    break;
+	ui->done += n1;
+	if (n1 < COMPARE_CHUNK) {
+	    result = 0;
+	    break;
 	}
-	close (file1);
     }
+    g_free (buf);
+
+    mc_close (file2);
+    mc_close (file1);
     return result;
 }
 
+static unsigned int
+compare_hash (const char *name)
+{
+    unsigned int h = 0;
+
+    while (*name)
+	h = h * 31 + (unsigned char) *name++;
+    return h;
+}
+
+/*
+ * Index the names of a panel: an open addressing table of entry
+ * numbers, -1 for empty slots.  *mask receives the table size - 1.
+ */
+static int *
+compare_index (WPanel *panel, unsigned int *mask)
+{
+    unsigned int size = 16, h;
+    int *index, j;
+
+    while (size < 2 * (unsigned int) panel->count)
+	size <<= 1;
+    index = g_new (int, size);
+    for (h = 0; h < size; h++)
+	index[h] = -1;
+
+    for (j = 0; j < panel->count; j++) {
+	h = compare_hash (panel->dir.list[j].fname) & (size - 1);
+	while (index[h] != -1)
+	    h = (h + 1) & (size - 1);
+	index[h] = j;
+    }
+
+    *mask = size - 1;
+    return index;
+}
+
 enum CompareMode {
     compare_quick, compare_size_only, compare_thourough
 };
 
+/*
+ * Mark the files of panel that are missing from other or newer there.
+ * twin[i] receives the entry of other found to have the same contents
+ * as entry i of panel, or -1.  prev is the twin array of the opposite
+ * compare, if any, so that the same pair of files is not read twice.
+ * *aborted is set when the user stops the content compare; files not
+ * compared any more are then marked.
+ */
 static void
-compare_dir (WPanel *panel, WPanel *other, enum CompareMode mode)
+compare_dir (WPanel *panel, WPanel *other, enum CompareMode mode,
+	     int *twin, const int *prev, int *aborted)
 {
-    int i, j;
+    int i, j, k, n, *index, *todo;
+    unsigned int h, mask;
     char *src_name, *dst_name;
+    struct compare_ui ui;
 
     /* No marks by default */
     panel->marked = 0;
     panel->total = 0;
     panel->dirs_marked = 0;
-    
+
+    index = compare_index (other, &mask);
+    todo = g_new (int, 2 * panel->count + 1);
+    n = 0;
+    memset (&ui, 0, sizeof (ui));
+
     /* Handle all files in the panel */
     for (i = 0; i < panel->count; i++){
 	file_entry *source = &panel->dir.list[i];
 
 	/* Default: unmarked */
 	file_mark (panel, i, 0);
+	twin[i] = -1;
 
 	/* Skip directories */
 	if (S_ISDIR (source->st.st_mode))
 	    continue;
 
 	/* Search the corresponding entry from the other panel */
-	for (j = 0; j < other->count; j++){
-	    if (strcmp (source->fname,
-			other->dir.list[j].fname) == 0)
-		break;
-	}
-	if (j >= other->count)
+	h = compare_hash (source->fname) & mask;
+	while ((j = index[h]) != -1
+	       && strcmp (source->fname, other->dir.list[j].fname) != 0)
+	    h = (h + 1) & mask;
+
+	if (j == -1)
 	    /* Not found -> mark */
 	    do_file_mark (panel, i, 1);
 	else {
@@ -875,15 +989,48 @@ compare_dir (WPanel *panel, WPanel *other, enum CompareMode mode)
 		continue;
 	    }
 
-	    /* Thorough compare on, do byte-by-byte comparison */
-	    src_name = concat_dir_and_file (panel->cwd, source->fname);
-	    dst_name = concat_dir_and_file (other->cwd, target->fname);
-	    if (compare_files (src_name, dst_name, source->st.st_size))
-		do_file_mark (panel, i, 1);
+	    /* Thorough compare on, queue for byte-by-byte comparison */
+	    if (prev != NULL && prev[j] == i) {
+		twin[i] = j;
+		continue;
+	    }
+	    todo[n++] = i;
+	    todo[n++] = j;
+	    ui.total += source->st.st_size;
+	}
+    } /* for (i ...) */
+    g_free (index);
+
+    /* Now read the files whose names, sizes and dates agree */
+    ui.start = time (NULL);
+    for (k = 0; k < n; k += 2) {
+	i = todo[k];
+	j = todo[k + 1];
+	if (!*aborted) {
+	    src_name = concat_dir_and_file (panel->cwd,
+					    panel->dir.list[i].fname);
+	    dst_name = concat_dir_and_file (other->cwd,
+					    other->dir.list[j].fname);
+	    switch (compare_files (src_name, dst_name, &ui)) {
+	    case 0:
+		twin[i] = j;
+		break;
+	    case -1:
+		*aborted = 1;
+		break;
+	    }
 	    g_free (src_name);
 	    g_free (dst_name);
 	}
-    } /* for (i ...) */
+	if (twin[i] == -1)
+	    do_file_mark (panel, i, 1);
+    }
+    g_free (todo);
+
+    if (ui.dlg != NULL) {
+	dlg_run_done (ui.dlg);
+	destroy_dlg (ui.dlg);
+    }
 }
 
 void
@@ -904,8 +1051,16 @@ compare_dirs_cmd (void)
 
     if (get_current_type () == view_listing
 	&& get_other_type () == view_listing) {
-	compare_dir (current_panel, other_panel, thorough_flag);
-	compare_dir (other_panel, current_panel, thorough_flag);
+	int *twin1, *twin2, aborted = 0;
+
+	twin1 = g_new (int, current_panel->count + 1);
+	twin2 = g_new (int, other_panel->count + 1);
+	compare_dir (current_panel, other_panel, thorough_flag,
+		     twin1, NULL, &aborted);
+	compare_dir (other_panel, current_panel, thorough_flag,
+		     twin2, twin1, &aborted);
+	g_free (twin1);
+	g_free (twin2);
     } else {
 	message (1, MSG_ERROR,
 		 _(" Both panels should be in the "
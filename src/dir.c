@@ -457,6 +457,16 @@ if_link_is_exe (const char *full_name, const file_entry *file)
 
 static dir_list dir_copy = { 0, 0 };
 
+static unsigned int
+reload_hash (const char *name)
+{
+    unsigned int h = 0;
+
+    while (*name)
+	h = h * 31 + (unsigned char) *name++;
+    return h;
+}
+
 static void
 alloc_dir_copy (int size)
 {
@@ -480,7 +490,127 @@ alloc_dir_copy (int size)
     }
 }
 
-/* If filter is null, then it is a match */
+/*
+ * Index the names of the previous listing: an open addressing table of
+ * entry numbers, -1 for empty slots.  *mask receives the table size - 1.
+ */
+static int *
+reload_index (const dir_list *list, int count, unsigned int *mask)
+{
+    unsigned int size = 16, h;
+    int *index, i;
+
+    while (size < 2 * (unsigned int) count)
+	size <<= 1;
+    index = g_new (int, size);
+    for (h = 0; h < size; h++)
+	index[h] = -1;
+
+    for (i = 0; i < count; i++) {
+	h = reload_hash (list->list[i].fname) & (size - 1);
+	while (index[h] != -1)
+	    h = (h + 1) & (size - 1);
+	index[h] = i;
+    }
+
+    *mask = size - 1;
+    return index;
+}
+
+static int
+reload_lookup (const dir_list *list, const int *index, unsigned int mask,
+	       const char *name)
+{
+    unsigned int h = reload_hash (name) & mask;
+    int i;
+
+    /* Entries already taken over have no name any more */
+    while ((i = index[h]) != -1 && (list->list[i].fname == NULL
+				    || strcmp (list->list[i].fname, name) != 0))
+	h = (h + 1) & mask;
+    return i;
+}
+
+/* Can the entry keep its place in the sorted listing? */
+static int
+reload_same_key (const file_entry *old, const struct stat *st,
+		 int link_to_dir)
+{
+    return old->st.st_mode == st->st_mode && old->st.st_size == st->st_size
+	&& old->st.st_mtime == st->st_mtime && old->st.st_atime == st->st_atime
+	&& old->st.st_ctime == st->st_ctime && old->st.st_ino == st->st_ino
+	&& old->f.link_to_dir == link_to_dir;
+}
+
+/*
+ * Sort list->list[top..n) after a reload.  order[i] is the position the
+ * entry had in the previous (sorted) listing of count entries, or -1 if
+ * it is new or its sort key may have changed.  The old entries are put
+ * back in their old order, only the others are sorted, and both runs
+ * are merged.  Falls back to a full sort if the old order does not
+ * hold for the current sort function.
+ */
+static void
+reload_sort (dir_list *list, int top, int n, const int *order, int count,
+	     sortfn *sort, int rev, int case_sensitive_f)
+{
+    file_entry *tmp, *dst;
+    int *pos, i, k, kept, fresh, a, b;
+
+    pos = g_new (int, count + 1);
+    for (k = 0; k < count; k++)
+	pos[k] = -1;
+    for (i = top; i < n; i++)
+	if (order[i] >= 0)
+	    pos[order[i]] = i;
+
+    tmp = g_new (file_entry, n - top + 1);
+    kept = 0;
+    for (k = 0; k < count; k++)
+	if (pos[k] >= 0)
+	    tmp[kept++] = list->list[pos[k]];
+    fresh = kept;
+    for (i = top; i < n; i++)
+	if (order[i] < 0)
+	    tmp[fresh++] = list->list[i];
+    g_free (pos);
+
+    reverse = rev ? -1 : 1;
+    case_sensitive = case_sensitive_f;
+
+    for (i = 1; i < kept; i++)
+	if ((*sort) (&tmp[i - 1], &tmp[i]) > 0)
+	    break;
+    if (i < kept) {
+	/* The listing was not in this order, sort everything */
+	memcpy (&list->list[top], tmp, (n - top) * sizeof (file_entry));
+	g_free (tmp);
+	do_sort (list, sort, n - 1, rev, case_sensitive_f);
+	return;
+    }
+
+    qsort (&tmp[kept], fresh - kept, sizeof (file_entry), sort);
+
+    dst = &list->list[top];
+    for (a = 0, b = kept; a < kept && b < fresh;)
+	if ((*sort) (&tmp[b], &tmp[a]) < 0)
+	    *dst++ = tmp[b++];
+	else
+	    *dst++ = tmp[a++];
+    while (a < kept)
+	*dst++ = tmp[a++];
+    while (b < fresh)
+	*dst++ = tmp[b++];
+    g_free (tmp);
+}
+
+/*
+ * If filter is null, then it is a match.
+ *
+ * Entries that were already listed keep their name strings and marks,
+ * and if their sort key did not change they keep their relative order,
+ * so that only new and changed entries need sorting.
+ */
 int
 do_reload_dir (const char *path, dir_list *list, sortfn *sort, int count,
 	       int rev, int case_sensitive, const char *filter)
@@ -488,10 +618,10 @@ do_reload_dir (const char *path, dir_list *list, sortfn *sort, int count,
     DIR *dirp;
     struct dirent *dp;
     int next_free = 0;
-    int i, status, link_to_dir, stale_link;
+    int i, k, status, link_to_dir, stale_link;
     struct stat st;
-    int marked_cnt;
-    GHashTable *marked_files;
+    int *index, *order, order_size;
+    unsigned int mask;
 
     dirp = mc_opendir (path);
     if (!dirp) {
@@ -501,22 +631,20 @@ do_reload_dir (const char *path, dir_list *list, sortfn *sort, int count,
     }
 
     tree_store_start_check (path);
-    marked_files = g_hash_table_new (g_str_hash, g_str_equal);
     alloc_dir_copy (list->size);
-    for (marked_cnt = i = 0; i < count; i++) {
+    for (i = 0; i < count; i++) {
 	dir_copy.list[i].fnamelen = list->list[i].fnamelen;
 	dir_copy.list[i].fname = list->list[i].fname;
+	dir_copy.list[i].st = list->list[i].st;
 	dir_copy.list[i].f.marked = list->list[i].f.marked;
 	dir_copy.list[i].f.dir_size_computed =
 	    list->list[i].f.dir_size_computed;
 	dir_copy.list[i].f.link_to_dir = list->list[i].f.link_to_dir;
 	dir_copy.list[i].f.stale_link = list->list[i].f.stale_link;
-	if (list->list[i].f.marked) {
-	    g_hash_table_insert (marked_files, dir_copy.list[i].fname,
-				 &dir_copy.list[i]);
-	    marked_cnt++;
-	}
     }
+    index = reload_index (&dir_copy, count, &mask);
+    order_size = list->size;
+    order = g_new (int, order_size);
 
     /* Add ".." except to the root directory. The ".." entry
        (if any) must be the first in the list. */
@@ -524,6 +652,8 @@ do_reload_dir (const char *path, dir_list *list, sortfn *sort, int count,
 	if (set_zero_dir (list) == 0) {
 	    clean_dir (list, count);
 	    clean_dir (&dir_copy, count);
+	    g_free (index);
+	    g_free (order);
 	    return next_free;
 	}
 	next_free++;
@@ -548,26 +678,31 @@ do_reload_dir (const char *path, dir_list *list, sortfn *sort, int count,
 	       clean_dir (&dir_copy, count);
 	     */
 	    tree_store_end_check ();
-	    g_hash_table_destroy (marked_files);
+	    g_free (index);
+	    g_free (order);
 	    return next_free;
 	}
 
-	list->list[next_free].f.marked = 0;
+	if (next_free >= order_size) {
+	    order_size = list->size;
+	    order = g_realloc (order, order_size * sizeof (int));
+	}
 
-	/*
-	 * If we have marked files in the copy, scan through the copy
-	 * to find matching file.  Decrease number of remaining marks if
-	 * we copied one.
-	 */
-	if (marked_cnt > 0) {
-	    if ((g_hash_table_lookup (marked_files, dp->d_name))) {
-		list->list[next_free].f.marked = 1;
-		marked_cnt--;
-	    }
+	k = reload_lookup (&dir_copy, index, mask, dp->d_name);
+	if (k != -1) {
+	    /* Known entry: take over its name and mark */
+	    list->list[next_free].fname = dir_copy.list[k].fname;
+	    list->list[next_free].f.marked = dir_copy.list[k].f.marked;
+	    dir_copy.list[k].fname = NULL;
+	    order[next_free] =
+		reload_same_key (&dir_copy.list[k], &st, link_to_dir) ? k : -1;
+	} else {
+	    list->list[next_free].fname = g_strdup (dp->d_name);
+	    list->list[next_free].f.marked = 0;
+	    order[next_free] = -1;
 	}
 
 	list->list[next_free].fnamelen = NLENGTH (dp);
-	list->list[next_free].fname = g_strdup (dp->d_name);
 	list->list[next_free].f.link_to_dir = link_to_dir;
 	list->list[next_free].f.stale_link = stale_link;
 	list->list[next_free].f.dir_size_computed = 0;
@@ -578,11 +713,14 @@ do_reload_dir (const char *path, dir_list *list, sortfn *sort, int count,
     }
     mc_closedir (dirp);
     tree_store_end_check ();
-    g_hash_table_destroy (marked_files);
+    g_free (index);
     if (next_free) {
-	do_sort (list, sort, next_free - 1, rev, case_sensitive);
+	i = (list->list[0].fname[0] == '.' && list->list[0].fname[1] == '.'
+	     && list->list[0].fname[2] == 0) ? 1 : 0;
+	reload_sort (list, i, next_free, order, count, sort, rev,
+		     case_sensitive);
     }
+    g_free (order);
     clean_dir (&dir_copy, count);
     return next_free;
 }
-
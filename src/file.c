@@ -42,12 +42,20 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#ifdef HAVE_LINUX_FS_H
+#  include <sys/ioctl.h>
+#  include <linux/fs.h>		/* FICLONE */
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#  include <sys/sendfile.h>
+#endif
 
 #include "global.h"
 #include "tty.h"
@@ -86,6 +94,12 @@ int verbose = 1;
  */
 int file_op_compute_totals = 1;
 
+/*
+ * Number of local files copied at the same time by helper processes.
+ * 1 means that copy_file_file does all the work itself.
+ */
+int file_op_copy_slots = 1;
+
 /* This is a hard link cache */
 struct link {
     struct link *next;
@@ -469,6 +483,650 @@ enum {
     DEST_FULL			/* Created, fully copied */
 };
 
+/* How copy_file_file moves the data, best first */
+enum {
+    COPY_RANGE,			/* copy_file_range(2), may share extents */
+    COPY_SENDFILE,		/* sendfile(2), stays in the kernel */
+    COPY_BUFFERED		/* mc_read/mc_write through a buffer */
+};
+
+#define COPY_BUFSIZ	(64 * 1024)		/* buffer for COPY_BUFFERED */
+#define COPY_CHUNK	(8 * 1024 * 1024)	/* bytes per kernel call */
+
+/*
+ * Return the local file descriptor behind a VFS handle, or -1 if the
+ * file does not live on the local filesystem.
+ */
+static int
+copy_local_fd (int handle)
+{
+#ifdef USE_VFS
+    int fd;
+
+    if (mc_ctl (handle, VFS_CTL_GETFD, &fd))
+	return fd;
+    return -1;
+#else
+    return handle;
+#endif				/* USE_VFS */
+}
+
+/*
+ * Make dst_fd share all the extents of src_fd (reflink).  Only works
+ * within one filesystem that supports it, e.g. btrfs or xfs.
+ */
+static int
+copy_clone (int src_fd, int dst_fd)
+{
+#if defined(HAVE_LINUX_FS_H) && defined(FICLONE)
+    return ioctl (dst_fd, FICLONE, src_fd) == 0;
+#else
+    (void) src_fd;
+    (void) dst_fd;
+    return 0;
+#endif
+}
+
+/* Does errno say that the method is not available for these files? */
+static int
+copy_unsupported (int err)
+{
+    switch (err) {
+    case EINVAL:
+    case EBADF:			/* copy_file_range() on O_APPEND target */
+#ifdef ENOSYS
+    case ENOSYS:
+#endif
+#ifdef EXDEV
+    case EXDEV:
+#endif
+#ifdef EOPNOTSUPP
+    case EOPNOTSUPP:
+#endif
+#if defined(ENOTSUP) && (!defined(EOPNOTSUPP) || ENOTSUP != EOPNOTSUPP)
+    case ENOTSUP:
+#endif
+	return 1;
+    default:
+	return 0;
+    }
+}
+
+/*
+ * Move up to COPY_CHUNK bytes from src_fd to dst_fd at their current
+ * offsets without going through user space.  Returns the number of
+ * bytes moved, 0 at EOF, -1 on error.  If the current method turns out
+ * not to work for these files, *method is degraded and -1 is returned
+ * with nothing moved, so that the caller can simply try again.
+ */
+static ssize_t
+copy_kernel (int *method, int src_fd, int dst_fd)
+{
+    ssize_t n;
+
+#ifdef HAVE_COPY_FILE_RANGE
+    if (*method == COPY_RANGE) {
+	n = copy_file_range (src_fd, NULL, dst_fd, NULL, COPY_CHUNK, 0);
+	if (n >= 0 || !copy_unsupported (errno))
+	    return n;
+    }
+#endif
+    if (*method == COPY_RANGE)
+	*method = COPY_SENDFILE;
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+    if (*method == COPY_SENDFILE) {
+	n = sendfile (dst_fd, src_fd, NULL, COPY_CHUNK);
+	if (n >= 0 || !copy_unsupported (errno))
+	    return n;
+    }
+#endif
+    (void) n;
+    (void) src_fd;
+    (void) dst_fd;
+
+    *method = COPY_BUFFERED;
+    return -1;
+}
+
+/*
+ * copy_kernel does not tell which side of the copy failed.  Returns 1
+ * if reading the source fails as well, with errno set by that read,
+ * else 0 with errno left as it was.
+ */
+static int
+copy_kernel_read_error (int src_fd)
+{
+    int saved_errno = errno;
+    off_t pos = lseek (src_fd, 0, SEEK_CUR);
+    char c;
+
+    if (pos != -1 && pread (src_fd, &c, 1, pos) < 0)
+	return 1;
+    errno = saved_errno;
+    return 0;
+}
+
+/*
+ * Copy slots.  Copying many small local files is bound by the latency
+ * of open/write/close rather than by bandwidth, so panel_operate may
+ * hand whole files to a few helper processes, each fed through a pipe.
+ * All decisions that may ask the user (overwrite, hardlinks, ...) are
+ * still made by copy_file_file; the helpers only move the data and set
+ * the attributes.  Their failures are reported back and shown one at a
+ * time when the slot is reaped; "Retry" copies the file again in the
+ * foreground.
+ */
+
+#define COPY_SLOTS_MAX	16
+
+/* Where a helper failed; indexes copy_stage_msg */
+enum {
+    COPY_DONE,
+    COPY_E_OPEN,
+    COPY_E_FSTAT,
+    COPY_E_READ,
+    COPY_E_CREATE,
+    COPY_E_WRITE,
+    COPY_E_CLOSE,
+    COPY_E_CHOWN,
+    COPY_E_CHMOD
+};
+
+static const char *copy_stage_msg[] = {
+    NULL,
+    N_(" Cannot open source file \"%s\" \n %s "),
+    N_(" Cannot fstat source file \"%s\" \n %s "),
+    N_(" Cannot read source file \"%s\" \n %s "),
+    N_(" Cannot create target file \"%s\" \n %s "),
+    N_(" Cannot write target file \"%s\" \n %s "),
+    N_(" Cannot close target file \"%s\" \n %s "),
+    N_(" Cannot chown target file \"%s\" \n %s "),
+    N_(" Cannot chmod target file \"%s\" \n %s ")
+};
+
+/* Request sent to a helper, followed by both path names */
+struct copy_req {
+    int preserve_uidgid;
+    int umask_kill;
+    size_t src_len, dst_len;
+};
+
+/* Reply from a helper: progress reports, then one final status */
+struct copy_msg {
+    int done;			/* 0 for a progress report */
+    int stage;
+    int err;
+    off_t bytes;
+};
+
+struct copy_slot {
+    pid_t pid;			/* 0 if no helper is running */
+    int req_fd, res_fd;
+    char *src, *dst;		/* NULL if the slot is idle */
+    off_t bytes;		/* copied so far */
+    int is_toplevel_file;
+    int mark;			/* panel entry to unmark when done, or -1 */
+};
+
+static struct {
+    FileOpContext *ctx;		/* NULL unless panel_operate enabled us */
+    int nslots;
+    off_t *progress_count;
+    double *progress_bytes;
+    WPanel *panel;
+    int mark;			/* entry panel_operate is working on */
+    struct copy_slot slot[COPY_SLOTS_MAX];
+} copy_pool;
+
+static int copy_pool_inhibit = 0;	/* set while retrying in foreground */
+
+static int
+copy_full_io (int fd, void *buf, size_t len, int writing)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while (len) {
+	n = writing ? write (fd, p, len) : read (fd, p, len);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    return 0;
+	p += n;
+	len -= n;
+    }
+    return 1;
+}
+
+static void
+copy_worker_reply (int fd, int done, int stage, off_t bytes)
+{
+    struct copy_msg msg;
+
+    msg.done = done;
+    msg.stage = stage;
+    msg.err = stage == COPY_DONE ? 0 : errno;
+    msg.bytes = bytes;
+    copy_full_io (fd, &msg, sizeof (msg), 1);
+}
+
+/* Copy one file in a helper, the unattended part of copy_file_file */
+static void
+copy_worker_file (int res_fd, const struct copy_req *req,
+		  const char *src, const char *dst, char *buf)
+{
+    struct stat sb;
+    struct utimbuf utb;
+    int src_fd, dst_fd, method = COPY_BUFFERED;
+    int stage = COPY_DONE, err = 0;
+    off_t total = 0, reported = 0;
+    ssize_t n, m;
+
+    if ((src_fd = open (src, O_RDONLY)) < 0) {
+	copy_worker_reply (res_fd, 1, COPY_E_OPEN, 0);
+	return;
+    }
+    if (fstat (src_fd, &sb)) {
+	copy_worker_reply (res_fd, 1, COPY_E_FSTAT, 0);
+	close (src_fd);
+	return;
+    }
+    if ((dst_fd = open (dst, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+	copy_worker_reply (res_fd, 1, COPY_E_CREATE, 0);
+	close (src_fd);
+	return;
+    }
+
+    if (S_ISREG (sb.st_mode) && sb.st_size > 0) {
+	method = COPY_RANGE;
+	if (copy_clone (src_fd, dst_fd)) {
+	    total = sb.st_size;
+	    method = -1;
+	}
+    }
+
+    while (method != -1) {
+	if (method != COPY_BUFFERED) {
+	    n = copy_kernel (&method, src_fd, dst_fd);
+	    if (n < 0 && method == COPY_BUFFERED)
+		continue;
+	    if (n < 0 && copy_kernel_read_error (src_fd))
+		stage = COPY_E_READ;
+	} else {
+	    while ((n = read (src_fd, buf, COPY_BUFSIZ)) < 0 && errno == EINTR);
+	    if (n < 0)
+		stage = COPY_E_READ;
+	    m = 0;
+	    while (n > 0 && m < n) {
+		ssize_t w = write (dst_fd, buf + m, n - m);
+
+		if (w < 0 && errno == EINTR)
+		    continue;
+		if (w <= 0) {
+		    n = -1;
+		    break;
+		}
+		m += w;
+	    }
+	}
+	if (n < 0) {
+	    copy_worker_reply (res_fd, 1, stage == COPY_E_READ ? stage
+			       : COPY_E_WRITE, total);
+	    close (src_fd);
+	    close (dst_fd);
+	    return;
+	}
+	if (n == 0)
+	    break;
+	total += n;
+	if (total - reported >= COPY_CHUNK / 8) {
+	    copy_worker_reply (res_fd, 0, COPY_DONE, total);
+	    reported = total;
+	}
+    }
+
+    close (src_fd);
+    if (close (dst_fd)) {
+	copy_worker_reply (res_fd, 1, COPY_E_CLOSE, total);
+	return;
+    }
+
+    /* Like copy_file_file, set the mode and times even if chown fails */
+    if (req->preserve_uidgid && chown (dst, sb.st_uid, sb.st_gid)) {
+	stage = COPY_E_CHOWN;
+	err = errno;
+    }
+    if (!(sb.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO)))
+	sb.st_mode |= S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+    if (chmod (dst, sb.st_mode & req->umask_kill) && stage == COPY_DONE) {
+	stage = COPY_E_CHMOD;
+	err = errno;
+    }
+    utb.actime = sb.st_atime;
+    utb.modtime = sb.st_mtime;
+    utime (dst, &utb);
+
+    errno = err;
+    copy_worker_reply (res_fd, 1, stage, total);
+}
+
+static void
+copy_worker (int req_fd, int res_fd)
+{
+    struct copy_req req;
+    char *buf = g_malloc (COPY_BUFSIZ);
+    char *src, *dst;
+
+    signal (SIGINT, SIG_IGN);
+    signal (SIGCHLD, SIG_DFL);
+
+    while (copy_full_io (req_fd, &req, sizeof (req), 0)) {
+	src = g_malloc (req.src_len + 1);
+	dst = g_malloc (req.dst_len + 1);
+	if (!copy_full_io (req_fd, src, req.src_len, 0)
+	    || !copy_full_io (req_fd, dst, req.dst_len, 0))
+	    break;
+	src[req.src_len] = 0;
+	dst[req.dst_len] = 0;
+	copy_worker_file (res_fd, &req, src, dst, buf);
+	g_free (src);
+	g_free (dst);
+    }
+    _exit (0);
+}
+
+static int
+copy_slot_spawn (struct copy_slot *slot)
+{
+    int req[2], res[2];
+
+    if (pipe (req))
+	return 0;
+    if (pipe (res)) {
+	close (req[0]);
+	close (req[1]);
+	return 0;
+    }
+
+    slot->pid = fork ();
+    if (slot->pid == 0) {
+	int i;
+
+	/* Other helpers must see EOF when the parent lets them go */
+	for (i = 0; i < copy_pool.nslots; i++)
+	    if (copy_pool.slot[i].pid) {
+		close (copy_pool.slot[i].req_fd);
+		close (copy_pool.slot[i].res_fd);
+	    }
+	close (req[1]);
+	close (res[0]);
+	copy_worker (req[0], res[1]);
+    }
+    close (req[0]);
+    close (res[1]);
+    if (slot->pid < 0) {
+	slot->pid = 0;
+	close (req[1]);
+	close (res[0]);
+	return 0;
+    }
+
+    slot->req_fd = req[1];
+    slot->res_fd = res[0];
+    fcntl (slot->req_fd, F_SETFD, FD_CLOEXEC);	/* keep them from the subshell */
+    fcntl (slot->res_fd, F_SETFD, FD_CLOEXEC);
+    return 1;
+}
+
+static void
+copy_slot_kill (struct copy_slot *slot, int sig)
+{
+    if (!slot->pid)
+	return;
+    close (slot->req_fd);
+    close (slot->res_fd);
+    if (sig)
+	kill (slot->pid, sig);
+    waitpid (slot->pid, NULL, 0);
+    slot->pid = 0;
+}
+
+/* Settle a finished slot: report errors, update the progress counters */
+static int
+copy_slot_finish (FileOpContext *ctx, struct copy_slot *slot,
+		  const struct copy_msg *msg)
+{
+    int status = FILE_CONT;
+
+    if (msg->stage == COPY_DONE) {
+	status = progress_update_one (ctx, copy_pool.progress_count,
+				      copy_pool.progress_bytes, msg->bytes,
+				      slot->is_toplevel_file);
+    } else {
+	errno = msg->err;
+	status = file_error (ctx, _(copy_stage_msg[msg->stage]),
+			     msg->stage <= COPY_E_READ ? slot->src : slot->dst);
+	if (status == FILE_RETRY) {
+	    copy_pool_inhibit++;
+	    status = copy_file_file (ctx, slot->src, slot->dst, 0,
+				     copy_pool.progress_count,
+				     copy_pool.progress_bytes,
+				     slot->is_toplevel_file);
+	    copy_pool_inhibit--;
+	} else if (msg->stage == COPY_E_READ || msg->stage == COPY_E_WRITE) {
+	    if (!query_dialog (_("Copy"),
+			       _("Incomplete file was retrieved. Keep it?"),
+			       D_ERROR, 2, _("&Delete"), _("&Keep")))
+		mc_unlink (slot->dst);
+	}
+    }
+
+    if (status == FILE_CONT && slot->mark != -1)
+	do_file_mark (copy_pool.panel, slot->mark, 0);
+    g_free (slot->src);
+    g_free (slot->dst);
+    slot->src = slot->dst = NULL;
+    return status;
+}
+
+/* Throw away the helpers and whatever they were copying */
+static void
+copy_pool_abort (void)
+{
+    struct copy_slot *slot;
+    int i;
+
+    for (i = 0; i < copy_pool.nslots; i++) {
+	slot = &copy_pool.slot[i];
+	if (slot->src) {
+	    copy_slot_kill (slot, SIGKILL);
+	    mc_unlink (slot->dst);
+	    g_free (slot->src);
+	    g_free (slot->dst);
+	    slot->src = slot->dst = NULL;
+	}
+    }
+}
+
+/*
+ * Reap finished helpers.  Wait until at least one slot is idle, or
+ * until all of them are if `all' is set, updating the progress
+ * display meanwhile.  Returns FILE_ABORT if the user gave up, and
+ * FILE_SKIP if any file was skipped.
+ */
+static int
+copy_pool_wait (FileOpContext *ctx, int all)
+{
+    struct copy_slot *slot;
+    struct copy_msg msg;
+    struct timeval tv;
+    fd_set set;
+    double inflight;
+    int i, n, busy, maxfd, status, result = FILE_CONT;
+
+    for (;;) {
+	busy = maxfd = 0;
+	FD_ZERO (&set);
+	for (i = 0; i < copy_pool.nslots; i++) {
+	    slot = &copy_pool.slot[i];
+	    if (!slot->src)
+		continue;
+	    busy++;
+	    FD_SET (slot->res_fd, &set);
+	    if (slot->res_fd > maxfd)
+		maxfd = slot->res_fd;
+	}
+	if (!busy || (!all && busy < copy_pool.nslots))
+	    return result;
+
+	tv.tv_sec = 0;
+	tv.tv_usec = 200000;
+	n = select (maxfd + 1, &set, NULL, NULL, &tv);
+	if (n < 0 && errno != EINTR) {
+	    for (i = 0; !copy_pool.slot[i].src; i++);
+	    status = file_error (ctx,
+		    _(" Cannot wait for the copy of \"%s\" \n %s "),
+		    copy_pool.slot[i].src);
+	    if (status == FILE_RETRY)
+		continue;
+	    /* Nothing tells when the files in flight are done */
+	    copy_pool_abort ();
+	    if (status == FILE_ABORT)
+		return FILE_ABORT;
+	    result = FILE_SKIP;
+	    continue;
+	}
+
+	for (i = 0; n > 0 && i < copy_pool.nslots; i++) {
+	    slot = &copy_pool.slot[i];
+	    if (!slot->src || !FD_ISSET (slot->res_fd, &set))
+		continue;
+	    if (!copy_full_io (slot->res_fd, &msg, sizeof (msg), 0)) {
+		/* The helper died, blame the file it was copying */
+		copy_slot_kill (slot, SIGKILL);
+		msg.done = 1;
+		msg.stage = COPY_E_WRITE;
+		msg.err = EIO;
+	    }
+	    if (!msg.done) {
+		slot->bytes = msg.bytes;
+		continue;
+	    }
+	    status = copy_slot_finish (ctx, slot, &msg);
+	    if (status == FILE_ABORT) {
+		copy_pool_abort ();
+		return FILE_ABORT;
+	    }
+	    if (status != FILE_CONT)
+		result = FILE_SKIP;
+	}
+
+	inflight = 0;
+	for (i = 0; i < copy_pool.nslots; i++)
+	    if (copy_pool.slot[i].src)
+		inflight += copy_pool.slot[i].bytes;
+	if (file_progress_show_bytes (ctx, *copy_pool.progress_bytes +
+		inflight, ctx->progress_bytes) == FILE_ABORT) {
+	    copy_pool_abort ();
+	    return FILE_ABORT;
+	}
+	mc_refresh ();
+    }
+}
+
+/*
+ * Let a helper copy src_path to dst_path.  Returns -1 if no helper
+ * could take the job, so that the caller copies the file itself,
+ * FILE_ABORT if the user gave up while slots were reaped to make
+ * room, and FILE_CONT otherwise.
+ */
+static int
+copy_pool_submit (FileOpContext *ctx, const char *src_path,
+		  const char *dst_path, int is_toplevel_file)
+{
+    struct copy_slot *slot = NULL;
+    struct copy_req req;
+    int i;
+
+    if (copy_pool_wait (ctx, 0) == FILE_ABORT)
+	return FILE_ABORT;
+
+    for (i = 0; i < copy_pool.nslots; i++)
+	if (!copy_pool.slot[i].src) {
+	    slot = &copy_pool.slot[i];
+	    break;
+	}
+    if (!slot || (!slot->pid && !copy_slot_spawn (slot)))
+	return -1;
+
+    req.preserve_uidgid = ctx->preserve_uidgid;
+    req.umask_kill = ctx->umask_kill;
+    req.src_len = strlen (src_path);
+    req.dst_len = strlen (dst_path);
+    if (!copy_full_io (slot->req_fd, &req, sizeof (req), 1)
+	|| !copy_full_io (slot->req_fd, (char *) src_path, req.src_len, 1)
+	|| !copy_full_io (slot->req_fd, (char *) dst_path, req.dst_len, 1)) {
+	copy_slot_kill (slot, SIGKILL);
+	return -1;
+    }
+
+    slot->src = g_strdup (src_path);
+    slot->dst = g_strdup (dst_path);
+    slot->bytes = 0;
+    slot->is_toplevel_file = is_toplevel_file;
+    slot->mark = -1;
+    if (is_toplevel_file) {
+	slot->mark = copy_pool.mark;
+	copy_pool.mark = -1;
+    }
+    return FILE_CONT;
+}
+
+/* Start using copy slots for the file operation ctx, if configured */
+static void
+copy_pool_begin (FileOpContext *ctx, WPanel *panel, off_t *progress_count,
+		 double *progress_bytes)
+{
+    if (ctx->operation != OP_COPY || file_op_copy_slots <= 1)
+	return;
+
+    copy_pool.ctx = ctx;
+    copy_pool.nslots = min (file_op_copy_slots, COPY_SLOTS_MAX);
+    copy_pool.progress_count = progress_count;
+    copy_pool.progress_bytes = progress_bytes;
+    copy_pool.panel = panel;
+    copy_pool.mark = -1;
+}
+
+/* Wait for all files in flight; ctx's directories may then be finalized */
+static int
+copy_pool_drain (FileOpContext *ctx)
+{
+    if (copy_pool.ctx != ctx)
+	return FILE_CONT;
+    return copy_pool_wait (ctx, 1);
+}
+
+/*
+ * Stop using copy slots.  Whatever is still in flight was left there
+ * by an aborted operation and is thrown away; the other paths out of
+ * panel_operate drain the slots first and use the status.
+ */
+static void
+copy_pool_end (FileOpContext *ctx)
+{
+    int i;
+
+    if (copy_pool.ctx != ctx)
+	return;
+
+    copy_pool_abort ();
+    for (i = 0; i < copy_pool.nslots; i++)
+	copy_slot_kill (&copy_pool.slot[i], 0);
+    copy_pool.ctx = NULL;
+}
+
 int
 copy_file_file (FileOpContext *ctx, const char *src_path, const char *dst_path,
 		int ask_overwrite, off_t *progress_count,
@@ -478,8 +1136,9 @@ copy_file_file (FileOpContext *ctx, const char *src_path, const char *dst_path,
     gid_t src_gid = (gid_t) - 1;
 
     char *buf = NULL;
-    int buf_size = BUF_8K;
+    int buf_size = COPY_BUFSIZ;
     int src_desc, dest_desc = -1;
+    int src_fd, dst_fd, method = COPY_BUFFERED;
     int n_read, n_written;
     mode_t src_mode = 0;		/* The mode of the source file */
     struct stat sb, sb2;
@@ -587,6 +1246,21 @@ copy_file_file (FileOpContext *ctx, const char *src_path, const char *dst_path,
 	}
     }
 
+    /*
+     * Plain local files may go to a copy slot.  Files with other links
+     * are copied here, so that the target exists by the time
+     * check_hardlinks wants to link the next name to it.
+     */
+    if (copy_pool.ctx == ctx && !copy_pool_inhibit && !ctx->do_append
+	&& !ctx->do_reget && S_ISREG (sb.st_mode)
+	&& (ctx->follow_links || sb.st_nlink <= 1)
+	&& vfs_file_is_local (src_path) && vfs_file_is_local (dst_path)) {
+	return_status = copy_pool_submit (ctx, src_path, dst_path,
+					  is_toplevel_file);
+	if (return_status != -1)
+	    return return_status;
+    }
+
     gettimeofday (&tv_transfer_start, (struct timezone *) NULL);
 
     while ((src_desc = mc_open (src_path, O_RDONLY | O_LINEAR)) < 0) {
@@ -649,6 +1323,13 @@ copy_file_file (FileOpContext *ctx, const char *src_path, const char *dst_path,
     }
     buf = g_malloc (buf_size);
 
+    /* Both ends local: let the kernel move the data.  Files reporting
+       size 0 (e.g. in /proc) are left to the plain read loop.  */
+    src_fd = copy_local_fd (src_desc);
+    dst_fd = copy_local_fd (dest_desc);
+    if (src_fd != -1 && dst_fd != -1 && S_ISREG (src_mode) && file_size > 0)
+	method = COPY_RANGE;
+
     ctx->eta_secs = 0.0;
     ctx->bps = 0;
 
@@ -659,7 +1340,18 @@ copy_file_file (FileOpContext *ctx, const char *src_path, const char *dst_path,
     if (return_status != FILE_CONT)
 	goto ret;
 
-    {
+    if (method != COPY_BUFFERED && !appending && !ctx->do_reget
+	&& copy_clone (src_fd, dst_fd)) {
+	/* The target shares the source extents, nothing left to move */
+	n_read_total = file_size;
+	return_status = file_progress_show_bytes (ctx, *progress_bytes +
+		n_read_total, ctx->progress_bytes);
+	if (return_status == FILE_CONT)
+	    return_status = file_progress_show (ctx, n_read_total, file_size);
+	mc_refresh ();
+	if (return_status != FILE_CONT)
+	    goto ret;
+    } else {
 	struct timeval tv_current, tv_last_update, tv_last_input;
 	int secs, update_secs;
 	long dt;
@@ -668,8 +1360,25 @@ copy_file_file (FileOpContext *ctx, const char *src_path, const char *dst_path,
 	tv_last_update = tv_transfer_start;
 
 	for (;;) {
+	    if (method != COPY_BUFFERED) {
+		/* src_read and dst_write in one go */
+		n_read = copy_kernel (&method, src_fd, dst_fd);
+		if (n_read < 0) {
+		    if (method == COPY_BUFFERED)
+			continue;
+		    if (copy_kernel_read_error (src_fd))
+			return_status = file_error (ctx,
+			    _(" Cannot read source file \"%s\" \n %s "), src_path);
+		    else
+			return_status = file_error (ctx,
+			    _(" Cannot write target file \"%s\" \n %s "), dst_path);
+		    if (return_status == FILE_RETRY)
+			continue;
+		    goto ret;
+		}
+	    }
 	    /* src_read */
-	    if (mc_ctl (src_desc, VFS_CTL_IS_NOTREADY, 0))
+	    else if (mc_ctl (src_desc, VFS_CTL_IS_NOTREADY, 0))
 		n_read = -1;
 	    else
 		while ((n_read = mc_read (src_desc, buf, buf_size)) < 0) {
@@ -697,7 +1406,7 @@ copy_file_file (FileOpContext *ctx, const char *src_path, const char *dst_path,
 		gettimeofday (&tv_last_input, NULL);
 
 		/* dst_write */
-		while ((n_written =
+		while (method == COPY_BUFFERED && (n_written =
 			mc_write (dest_desc, t, n_read)) < n_read) {
 		    if (n_written > 0) {
 			n_read -= n_written;
@@ -1014,6 +1723,10 @@ copy_dir_dir (FileOpContext *ctx, const char *s, const char *d, int toplevel,
     }
     mc_closedir (reading);
 
+    /* Files still in copy slots would touch the directory again */
+    if (copy_pool_drain (ctx) == FILE_ABORT)
+	return_status = FILE_ABORT;
+
     if (ctx->preserve) {
 	mc_chmod (dest_dir, cbuf.st_mode & ctx->umask_kill);
 	utb.actime = cbuf.st_atime;
@@ -1499,6 +2212,244 @@ panel_get_file (WPanel *panel, struct stat *stat_buf)
     return NULL;
 }
 
+#if defined(HAVE_OPENAT) && defined(HAVE_FSTATAT) && defined(HAVE_FDOPENDIR)
+#define DSIZE_LOCAL
+#endif
+
+#ifdef DSIZE_LOCAL
+/*
+ * Sizes of local directories, remembered across compute_dir_size()
+ * calls so that sizing a sibling or starting a copy right after
+ * sizing does not walk the same tree again.  Every directory keeps the
+ * totals of the files directly in it and the names of its
+ * subdirectories; an entry is trusted as long as the mtime of the
+ * directory is unchanged, which means that the set of its entries is
+ * the same.  Revisiting a cached tree costs one fstat per directory.
+ *
+ * The mtime does not move when a file in the directory grows in place,
+ * so the whole cache is dropped by compute_dir_size_flush() whenever
+ * the panels are updated and when a file operation ends.
+ */
+struct dsize_entry {
+    struct dsize_entry *next;
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    off_t count;		/* files directly in the directory */
+    double bytes;
+    int nsubdirs;
+    char *subdirs;		/* their names, each one NUL-terminated */
+};
+
+#define DSIZE_HASH	4096	/* buckets */
+#define DSIZE_MAX	65536	/* entries before the cache is flushed */
+
+static struct dsize_entry *dsize_hash[DSIZE_HASH];
+static int dsize_entries = 0;
+
+static struct dsize_entry **
+dsize_bucket (const struct stat *st)
+{
+    return &dsize_hash[((unsigned long) st->st_ino * 31 + st->st_dev)
+		       % DSIZE_HASH];
+}
+
+static void
+dsize_flush (void)
+{
+    struct dsize_entry *e;
+    int i;
+
+    for (i = 0; i < DSIZE_HASH; i++)
+	while ((e = dsize_hash[i]) != NULL) {
+	    dsize_hash[i] = e->next;
+	    g_free (e->subdirs);
+	    g_free (e);
+	}
+    dsize_entries = 0;
+}
+
+/* Find the entry for the directory st, dropping it if it is stale */
+static struct dsize_entry *
+dsize_lookup (const struct stat *st)
+{
+    struct dsize_entry **p, *e;
+
+    for (p = dsize_bucket (st); (e = *p) != NULL; p = &e->next) {
+	if (e->ino != st->st_ino || e->dev != st->st_dev)
+	    continue;
+	if (e->mtime == st->st_mtime)
+	    return e;
+	*p = e->next;
+	g_free (e->subdirs);
+	g_free (e);
+	dsize_entries--;
+	break;
+    }
+    return NULL;
+}
+
+static void
+dsize_store (const struct stat *st, off_t count, double bytes,
+	     int nsubdirs, char *subdirs)
+{
+    struct dsize_entry **p, *e;
+
+    if (dsize_entries >= DSIZE_MAX)
+	dsize_flush ();
+
+    e = g_new (struct dsize_entry, 1);
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->mtime = st->st_mtime;
+    e->count = count;
+    e->bytes = bytes;
+    e->nsubdirs = nsubdirs;
+    e->subdirs = subdirs;
+
+    p = dsize_bucket (st);
+    e->next = *p;
+    *p = e;
+    dsize_entries++;
+}
+
+static FileProgressStatus dsize_walk (int fd, const struct stat *st,
+				      const char *path, off_t *ret_marked,
+				      double *ret_total,
+				      const ComputeDirSizeUI *ui,
+				      ComputeDirSizeCallback callback);
+
+static FileProgressStatus
+dsize_subdir (int dfd, const char *path, const char *name,
+	      off_t *ret_marked, double *ret_total,
+	      const ComputeDirSizeUI *ui, ComputeDirSizeCallback callback)
+{
+    FileProgressStatus rv;
+    struct stat st;
+    char *fullname;
+    int fd;
+
+    fd = openat (dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if (fd == -1)
+	return FILE_SKIP;
+    if (fstat (fd, &st)) {
+	close (fd);
+	return FILE_SKIP;
+    }
+
+    fullname = concat_dir_and_file (path, name);
+    rv = dsize_walk (fd, &st, fullname, ret_marked, ret_total, ui, callback);
+    g_free (fullname);
+    return rv;
+}
+
+/*
+ * compute_dir_size() for a local directory open on fd, which is closed
+ * on return.  Entries are looked up relative to the directory, so no
+ * path is resolved twice, and the UI is updated once per directory
+ * (and every 1024 entries) rather than for every file.
+ */
+static FileProgressStatus
+dsize_walk (int fd, const struct stat *st, const char *path,
+	    off_t *ret_marked, double *ret_total,
+	    const ComputeDirSizeUI *ui, ComputeDirSizeCallback callback)
+{
+    FileProgressStatus rv = FILE_CONT;
+    struct dsize_entry *e;
+    struct dirent *dirent;
+    struct stat s;
+    DIR *dir;
+    const char *name;
+    char *subdirs = NULL;
+    size_t len = 0, n;
+    int i, nsubdirs = 0, complete = 1, entries = 0;
+    off_t count = 0;
+    double bytes = 0;
+
+    if (callback) {
+	rv |= callback (ui, path);
+	if (rv == FILE_ABORT) {
+	    close (fd);
+	    return rv;
+	}
+    }
+
+    if ((e = dsize_lookup (st)) != NULL) {
+	*ret_marked += e->count;
+	*ret_total += e->bytes;
+	name = e->subdirs;
+	for (i = 0; i < e->nsubdirs && rv != FILE_ABORT; i++) {
+	    rv |= dsize_subdir (fd, path, name, ret_marked, ret_total,
+				ui, callback);
+	    name += strlen (name) + 1;
+	}
+	close (fd);
+	return rv;
+    }
+
+    if ((dir = fdopendir (fd)) == NULL) {
+	close (fd);
+	return FILE_SKIP;
+    }
+
+    while (rv != FILE_ABORT && (dirent = readdir (dir)) != NULL) {
+	if (strcmp (dirent->d_name, ".") == 0)
+	    continue;
+	if (strcmp (dirent->d_name, "..") == 0)
+	    continue;
+
+	if (callback && (++entries & 1023) == 0) {
+	    rv |= callback (ui, path);
+	    if (rv == FILE_ABORT)
+		break;
+	}
+
+	if (fstatat (dirfd (dir), dirent->d_name, &s, AT_SYMLINK_NOFOLLOW)) {
+	    rv |= FILE_SKIP;
+	    complete = 0;
+	    continue;
+	}
+
+	if (S_ISDIR (s.st_mode)) {
+	    n = strlen (dirent->d_name) + 1;
+	    subdirs = g_realloc (subdirs, len + n);
+	    memcpy (subdirs + len, dirent->d_name, n);
+	    len += n;
+	    nsubdirs++;
+
+	    rv |= dsize_subdir (dirfd (dir), path, dirent->d_name,
+				ret_marked, ret_total, ui, callback);
+	} else {
+	    count++;
+	    bytes += s.st_size;
+	}
+    }
+    closedir (dir);
+
+    *ret_marked += count;
+    *ret_total += bytes;
+
+    /*
+     * A directory changed within the current second may change again
+     * without its mtime moving on, so it is not remembered yet.
+     */
+    if (rv != FILE_ABORT && complete && st->st_mtime < time (NULL))
+	dsize_store (st, count, bytes, nsubdirs, subdirs);
+    else
+	g_free (subdirs);
+    return rv;
+}
+#endif				/* DSIZE_LOCAL */
+
+/* Forget the directory sizes remembered by compute_dir_size() */
+void
+compute_dir_size_flush (void)
+{
+#ifdef DSIZE_LOCAL
+    dsize_flush ();
+#endif				/* DSIZE_LOCAL */
+}
+
 /**
  * compute_dir_size:
  *
@@ -1520,6 +2471,23 @@ compute_dir_size (const char *dirname, off_t *ret_marked, double *ret_total,
     DIR *dir;
     struct dirent *dirent;
 
+#ifdef DSIZE_LOCAL
+    if (vfs_file_is_local (dirname)) {
+	struct stat st;
+	int fd;
+
+	fd = open (dirname, O_RDONLY | O_DIRECTORY);
+	if (fd == -1)
+	    return FILE_SKIP;
+	if (fstat (fd, &st)) {
+	    close (fd);
+	    return FILE_SKIP;
+	}
+	return dsize_walk (fd, &st, dirname, ret_marked, ret_total, ui,
+			   callback);
+    }
+#endif				/* DSIZE_LOCAL */
+
     dir = mc_opendir (dirname);
 
     if (!dir)
@@ -1750,6 +2718,58 @@ panel_operate_generate_prompt (const WPanel *panel, const int operation,
     }
 }
 
+#ifdef USE_VFS
+/* Tell the vfs which marked files are about to be read */
+static void
+panel_prefetch (const WPanel *panel)
+{
+    char **names;
+    int i, n = 0;
+
+    if (vfs_file_is_local (panel->cwd))
+	return;
+
+    names = g_new (char *, panel->marked + 1);
+    for (i = 0; i < panel->count && n < panel->marked; i++)
+	if (panel->dir.list[i].f.marked)
+	    names[n++] = panel->dir.list[i].fname;
+    names[n] = NULL;
+    mc_setctl (panel->cwd, VFS_SETCTL_PREFETCH, names);
+    g_free (names);
+}
+
+/* Send the deletions the vfs has queued, and ask about those which
+   failed.  Retrying one deletes it the usual way */
+static void
+erase_batch_end (FileOpContext *ctx, const char *path)
+{
+    GList *failed = NULL, *l;
+    struct stat buf;
+    const char *format;
+    int return_status = FILE_CONT;
+
+    mc_setctl (path, VFS_SETCTL_BATCH_END, &failed);
+    for (l = failed; l; l = l->next) {
+	const char *s = l->data;
+
+	/* Gone anyway, or the user has had enough */
+	if (return_status == FILE_ABORT || mc_lstat (s, &buf)) {
+	    g_free (l->data);
+	    continue;
+	}
+	format = S_ISDIR (buf.st_mode)
+	    ? _(" Cannot remove directory \"%s\" \n %s ")
+	    : _(" Cannot delete file \"%s\" \n %s ");
+	errno = E_REMOTE;
+	while ((return_status = file_error (ctx, format, s)) == FILE_RETRY)
+	    if ((S_ISDIR (buf.st_mode) ? my_rmdir (s) : mc_unlink (s)) == 0)
+		break;
+	g_free (l->data);
+    }
+    g_list_free (failed);
+}
+#endif				/* USE_VFS */
+
 /**
  * panel_operate:
  *
@@ -1776,6 +2796,9 @@ panel_operate (void *source_panel, FileOperation operation,
     char *dest = NULL;
     const char *temp = NULL;
     char *save_cwd = NULL, *save_dest = NULL;
+#ifdef USE_VFS
+    char *save_batch = NULL;
+#endif				/* USE_VFS */
     int single_entry = (get_current_type () == view_tree)
 	|| (panel->marked <= 1) || force_single;
     struct stat src_stat, dst_stat;
@@ -1881,6 +2904,12 @@ panel_operate (void *source_panel, FileOperation operation,
 	if (mc_setctl (panel->cwd, VFS_SETCTL_STALE_DATA, (void *) 1))
 	    save_cwd = g_strdup (panel->cwd);
     }
+#ifdef USE_VFS
+    /* A remote vfs may send the deletions in batches */
+    if (operation == OP_DELETE
+	&& mc_setctl (panel->cwd, VFS_SETCTL_BATCH_BEGIN, NULL))
+	save_batch = g_strdup (panel->cwd);
+#endif				/* USE_VFS */
 
     /* Now, let's do the job */
 
@@ -1889,6 +2918,8 @@ panel_operate (void *source_panel, FileOperation operation,
     else
 	file_op_context_create_ui (ctx, 1);
 
+    copy_pool_begin (ctx, panel, &count, &bytes);
+
     /* This code is only called by the tree and panel code */
     if (single_entry) {
 	/* We now have ETA in all cases */
@@ -1954,6 +2985,10 @@ panel_operate (void *source_panel, FileOperation operation,
 	    }
 	}			/* Copy or move operation */
 
+	/* The file may still be in a copy slot */
+	if (value == FILE_CONT)
+	    value = copy_pool_drain (ctx);
+
 	if ((value == FILE_CONT) && !force_single)
 	    unmark_files (panel);
     } else {
@@ -1984,6 +3019,11 @@ panel_operate (void *source_panel, FileOperation operation,
 	    ctx->progress_bytes = panel->total;
 	}
 
+#ifdef USE_VFS
+	if (operation != OP_DELETE)
+	    panel_prefetch (panel);
+#endif				/* USE_VFS */
+
 	/* Loop for every file, perform the actual copy operation */
 	for (i = 0; i < panel->count; i++) {
 	    if (!panel->dir.list[i].f.marked)
@@ -1991,6 +3031,7 @@ panel_operate (void *source_panel, FileOperation operation,
 
 	    source = panel->dir.list[i].fname;
 	    src_stat = panel->dir.list[i].st;
+	    copy_pool.mark = i;
 
 #ifdef WITH_FULL_PATHS
 	    g_free (source_with_path);
@@ -2052,8 +3093,10 @@ panel_operate (void *source_panel, FileOperation operation,
 	    if (value == FILE_ABORT)
 		goto clean_up;
 
-	    if (value == FILE_CONT)
+	    /* Files handed to a copy slot are unmarked when they are done */
+	    if (value == FILE_CONT && copy_pool.mark == i)
 		do_file_mark (panel, i, 0);
+	    copy_pool.mark = -1;
 
 	    if (file_progress_show_count (ctx, count, ctx->progress_count)
 		== FILE_ABORT)
@@ -2071,9 +3114,20 @@ panel_operate (void *source_panel, FileOperation operation,
 
 	    mc_refresh ();
 	}			/* Loop for every file */
+
+	/* Skipped files stay marked, the rest are unmarked when reaped */
+	copy_pool_drain (ctx);
     }				/* Many entries */
   clean_up:
     /* Clean up */
+#ifdef USE_VFS
+    if (save_batch) {
+	erase_batch_end (ctx, save_batch);
+	g_free (save_batch);
+    }
+#endif				/* USE_VFS */
+    copy_pool_end (ctx);
+    compute_dir_size_flush ();
 
     if (save_cwd) {
 	mc_setctl (save_cwd, VFS_SETCTL_STALE_DATA, NULL);
@@ -19,6 +19,7 @@ int erase_dir (FileOpContext *ctx, const char *s, off_t *progress_count,
 int panel_operate (void *source_panel, FileOperation op, int force_single);
 
 extern int file_op_compute_totals;
+extern int file_op_copy_slots;
 
 /* Error reporting routines */
 
@@ -29,5 +30,6 @@ int file_error (FileOpContext *ctx, const char *format, const char *file);
 
 FileProgressStatus compute_dir_size (const char *dirname, off_t *ret_marked,
 		       double *ret_total, const ComputeDirSizeUI *ui, ComputeDirSizeCallback callback);
+void compute_dir_size_flush (void);
 
 #endif
@@ -1266,6 +1266,13 @@ application_keypad_mode (void)
  */
 int
 is_idle (void)
+{
+    return is_idle_wait (0);
+}
+
+/* Like is_idle(), but waits up to msec milliseconds for an event */
+int
+is_idle_wait (int msec)
 {
     int maxfdp;
     fd_set select_set;
@@ -1280,8 +1287,8 @@ is_idle (void)
 	maxfdp = max (maxfdp, gpm_fd);
     }
 #endif
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 0;
+    timeout.tv_sec = msec / 1000;
+    timeout.tv_usec = (msec % 1000) * 1000;
     return (select (maxfdp + 1, &select_set, 0, 0, &timeout) <= 0);
 }
 
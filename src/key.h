@@ -8,6 +8,7 @@ void done_key (void);
 struct Gpm_Event;
 int get_event (struct Gpm_Event *event, int redo_event, int block);
 int is_idle (void);
+int is_idle_wait (int msec);
 
 int mi_getch (void);
 /* Possible return values from get_event: */
@@ -60,6 +60,7 @@
 #include "listmode.h"
 #include "execute.h"
 #include "ext.h"		/* For flush_extension_file() */
+#include "file.h"		/* compute_dir_size_flush() */
 
 /* Listbox for the command history feature */
 #include "widget.h"
@@ -412,6 +413,7 @@ update_panels (int force_update, const char *current_file)
     int reload_other = !(force_update & UP_ONLY_CURRENT);
     WPanel *panel;
 
+    compute_dir_size_flush ();
     update_one_panel (get_current_index (), force_update, current_file);
     if (reload_other)
 	update_one_panel (get_other_index (), force_update, UP_KEEPSEL);
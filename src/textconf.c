@@ -32,6 +32,9 @@ static const char *const vfs_supported[] = {
     "tarfs",
     "extfs",
     "cpiofs",
+#ifdef HAVE_LIBZ
+    "zipfs",
+#endif
 #ifdef USE_NETCODE
     "ftpfs",
     "fish",
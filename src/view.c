@@ -42,6 +42,16 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#include <signal.h>
+#endif
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#ifdef HAVE_SYS_STATFS_H
+#include <sys/statfs.h>
+#endif
+#endif
 
 #include "global.h"
 #include "tty.h"
@@ -76,6 +86,11 @@
 /* Block size for reading files in parts */
 #define VIEW_PAGE_SIZE		((size_t) 8192)
 #define VIEW_COORD_CACHE_GRANUL	1024
+#define VIEW_INDEX_GRANUL	((offset_type) 65536)	/* Spacing of indexed line starts */
+#define VIEW_INDEX_STEP		((offset_type) 1048576)	/* Bytes indexed when idle */
+#define VIEW_SEARCH_BLOCK	((size_t) 65536)	/* for plain and hex searches */
+#define VIEW_SEARCH_LINE_MAX	((size_t) 1048576)	/* for regexp searches */
+#define VIEW_FILE_BLOCKS	16	/* Blocks cached of a VFS file */
 
 typedef unsigned char byte;
 
@@ -114,9 +129,18 @@ enum view_ds {
     DS_STDIO_PIPE,		/* Data comes from a pipe using popen/pclose */
     DS_VFS_PIPE,		/* Data comes from a piped-in VFS file */
     DS_FILE,			/* Data comes from a VFS file */
+    DS_MMAP,			/* Data comes from a mapped local file */
     DS_STRING			/* Data comes from a string in memory */
 };
 
+/* A block of a VFS file in the cache of the view */
+struct file_block {
+    off_t  offset;		/* Offset of the block in the file */
+    byte  *data;		/* The data of the block */
+    size_t len;			/* Number of valid bytes, 0 if unused */
+    unsigned int used;		/* Time of the last use */
+};
+
 struct area {
     screen_dimen top, left;
     screen_dimen height, width;
@@ -142,7 +166,14 @@ struct WView {
     off_t  ds_file_offset;	/* Offset of the currently loaded data */
     byte  *ds_file_data;	/* Currently loaded data */
     size_t ds_file_datalen;	/* Number of valid bytes in file_data */
-    size_t ds_file_datasize;	/* Number of allocated bytes in file_data */
+    size_t ds_file_datasize;	/* Size of each block in the cache */
+    struct file_block ds_file_blocks[VIEW_FILE_BLOCKS];
+				/* Recently used blocks of the file */
+    unsigned int ds_file_clock;	/* Counter for the block use times */
+
+    /* mmap data source, which keeps ds_file_fd open */
+    byte  *ds_mmap_data;	/* The mapped file */
+    size_t ds_mmap_len;		/* The size of the file */
 
     /* string data source */
     byte  *ds_string_data;	/* The characters of the string */
@@ -167,12 +198,15 @@ struct WView {
     gboolean text_wrap_mode;	/* Wrap text lines to fit them on the screen */
     gboolean magic_mode;	/* Preprocess the file using external programs */
     gboolean monitor_mode;	/* Monitor mode a la "tail -f" */
+    int monitor_fd;		/* inotify descriptor in monitor mode, or -1 */
     gboolean strings_mode;	/* Strings highlighting */
     size_t string_length;
 
     /* Additional editor state */
     gboolean hexedit_lownibble;	/* Are we editing the last significant nibble? */
     GArray *coord_cache;	/* Cache for mapping offsets to cursor positions */
+    offset_type ccache_scan_offset; /* Where the scan for line starts stopped */
+    offset_type ccache_scan_line; /* The line number at ccache_scan_offset */
 
     /* Display information */
     screen_dimen dpy_frame_size;/* Size of the frame surrounding the real viewer */
@@ -215,21 +249,11 @@ struct WView {
 				 * -1 view previous file
 				 * 1 view next file
 				 */
-
-    offset_type update_steps;	/* The number of bytes between percent
-				 * increments */
-    offset_type update_activate;/* Last point where we updated the status */
 };
 
 
 /* {{{ Global Variables }}} */
 
-#define IS_WHOLE_OR_DONT_CARE()						\
-    (!view->searchopt_whole || (					\
-     (q - lng == data || strchr(wholechars, q[-(lng + 1)]) == NULL) &&	\
-     (q[0] == '\0' || strchr(wholechars, q[0]) == NULL)			\
-    ))
-
 static const char *wholechars = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz_";
 
 /* Maxlimit for skipping updates */
@@ -264,14 +288,14 @@ int mcview_remember_file_position = FALSE;
 /* Our widget callback */
 static cb_ret_t view_callback (Widget *, widget_msg_t, int);
 
-static int regexp_view_search (WView * view, char *pattern, char *string,
-			       int match_type);
 static void view_labels (WView * view);
 
 static void view_init_growbuf (WView *);
 static void view_place_cursor (WView *view);
 static void display (WView *);
 static void view_done (WView *);
+static void view_update (WView *view);
+static void view_ccache_truncate (WView *view, offset_type size);
 
 /* {{{ Helper Functions }}} */
 
@@ -424,12 +448,14 @@ view_growbuf_read_until (WView *view, offset_type ofs)
     byte *p;
     size_t bytesfree;
     gboolean short_read;
+    offset_type oldsize;
 
     assert (view->growbuf_in_use);
 
     if (view->growbuf_finished)
 	return;
 
+    oldsize = view_growbuf_filesize (view);
     short_read = FALSE;
     while (view_growbuf_filesize (view) < ofs || short_read) {
 	if (view->growbuf_lastindex == VIEW_PAGE_SIZE) {
@@ -466,7 +492,7 @@ view_growbuf_read_until (WView *view, offset_type ofs)
 		nread = mc_read (view->ds_vfs_pipe, p, bytesfree);
 	    } while (nread == -1 && errno == EINTR);
 	    if (nread == 0 && view->monitor_mode) {
-		return;
+		break;
 	    }
 	    if (nread == -1 || nread == 0) {
 		view->growbuf_finished = TRUE;
@@ -478,6 +504,10 @@ view_growbuf_read_until (WView *view, offset_type ofs)
 	short_read = ((size_t)nread < bytesfree);
 	view->growbuf_lastindex += nread;
     }
+
+    /* In monitor mode, the end of the data is only temporary */
+    if (view->monitor_mode && view_growbuf_filesize (view) != oldsize)
+	view_ccache_truncate (view, oldsize);
 }
 
 static int
@@ -533,6 +563,8 @@ view_get_filesize (WView *view)
 	    return view_growbuf_filesize (view);
 	case DS_FILE:
 	    return view->ds_file_filesize;
+	case DS_MMAP:
+	    return view->ds_mmap_len;
 	case DS_STRING:
 	    return view->ds_string_len;
 	default:
@@ -556,12 +588,16 @@ already_loaded (offset_type offset, offset_type idx, size_t size)
     return (offset <= idx && idx - offset < size);
 }
 
+/* Makes the block containing byte_index the current one, reading it
+ * into the least recently used block of the cache if necessary. */
 static inline void
 view_file_load_data (WView *view, offset_type byte_index)
 {
+    struct file_block *block, *victim;
     offset_type blockoffset;
     ssize_t res;
     size_t bytes_read;
+    int i;
 
     assert (view->datasource == DS_FILE);
 
@@ -572,28 +608,46 @@ view_file_load_data (WView *view, offset_type byte_index)
 	return;
 
     blockoffset = offset_rounddown (byte_index, view->ds_file_datasize);
+    victim = &view->ds_file_blocks[0];
+    for (i = 0; i < VIEW_FILE_BLOCKS; i++) {
+	block = &view->ds_file_blocks[i];
+	if (block->len != 0 && block->offset == blockoffset)
+	    goto found;
+	if (block->used < victim->used)
+	    victim = block;
+    }
+    block = victim;
+    block->len = 0;
+
     if (mc_lseek (view->ds_file_fd, blockoffset, SEEK_SET) == -1)
 	goto error;
 
     bytes_read = 0;
     while (bytes_read < view->ds_file_datasize) {
-	res = mc_read (view->ds_file_fd, view->ds_file_data + bytes_read, view->ds_file_datasize - bytes_read);
+	res = mc_read (view->ds_file_fd, block->data + bytes_read, view->ds_file_datasize - bytes_read);
 	if (res == -1)
 	    goto error;
 	if (res == 0)
 	    break;
 	bytes_read += (size_t) res;
     }
-    view->ds_file_offset  = blockoffset;
-    if (bytes_read > view->ds_file_filesize - view->ds_file_offset) {
+    block->offset = blockoffset;
+    if (bytes_read > view->ds_file_filesize - block->offset) {
 	/* the file has grown in the meantime -- stick to the old size */
-	view->ds_file_datalen = view->ds_file_filesize - view->ds_file_offset;
+	block->len = view->ds_file_filesize - block->offset;
     } else {
-	view->ds_file_datalen = bytes_read;
+	block->len = bytes_read;
     }
+
+  found:
+    block->used = ++view->ds_file_clock;
+    view->ds_file_offset = block->offset;
+    view->ds_file_data = block->data;
+    view->ds_file_datalen = block->len;
     return;
 
 error:
+    block->used = 0;
     view->ds_file_datalen = 0;
 }
 
@@ -617,6 +671,15 @@ get_byte_file (WView *view, offset_type byte_index)
     return -1;
 }
 
+static inline int
+get_byte_mmap (WView *view, offset_type byte_index)
+{
+    assert (view->datasource == DS_MMAP);
+    if (byte_index < view->ds_mmap_len)
+	return view->ds_mmap_data[byte_index];
+    return -1;
+}
+
 static int
 get_byte_string (WView *view, offset_type byte_index)
 {
@@ -635,6 +698,8 @@ get_byte (WView *view, offset_type offset)
 	    return get_byte_growing_buffer (view, offset);
 	case DS_FILE:
 	    return get_byte_file (view, offset);
+	case DS_MMAP:
+	    return get_byte_mmap (view, offset);
 	case DS_STRING:
 	    return get_byte_string (view, offset);
 	case DS_NONE:
@@ -652,12 +717,96 @@ get_byte_indexed (WView *view, offset_type base, offset_type ofs)
     return -1;
 }
 
+/* Copies the bytes [offset; offset + len) of the data source to buf.
+ * Returns the number of bytes copied, which is less than len only at
+ * the end of the data. */
+static size_t
+view_get_block (WView *view, offset_type offset, byte *buf, size_t len)
+{
+    size_t done = 0;
+    ssize_t res;
+
+    if (offset > OFFSETTYPE_MAX - len)
+	len = OFFSETTYPE_MAX - offset;
+
+    switch (view->datasource) {
+	case DS_STDIO_PIPE:
+	case DS_VFS_PIPE:
+	    view_growbuf_read_until (view, offset + len);
+	    while (done < len) {
+		offset_type pageno = (offset + done) / VIEW_PAGE_SIZE;
+		size_t pageindex = (offset + done) % VIEW_PAGE_SIZE;
+		size_t pagelen, n;
+
+		if (pageno >= view->growbuf_blocks)
+		    break;
+		pagelen = (pageno == view->growbuf_blocks - 1)
+		    ? view->growbuf_lastindex : VIEW_PAGE_SIZE;
+		if (pageindex >= pagelen)
+		    break;
+		n = pagelen - pageindex;
+		if (n > len - done)
+		    n = len - done;
+		memcpy (buf + done, view->growbuf_blockptr[pageno] + pageindex, n);
+		done += n;
+	    }
+	    return done;
+	case DS_FILE:
+	    if (offset >= view->ds_file_filesize)
+		return 0;
+	    if (len > view->ds_file_filesize - offset)
+		len = view->ds_file_filesize - offset;
+	    if (already_loaded (view->ds_file_offset, offset, view->ds_file_datalen)) {
+		done = view->ds_file_datalen - (offset - view->ds_file_offset);
+		if (done > len)
+		    done = len;
+		memcpy (buf, view->ds_file_data + (offset - view->ds_file_offset), done);
+		if (done == len)
+		    return done;
+	    }
+	    /* Read the rest directly, bypassing the small block cache */
+	    if (mc_lseek (view->ds_file_fd, offset + done, SEEK_SET) == -1)
+		return done;
+	    while (done < len) {
+		res = mc_read (view->ds_file_fd, buf + done, len - done);
+		if (res == -1 || res == 0)
+		    break;
+		done += (size_t) res;
+	    }
+	    return done;
+	case DS_MMAP:
+	    if (offset >= view->ds_mmap_len)
+		return 0;
+	    if (len > view->ds_mmap_len - offset)
+		len = view->ds_mmap_len - offset;
+	    memcpy (buf, view->ds_mmap_data + offset, len);
+	    return len;
+	case DS_STRING:
+	    if (offset >= view->ds_string_len)
+		return 0;
+	    if (len > view->ds_string_len - offset)
+		len = view->ds_string_len - offset;
+	    memcpy (buf, view->ds_string_data + offset, len);
+	    return len;
+	case DS_NONE:
+	    return 0;
+    }
+    assert(!"Unknown datasource type");
+    return 0;
+}
+
 static void
 view_set_byte (WView *view, offset_type offset, byte b)
 {
+    int i;
+
     (void) &b;
     assert (offset < view_get_filesize (view));
-    assert (view->datasource == DS_FILE);
+    assert (view->datasource == DS_FILE || view->datasource == DS_MMAP);
+    if (view->datasource == DS_MMAP)
+	return;			/* the shared mapping shows the change */
+    for (i = 0; i < VIEW_FILE_BLOCKS; i++)
+	view->ds_file_blocks[i].len = 0;
     view->ds_file_datalen = 0; /* just force reloading */
 }
 
@@ -698,13 +847,150 @@ view_set_datasource_string (WView *view, const char *s)
 static void
 view_set_datasource_file (WView *view, int fd, const struct stat *st)
 {
+    byte *data;
+    int i;
+
     view->datasource = DS_FILE;
     view->ds_file_fd = fd;
     view->ds_file_filesize = st->st_size;
     view->ds_file_offset = 0;
-    view->ds_file_data = g_malloc (4096);
     view->ds_file_datalen = 0;
-    view->ds_file_datasize = 4096;
+    view->ds_file_datasize = VIEW_PAGE_SIZE;
+    data = g_malloc (VIEW_FILE_BLOCKS * VIEW_PAGE_SIZE);
+    for (i = 0; i < VIEW_FILE_BLOCKS; i++) {
+	view->ds_file_blocks[i].data = data + i * VIEW_PAGE_SIZE;
+	view->ds_file_blocks[i].len = 0;
+	view->ds_file_blocks[i].used = 0;
+    }
+    view->ds_file_data = data;
+    view->ds_file_clock = 0;
+}
+
+#ifdef HAVE_MMAP
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* The views that have a mapped file */
+static GList *mapped_views = NULL;
+
+#if defined(SA_SIGINFO) && defined(MAP_ANONYMOUS)
+static long mapped_pagesize;
+
+/* Reading a mapped file beyond its end raises SIGBUS, which happens
+ * when the file is truncated while it is viewed. The missing part of
+ * the file is replaced by zeroes then. */
+static void
+view_mmap_sigbus (int sig, siginfo_t *info, void *context)
+{
+    const byte *addr = (const byte *) info->si_addr;
+    WView *view;
+    GList *l;
+    byte *page;
+
+    (void) sig;
+    (void) context;
+
+    for (l = mapped_views; l != NULL; l = l->next) {
+	view = (WView *) l->data;
+	if (addr < view->ds_mmap_data
+	    || addr >= view->ds_mmap_data + view->ds_mmap_len)
+	    continue;
+	page = view->ds_mmap_data
+	    + offset_rounddown (addr - view->ds_mmap_data, mapped_pagesize);
+	if (mmap (page, mapped_pagesize, PROT_READ,
+		  MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED)
+	    return;
+    }
+    signal (SIGBUS, SIG_DFL);
+}
+#endif				/* SA_SIGINFO && MAP_ANONYMOUS */
+#endif				/* HAVE_MMAP */
+
+#ifdef HAVE_MMAP
+/* Maps the first ''size'' bytes of the file ''fd'' into memory. Returns
+ * NULL if it is not a local file or cannot be mapped. */
+static byte *
+view_mmap_file (int fd, offset_type size)
+{
+    void *data;
+    int local_fd;
+
+#ifdef USE_VFS
+    if (!mc_ctl (fd, VFS_CTL_GETFD, &local_fd))
+	return NULL;
+#else
+    local_fd = fd;
+#endif
+    if (size == 0 || (offset_type) (size_t) size != size)
+	return NULL;
+    data = mmap (NULL, size, PROT_READ, MAP_SHARED, local_fd, 0);
+    if (data == MAP_FAILED)
+	return NULL;
+    return data;
+}
+#endif				/* HAVE_MMAP */
+
+/* Maps a local file into memory. Returns FALSE if the file has to be
+ * read through the VFS instead. */
+static gboolean
+view_set_datasource_mmap (WView *view, int fd, const struct stat *st)
+{
+#ifdef HAVE_MMAP
+    byte *data;
+
+    if ((off_t) (offset_type) st->st_size != st->st_size)
+	return FALSE;
+    data = view_mmap_file (fd, st->st_size);
+    if (data == NULL)
+	return FALSE;
+
+#if defined(SA_SIGINFO) && defined(MAP_ANONYMOUS)
+    if (mapped_pagesize == 0) {
+	struct sigaction sa;
+
+	mapped_pagesize = sysconf (_SC_PAGESIZE);
+	memset (&sa, 0, sizeof (sa));
+	sa.sa_sigaction = view_mmap_sigbus;
+	sigemptyset (&sa.sa_mask);
+	sa.sa_flags = SA_SIGINFO;
+	sigaction (SIGBUS, &sa, NULL);
+    }
+#endif
+    mapped_views = g_list_prepend (mapped_views, view);
+
+    view->datasource = DS_MMAP;
+    view->ds_file_fd = fd;
+    view->ds_mmap_data = data;
+    view->ds_mmap_len = st->st_size;
+    return TRUE;
+#else
+    (void) view;
+    (void) fd;
+    (void) st;
+    return FALSE;
+#endif				/* HAVE_MMAP */
+}
+
+/* Maps the grown file again */
+static gboolean
+view_mmap_resize (WView *view, offset_type size)
+{
+#ifdef HAVE_MMAP
+    byte *data;
+
+    data = view_mmap_file (view->ds_file_fd, size);
+    if (data == NULL)
+	return FALSE;
+    (void) munmap (view->ds_mmap_data, view->ds_mmap_len);
+    view->ds_mmap_data = data;
+    view->ds_mmap_len = size;
+    return TRUE;
+#else
+    (void) view;
+    (void) size;
+    return FALSE;
+#endif				/* HAVE_MMAP */
 }
 
 static void
@@ -732,9 +1018,18 @@ view_close_datasource (WView *view)
 	case DS_FILE:
 	    (void) mc_close (view->ds_file_fd);
 	    view->ds_file_fd = -1;
-	    g_free (view->ds_file_data);
+	    g_free (view->ds_file_blocks[0].data);
 	    view->ds_file_data = NULL;
 	    break;
+	case DS_MMAP:
+#ifdef HAVE_MMAP
+	    mapped_views = g_list_remove (mapped_views, view);
+	    (void) munmap (view->ds_mmap_data, view->ds_mmap_len);
+#endif
+	    view->ds_mmap_data = NULL;
+	    (void) mc_close (view->ds_file_fd);
+	    view->ds_file_fd = -1;
+	    break;
 	case DS_STRING:
 	    g_free (view->ds_string_data);
 	    view->ds_string_data = NULL;
@@ -877,6 +1172,171 @@ is_nroff_sequence (WView *view, offset_type offset)
     return (c0 == c2 || c0 == '_' || (c0 == '+' && c2 == 'o'));
 }
 
+static void
+view_ccache_init (WView *view)
+{
+    struct coord_cache_entry entry;
+
+    view->coord_cache = g_array_new (FALSE, FALSE, sizeof(struct coord_cache_entry));
+    entry.cc_offset = 0;
+    entry.cc_line = 0;
+    entry.cc_column = 0;
+    entry.cc_nroff_column = 0;
+    g_array_append_val (view->coord_cache, entry);
+    view->ccache_scan_offset = 0;
+    view->ccache_scan_line = 0;
+}
+
+/* Drops the cache entries that may depend on data at or beyond
+ * ''size''. Each entry depends on the two bytes following it, which
+ * decide about nroff sequences and '\r' line breaks. */
+static void
+view_ccache_truncate (WView *view, offset_type size)
+{
+    guint len;
+
+    if (!view->coord_cache)
+	return;
+    len = view->coord_cache->len;
+    while (len > 1 && g_array_index (view->coord_cache,
+	    struct coord_cache_entry, len - 1).cc_offset + 2 > size)
+	len--;
+    g_array_set_size (view->coord_cache, len);
+}
+
+/* Returns TRUE if the scan for line starts has reached the position
+ * ''offset''/''line'' behind ''coord''. */
+static inline gboolean
+view_ccache_scanned (const struct coord_cache_entry *coord,
+	enum ccache_type sort_by, offset_type offset, offset_type line)
+{
+    if (coord == NULL)
+	return FALSE;
+    if (sort_by == CCACHE_OFFSET)
+	return (offset >= coord->cc_offset);
+    return (line > coord->cc_line);
+}
+
+/* Returns how many bytes view_ccache_index() reads at ''offset''. A pipe
+ * blocks until the data is there, so only what has arrived so far is
+ * taken, or else no more than is needed to reach ''coord''. */
+static size_t
+view_ccache_index_len (WView *view, const struct coord_cache_entry *coord,
+	enum ccache_type sort_by, offset_type offset)
+{
+    offset_type have;
+
+    if (!view->growbuf_in_use || view->growbuf_finished)
+	return VIEW_SEARCH_BLOCK;
+
+    have = view_growbuf_filesize (view);
+    if (have > offset)
+	return MIN (VIEW_SEARCH_BLOCK, have - offset);
+    if (coord != NULL && sort_by == CCACHE_OFFSET && coord->cc_offset > offset)
+	return MIN (VIEW_SEARCH_BLOCK, coord->cc_offset - offset);
+    return 1;
+}
+
+/* Extends the coordinate cache by entries at the beginning of lines,
+ * at most one per VIEW_INDEX_GRANUL bytes, which keeps the cache small
+ * even for huge files; view_ccache_lookup() walks the rest of the way
+ * from the nearest entry. Line breaks are found
+ * with memchr() on whole blocks of data, which is much faster than
+ * stepping through the data in view_ccache_lookup(). Since the line and
+ * the column of a line start do not depend on nroff sequences or tabs,
+ * only '\n' and the '\r' of Mac line endings need to be counted.
+ *
+ * The scan stops after the block in which it has passed ''coord'' (if
+ * not NULL), after ''budget'' bytes, or at the end of the data. Returns
+ * TRUE if there may be more data to scan.
+ */
+static gboolean
+view_ccache_index (WView *view, const struct coord_cache_entry *coord,
+	enum ccache_type sort_by, offset_type budget)
+{
+    struct coord_cache_entry entry;
+    offset_type offset, line, next_entry;
+    size_t len, n, i, j;
+    byte *buf;
+    gboolean has_cr, result = TRUE;
+    int nextc;
+
+    if (!view->coord_cache)
+	view_ccache_init (view);
+
+    /* Continue after the last cache entry or where the last scan
+     * stopped, whichever comes later. */
+    entry = g_array_index (view->coord_cache, struct coord_cache_entry,
+	view->coord_cache->len - 1);
+    if (view->ccache_scan_offset < entry.cc_offset) {
+	view->ccache_scan_offset = entry.cc_offset;
+	view->ccache_scan_line = entry.cc_line;
+    }
+    offset = view->ccache_scan_offset;
+    line = view->ccache_scan_line;
+    next_entry = entry.cc_offset + VIEW_INDEX_GRANUL;
+
+    if (view_ccache_scanned (coord, sort_by, offset, line))
+	return TRUE;
+
+    buf = g_malloc (VIEW_SEARCH_BLOCK);
+    while (budget > 0) {
+	len = view_ccache_index_len (view, coord, sort_by, offset);
+	n = view_get_block (view, offset, buf, len);
+	has_cr = (memchr (buf, '\r', n) != NULL);
+
+	for (i = 0; i < n; i = j + 1) {
+	    if (has_cr) {
+		for (j = i; j < n && buf[j] != '\n' && buf[j] != '\r'; j++)
+		    continue;
+	    } else {
+		const byte *nl = memchr (buf + i, '\n', n - i);
+		j = (nl != NULL) ? (size_t) (nl - buf) : n;
+	    }
+	    if (j == n)
+		break;
+
+	    if (buf[j] == '\r') {
+		/* A '\r' that is followed by '\r' or '\n' is ignored. If
+		 * the next byte is not there yet, the scan must wait. */
+		if (j + 1 < n)
+		    nextc = buf[j + 1];
+		else if (n < len
+			 || (nextc = get_byte (view, offset + n)) == -1) {
+		    n = j;
+		    break;
+		}
+		if (nextc != '\r' && nextc != '\n')
+		    line++;
+		continue;
+	    }
+
+	    line++;
+	    if (offset + j + 1 >= next_entry) {
+		entry.cc_offset = offset + j + 1;
+		entry.cc_line = line;
+		entry.cc_column = 0;
+		entry.cc_nroff_column = 0;
+		g_array_append_val (view->coord_cache, entry);
+		next_entry = entry.cc_offset + VIEW_INDEX_GRANUL;
+	    }
+	}
+	offset += n;
+	if (n < len) {
+	    result = FALSE;
+	    break;
+	}
+	if (view_ccache_scanned (coord, sort_by, offset, line))
+	    break;
+	budget = offset_doz (budget, n);
+    }
+
+    view->ccache_scan_offset = offset;
+    view->ccache_scan_line = line;
+    g_free (buf);
+    return result;
+}
+
 /* Find and return the index of the last cache entry that is
  * smaller than ''coord'', according to the criterion ''sort_by''. */
 static inline guint
@@ -920,14 +1380,8 @@ view_ccache_lookup (WView *view, struct coord_cache_entry *coord,
 	NROFF_CONTINUATION
     } nroff_state;
 
-    if (!view->coord_cache) {
-	view->coord_cache = g_array_new (FALSE, FALSE, sizeof(struct coord_cache_entry));
-	current.cc_offset = 0;
-	current.cc_line = 0;
-	current.cc_column = 0;
-	current.cc_nroff_column = 0;
-	g_array_append_val (view->coord_cache, current);
-    }
+    if (!view->coord_cache)
+	view_ccache_init (view);
 
     sorter = (lookup_what == CCACHE_OFFSET) ? CCACHE_LINECOL : CCACHE_OFFSET;
 
@@ -937,6 +1391,17 @@ view_ccache_lookup (WView *view, struct coord_cache_entry *coord,
     i = view_ccache_find (view, cache, coord, sorter);
     /* now i points to the lower neighbor in the cache */
 
+    /* Beyond the last entry, jump ahead to the nearest line start */
+    if (i + 1 == view->coord_cache->len) {
+	guint len = view->coord_cache->len;
+
+	(void) view_ccache_index (view, coord, sorter, OFFSETTYPE_MAX);
+	if (view->coord_cache->len != len) {
+	    cache = &(g_array_index (view->coord_cache, struct coord_cache_entry, 0));
+	    i = view_ccache_find (view, cache, coord, sorter);
+	}
+    }
+
     current = cache[i];
     if (i + 1 < view->coord_cache->len)
 	limit = cache[i + 1].cc_offset;
@@ -1152,9 +1617,6 @@ view_moveto_bottom (WView *view)
 	view_move_up (view, lines_up);
 	view->hex_cursor = last_offset;
     } else {
-	if (view->monitor_mode) {
-	    /* XXX need to reset some cache? */
-	}
 	view->dpy_start = last_offset;
 	view_moveto_bol (view);
 	view_move_up (view, lines_up);
@@ -1434,15 +1896,14 @@ view_toggle_magic_mode (WView *view)
     view->dirty++;
 }
 
+/* Loads the file again at the current line */
 static void
-view_toggle_monitor_mode (WView *view)
+view_reload (WView *view)
 {
     char *filename, *command;
-
     offset_type line, col;
-    view_offset_to_coord (view, &line, &col, view->dpy_start);
 
-    view->monitor_mode = !view->monitor_mode;
+    view_offset_to_coord (view, &line, &col, view->dpy_start);
     filename = g_strdup (view->filename);
     command = g_strdup (view->command);
 
@@ -1450,10 +1911,174 @@ view_toggle_monitor_mode (WView *view)
     view_load (view, command, filename, line + 1);
     g_free (filename);
     g_free (command);
-    view->dpy_bbar_dirty = TRUE;
+}
+
+/* Makes the data that has been appended to the file since the last
+ * call visible. If the end of the file was shown before, the view
+ * stays at the end. */
+static void
+view_monitor_update (WView *view)
+{
+    offset_type oldsize;
+    gboolean at_end;
+    struct stat st;
+    int i;
+
+    oldsize = view_get_filesize (view);
+    at_end = (view->dpy_end >= oldsize);
+
+    switch (view->datasource) {
+	case DS_VFS_PIPE:
+	    view_growbuf_read_until (view, OFFSETTYPE_MAX);
+	    break;
+	case DS_FILE:
+	case DS_MMAP:
+	    if (mc_fstat (view->ds_file_fd, &st) == -1
+		|| (offset_type) st.st_size == oldsize)
+		return;
+	    if ((offset_type) st.st_size < oldsize) {
+		/* The file has been truncated, start all over */
+		view_reload (view);
+		view_moveto_bottom (view);
+		view->dirty++;
+		view_update (view);
+		mc_refresh ();
+		return;
+	    }
+	    if (view->datasource == DS_MMAP) {
+		if (!view_mmap_resize (view, st.st_size))
+		    return;
+	    } else {
+		/* The blocks at the old end of the file are incomplete */
+		for (i = 0; i < VIEW_FILE_BLOCKS; i++) {
+		    if (view->ds_file_blocks[i].len < view->ds_file_datasize) {
+			view->ds_file_blocks[i].len = 0;
+			view->ds_file_blocks[i].used = 0;
+		    }
+		}
+		view->ds_file_datalen = 0;
+		view->ds_file_filesize = st.st_size;
+	    }
+	    view_ccache_truncate (view, oldsize);
+	    break;
+	default:
+	    return;
+    }
+
+    if (view_get_filesize (view) == oldsize)
+	return;
+    if (at_end)
+	view_moveto_bottom (view);
+    /* Let the idle handler index the new lines */
+    set_idle_proc (view->widget.parent, 1);
     view->dirty++;
+    view_update (view);
+    mc_refresh ();
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+/* Writes to files on network file systems from other hosts never reach
+ * inotify, so it can only be trusted on file systems known to be local */
+static gboolean
+view_monitor_fs_is_local (const char *filename)
+{
+#ifdef HAVE_SYS_STATFS_H
+    static const unsigned int local_fs[] = {
+	0xEF53,			/* ext2, ext3, ext4 */
+	0x58465342,		/* xfs */
+	0x9123683E,		/* btrfs */
+	0x01021994,		/* tmpfs */
+	0x858458F6,		/* ramfs */
+	0x794C7630,		/* overlayfs */
+	0xF2F52010,		/* f2fs */
+	0x52654973,		/* reiserfs */
+	0x3153464A,		/* jfs */
+	0x2FC12FC1,		/* zfs */
+	0x4D44,			/* msdos, vfat */
+	0x2011BAB0,		/* exfat */
+	0x5346544E		/* ntfs */
+    };
+    struct statfs sfs;
+    size_t i;
 
-    set_idle_proc(view->widget.parent, view->monitor_mode);
+    if (statfs (filename, &sfs) == -1)
+	return FALSE;
+    for (i = 0; i < sizeof (local_fs) / sizeof (local_fs[0]); i++)
+	if ((unsigned int) sfs.f_type == local_fs[i])
+	    return TRUE;
+    return FALSE;
+#else
+    return TRUE;
+#endif				/* HAVE_SYS_STATFS_H */
+}
+
+static int
+view_monitor_event (int fd, void *info)
+{
+    char buf[4096];
+
+    /* Any of the events means that the file has changed. Viewers that
+     * are not in front catch up with the next change. */
+    if (read (fd, buf, sizeof (buf)) > 0
+	&& ((WView *) info)->widget.parent == current_dlg)
+	view_monitor_update ((WView *) info);
+    return 0;
+}
+#endif
+
+/* Starts watching the file in monitor mode. Changes of files on local
+ * file systems are reported by the kernel, other files are checked
+ * once a second while the viewer is idle. */
+static void
+view_monitor_start (WView *view)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    int fd;
+
+    if (view->datasource != DS_STDIO_PIPE && view->filename != NULL
+	&& vfs_file_is_local (view->filename)
+	&& view_monitor_fs_is_local (view->filename)
+	&& (fd = inotify_init ()) != -1) {
+	if (inotify_add_watch (fd, view->filename, IN_MODIFY) != -1) {
+	    view->monitor_fd = fd;
+	    add_select_channel (fd, view_monitor_event, view);
+	    return;
+	}
+	close (fd);
+    }
+#endif
+    set_idle_proc (view->widget.parent, 1);
+}
+
+static void
+view_monitor_stop (WView *view)
+{
+    if (view->monitor_fd != -1) {
+	delete_select_channel (view->monitor_fd);
+	close (view->monitor_fd);
+	view->monitor_fd = -1;
+    }
+}
+
+static void
+view_toggle_monitor_mode (WView *view)
+{
+    view->monitor_mode = !view->monitor_mode;
+    if (!view->monitor_mode) {
+	view_monitor_stop (view);
+    } else if (view->datasource == DS_VFS_PIPE && view->growbuf_finished) {
+	/* The end of the file has been seen, so it must be opened again */
+	view_reload (view);
+    } else {
+	view_monitor_start (view);
+    }
+
+    if (view->monitor_mode) {
+	view_monitor_update (view);
+	view_moveto_bottom (view);
+    }
+    view->dpy_bbar_dirty = TRUE;
+    view->dirty++;
 }
 
 /* {{{ Miscellaneous functions }}} */
@@ -1485,6 +2110,7 @@ view_done (WView *view)
     g_free (view->filename), view->filename = NULL;
     g_free (view->command), view->command = NULL;
 
+    view_monitor_stop (view);
     view_close_datasource (view);
     /* the growing buffer is freed with the datasource */
 
@@ -1590,7 +2216,7 @@ view_load (WView *view, const char *command, const char *file,
 	    goto finish;
 	}
 
-	if (view->monitor_mode || st.st_size == 0 || mc_lseek (fd, 0, SEEK_SET) == -1) {
+	if (st.st_size == 0 || mc_lseek (fd, 0, SEEK_SET) == -1) {
 	    /* Must be one of those nice files that grow (/proc) */
 	    view_set_datasource_vfs_pipe (view, fd);
 	} else {
@@ -1600,7 +2226,8 @@ view_load (WView *view, const char *command, const char *file,
 		g_free (view->filename);
 		view->filename = g_strconcat (file, decompress_extension (type), (char *) NULL);
 	    }
-	    view_set_datasource_file (view, fd, &st);
+	    if (!view_set_datasource_mmap (view, fd, &st))
+		view_set_datasource_file (view, fd, &st);
 	}
 	retval = TRUE;
     }
@@ -1630,6 +2257,9 @@ view_load (WView *view, const char *command, const char *file,
     view->hexview_in_text = FALSE;
     view->change_list = NULL;
 
+    if (retval && view->monitor_mode)
+	view_monitor_start (view);
+
     return retval;
 }
 
@@ -2431,353 +3061,631 @@ my_define (Dlg_head *h, int idx, const char *text, void (*fn) (WView *),
 
 /* {{{ Searching }}} */
 
-/* Case insensitive search of text in data */
-static int
-icase_search_p (WView *view, char *text, char *data, int nothing)
-{
-    const char *p;
-    const char *q;
-    int lng;
-    const int direction = view->direction;
+/*
+   Plain text and hex strings are searched for in blocks of
+   VIEW_SEARCH_BLOCK bytes with the Boyer-Moore-Horspool algorithm.
+   Consecutive blocks overlap by the length of the pattern, so that
+   matches spanning two blocks are found, too.
+
+   In text mode, overstruck characters ("c\bc", as produced by nroff)
+   match the character that is shown. Blocks that contain a backspace
+   are therefore checked position by position.
+ */
 
-    (void) nothing;
+struct search_pattern {
+    byte *text;			/* The pattern, case folded */
+    size_t len;			/* Length of the pattern */
+    gboolean whole;		/* Match whole words only */
+    gboolean overstrike;	/* Match overstruck characters */
+    offset_type limit;		/* Matches must end before this offset */
+    byte fold[256];		/* Case folding table */
+    size_t skip[256];		/* Shifts for searching forward */
+    size_t rskip[256];		/* Shifts for searching backward */
+};
 
-    /* If we are searching backwards, reverse the string */
-    if (direction == -1) {
-	g_strreverse (text);
-	g_strreverse (data);
-    }
+static void
+search_pattern_init (struct search_pattern *sp, const char *text, size_t len,
+		     gboolean icase)
+{
+    size_t i;
 
-    for (p = data; ; p++) {
-	q = _icase_search (text, p, &lng);
-	if (!q || IS_WHOLE_OR_DONT_CARE()) {
-	    break;
-	}
+    for (i = 0; i < 256; i++) {
+	sp->fold[i] = icase ? (byte) toupper ((int) i) : (byte) i;
+	sp->skip[i] = len;
+	sp->rskip[i] = len;
     }
+    sp->text = g_malloc (len);
+    for (i = 0; i < len; i++)
+	sp->text[i] = sp->fold[(byte) text[i]];
+    for (i = 0; i + 1 < len; i++)
+	sp->skip[sp->text[i]] = len - 1 - i;
+    for (i = len - 1; i > 0; i--)
+	sp->rskip[sp->text[i]] = i;
+    sp->len = len;
+    sp->whole = FALSE;
+    sp->overstrike = FALSE;
+    sp->limit = OFFSETTYPE_MAX;
+}
 
-    if (direction == -1) {
-	g_strreverse (text);
-	g_strreverse (data);
-    }
+static inline gboolean
+search_is_wordchar (int c)
+{
+    return (c != -1 && c != '\0' && strchr (wholechars, c) != NULL);
+}
 
-    if (q != 0) {
-	if (direction > 0)
-	    view->search_start = q - data - lng;
-	else
-	    view->search_start = strlen (data) - (q - data);
-	view->search_length = lng;
-	return 1;
+/* Returns the byte at offset, taking it from buf if it is there */
+static inline int
+search_get_byte (WView *view, const byte *buf, offset_type base, size_t n,
+		 offset_type offset)
+{
+    if (already_loaded (base, offset, n))
+	return buf[offset - base];
+    return get_byte (view, offset);
+}
+
+/* Returns the length of the match starting at offset, or 0 */
+static offset_type
+search_match_at (WView *view, const struct search_pattern *sp,
+		 const byte *buf, offset_type base, size_t n, offset_type offset)
+{
+    offset_type e = offset;
+    size_t i;
+    int c;
+
+    for (i = 0; i < sp->len; i++) {
+	/* Skip to the last character of an overstruck sequence */
+	while (sp->overstrike && e + 2 < sp->limit
+	       && search_get_byte (view, buf, base, n, e + 1) == '\b'
+	       && (c = search_get_byte (view, buf, base, n, e + 2)) != -1
+	       && c != '\n' && c != '\0')
+	    e += 2;
+	if (e >= sp->limit)
+	    return 0;
+	c = search_get_byte (view, buf, base, n, e);
+	if (c == -1 || sp->fold[c] != sp->text[i])
+	    return 0;
+	e++;
     }
-    return 0;
+    if (sp->whole
+	&& ((offset > 0 && search_is_wordchar (search_get_byte (view, buf, base, n, offset - 1)))
+	    || search_is_wordchar (search_get_byte (view, buf, base, n, e))))
+	return 0;
+    return e - offset;
 }
 
-static int
-case_search_p (WView *view, char *text, char *data, int nothing)
+/* Returns TRUE if a match may start at buf[s]. In a block without
+ * backspaces, this means that the pattern must be there literally. */
+static inline gboolean
+search_candidate (const struct search_pattern *sp, const byte *buf,
+		  size_t n, size_t s, gboolean plain)
 {
-    const char *p;
-    const char *q;
-    int lng;
-    const int direction = view->direction;
+    size_t k;
+
+    if (!plain)
+	return (sp->fold[buf[s]] == sp->text[0]
+		|| (s + 1 < n && buf[s + 1] == '\b'));
+    for (k = sp->len; k-- > 0;)
+	if (sp->fold[buf[s + k]] != sp->text[k])
+	    return FALSE;
+    return TRUE;
+}
 
-    (void) nothing;
+/* Searches the n bytes in buf, which start at offset base, for a match
+ * that starts in buf[0..end). Returns the offset of the first match in
+ * the search direction and stores its length in match_len, or returns
+ * INVALID_OFFSET. */
+static offset_type
+search_block (WView *view, const struct search_pattern *sp, const byte *buf,
+	      offset_type base, size_t n, size_t end, offset_type *match_len)
+{
+    const size_t len = sp->len;
+    const gboolean plain = !sp->overstrike || memchr (buf, '\b', n) == NULL;
+    size_t s, shift;
 
-    /* If we are searching backwards, reverse the string */
-    if (direction == -1) {
-	g_strreverse (text);
-	g_strreverse (data);
+    if (view->direction == 1) {
+	for (s = 0; s < end; s += plain ? sp->skip[sp->fold[buf[s + len - 1]]] : 1) {
+	    if (search_candidate (sp, buf, n, s, plain)
+		&& (*match_len = search_match_at (view, sp, buf, base, n, base + s)) != 0)
+		return base + s;
+	}
+    } else {
+	for (s = end; s > 0;) {
+	    s--;
+	    if (search_candidate (sp, buf, n, s, plain)
+		&& (*match_len = search_match_at (view, sp, buf, base, n, base + s)) != 0)
+		return base + s;
+	    if (plain) {
+		shift = sp->rskip[sp->fold[buf[s]]] - 1;
+		s = (s > shift) ? s - shift : 0;
+	    }
+	}
     }
+    return INVALID_OFFSET;
+}
 
-    for (p = data; ; p++) {
-	q = _case_search (text, p, &lng);
-	if (!q || IS_WHOLE_OR_DONT_CARE()) {
-	    break;
+/* Searches the data for the pattern, starting at the current search
+ * position. Returns the offset of the match and stores its length in
+ * match_len, or returns INVALID_OFFSET. */
+static offset_type
+view_search_pattern (WView *view, struct search_pattern *sp,
+		     offset_type *match_len)
+{
+    const size_t bufsize = MAX (VIEW_SEARCH_BLOCK, 2 * sp->len);
+    byte *buf = g_malloc (bufsize);
+    offset_type from, lo, hi, found = INVALID_OFFSET;
+    size_t n, end;
+
+    enable_interrupt_key ();
+    if (view->direction == 1) {
+	from = view->search_start + ((view->search_length) ? 1 : 0);
+	for (;;) {
+	    if (verbose) {
+		view_percent (view, from);
+		mc_refresh ();
+	    }
+	    if (got_interrupt ())
+		break;
+	    n = view_get_block (view, from, buf, bufsize);
+	    if (n < sp->len)
+		break;
+	    /* The last len bytes are searched again with the next block */
+	    end = n - sp->len + ((n < bufsize) ? 1 : 0);
+	    found = search_block (view, sp, buf, from, n, end, match_len);
+	    if (found != INVALID_OFFSET || n < bufsize)
+		break;
+	    from += end;
+	}
+    } else {
+	hi = view->search_start + ((view->search_length) ? 0 : 1);
+	if (hi > view_get_filesize (view))
+	    hi = view_get_filesize (view);
+	sp->limit = hi;
+	while (hi >= sp->len) {
+	    lo = (hi > bufsize) ? hi - bufsize : 0;
+	    if (verbose) {
+		view_percent (view, lo);
+		mc_refresh ();
+	    }
+	    if (got_interrupt ())
+		break;
+	    n = view_get_block (view, lo, buf, hi - lo);
+	    if (n < hi - lo)
+		break;
+	    end = n - sp->len + ((hi == sp->limit) ? 1 : 0);
+	    found = search_block (view, sp, buf, lo, n, end, match_len);
+	    if (found != INVALID_OFFSET || lo == 0)
+		break;
+	    hi = lo + sp->len;
 	}
     }
+    disable_interrupt_key ();
+    g_free (buf);
+    return found;
+}
 
-    if (direction == -1) {
-	g_strreverse (text);
-	g_strreverse (data);
-    }
+/*
+   Regular expressions are matched a line at a time, directly in the
+   blocks read for the search. Lines end at a newline or a NUL byte.
+   When the expression requires some literal text, the blocks are first
+   searched for it like for plain text, and only the lines containing
+   it are given to the matcher.
+ */
 
-    if (q != 0) {
-	if (direction > 0)
-	    view->search_start = q - data - lng;
-	else
-	    view->search_start = strlen (data) - (q - data);
-	view->search_length = lng;
-	return 1;
-    }
-    return 0;
+static inline gboolean
+is_line_end (byte c)
+{
+    return (c == '\n' || c == '\0');
 }
 
-static char *
-grow_string_buffer (char *text, gulong *size)
+/* Returns the compiled regular expression for pattern, or NULL if the
+ * pattern is invalid. The last expression is kept for repeated
+ * searches. */
+static regex_t *
+view_regexp_compile (WView *view, const char *pattern)
 {
-    char *new;
+    static regex_t r;
+    static char *old_pattern = NULL;
+    static int old_flags;
+    int flags = view->searchopt_case ? 0 : REG_ICASE;
 
-    /* The grow steps */
-    *size += 160;
-    new = g_realloc (text, *size);
-    if (text == NULL) {
-	*new = '\0';
+    if (old_pattern == NULL || strcmp (old_pattern, pattern) != 0
+	|| old_flags != flags) {
+	if (old_pattern != NULL) {
+	    regfree (&r);
+	    g_free (old_pattern);
+	    old_pattern = 0;
+	}
+	if (regcomp (&r, pattern, flags | REG_EXTENDED
+#ifdef REG_ENHANCED
+	    | REG_ENHANCED
+#endif
+#ifdef REG_ADVANCED
+	    | REG_ADVANCED
+#endif
+	)) {
+	    message (1, MSG_ERROR, _(" Invalid regular expression "));
+	    return NULL;
+	}
+	old_pattern = g_strdup (pattern);
+	old_flags = flags;
     }
-    return new;
+    return &r;
 }
 
+/* Returns the longest text that every match of the regular expression
+ * contains, or NULL if there is none. Only characters outside of groups
+ * are considered, and expressions with alternatives have none. */
 static char *
-get_line_at (WView *view, offset_type *p, offset_type *skipped)
+regexp_literal (const char *pattern, gboolean icase)
 {
-    char *buffer = NULL;
-    gulong buffer_size = 0;
-    offset_type usable_size = 0;
-    int ch;
-    const int direction = view->direction;
-    offset_type pos = *p;
-    offset_type i = 0;
-    int prev = '\0';
-
-    *skipped = 0;
+    char *best, *cur;
+    size_t best_len = 0, cur_len = 0;
+    const char *p;
+    int depth = 0;
+    int c;
 
-    if (pos == 0 && direction == -1)
-	return 0;
+    if (strchr (pattern, '|') != NULL)
+	return NULL;
 
-    /* skip over all the possible zeros in the file */
-    while ((ch = get_byte (view, pos)) == 0) {
-	if (pos == 0 && direction == -1)
-	    return 0;
-	pos += direction;
-	i++;
+    best = g_malloc (strlen (pattern) + 1);
+    cur = g_malloc (strlen (pattern) + 1);
+    for (p = pattern; *p != '\0'; p++) {
+	c = (unsigned char) *p;
+	switch (c) {
+	case '\\':
+	    if (p[1] == '\0') {
+		c = -1;
+		break;
+	    }
+	    c = (unsigned char) *++p;
+	    if (isalnum (c))
+		c = -1;		/* \1, \w, \< and friends */
+	    break;
+	case '[':
+	    p++;
+	    if (*p == '^')
+		p++;
+	    if (*p == ']')
+		p++;
+	    for (; *p != '\0' && *p != ']'; p++)
+		if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+		    const char *end = strchr (p + 2, ']');
+		    if (end == NULL)
+			break;
+		    p = end;
+		}
+	    if (*p == '\0')
+		p--;
+	    c = -1;
+	    break;
+	case '(':
+	    depth++;
+	    c = -1;
+	    break;
+	case ')':
+	    depth--;
+	    c = -1;
+	    break;
+	case '*':
+	case '?':
+	case '{':
+	    /* The previous character is optional */
+	    if (cur_len > 0)
+		cur_len--;
+	    if (c == '{')
+		while (p[1] != '\0' && *p != '}')
+		    p++;
+	    c = -1;
+	    break;
+	case '+':
+	    /* a+? and a+* make the character optional, too */
+	    if ((p[1] == '*' || p[1] == '?' || p[1] == '{') && cur_len > 0)
+		cur_len--;
+	    c = -1;
+	    break;
+	case '.':
+	case '^':
+	case '$':
+	    c = -1;
+	    break;
+	}
+	if (c != -1 && depth == 0 && !(icase && c >= 0x80)) {
+	    cur[cur_len++] = c;
+	    continue;
+	}
+	if (cur_len > best_len) {
+	    memcpy (best, cur, cur_len);
+	    best_len = cur_len;
+	}
+	cur_len = 0;
     }
-    *skipped = i;
+    if (cur_len > best_len) {
+	memcpy (best, cur, cur_len);
+	best_len = cur_len;
+    }
+    g_free (cur);
+    if (best_len == 0) {
+	g_free (best);
+	return NULL;
+    }
+    best[best_len] = '\0';
+    return best;
+}
 
-    if (i == 0 && (pos != 0 || direction == -1)) {
-	prev = get_byte (view, pos - direction);
-	if ((prev == -1) || (prev == '\n'))
-	    prev = '\0';
+/* Runs the matcher on buf[ls..le) and returns TRUE if it matches. With
+ * last set, the last of the matches is reported, otherwise the first.
+ * The offset of the match in buf is stored in match_pos. */
+static gboolean
+regexp_match_line (regex_t *re, byte *buf, size_t ls, size_t le, int eflags,
+		   gboolean last, size_t *match_pos, offset_type *match_len)
+{
+    regmatch_t pmatch[1];
+    const byte saved = buf[le];
+    gboolean found = FALSE;
+    size_t off = ls;
+
+    buf[le] = '\0';
+    while (off <= le && regexec (re, (char *) buf + off, 1, pmatch, eflags) == 0) {
+	*match_pos = off + pmatch[0].rm_so;
+	*match_len = pmatch[0].rm_eo - pmatch[0].rm_so;
+	found = TRUE;
+	if (!last)
+	    break;
+	/* Matches may overlap, the last one is the one starting last */
+	off = *match_pos + 1;
+	eflags |= REG_NOTBOL;
     }
+    buf[le] = saved;
+    return found;
+}
 
-    for (i = 1; ch != -1; ch = get_byte (view, pos)) {
-	if (i >= usable_size) {
-	    buffer = grow_string_buffer (buffer, &buffer_size);
-	    usable_size = buffer_size - 2;	/* prev & null terminator */
-	}
+/* Searches forward for the regular expression. If lit is not NULL, it
+ * is text that every match contains. */
+static offset_type
+regexp_search_forward (WView *view, regex_t *re, struct search_pattern *lit,
+		       offset_type *match_len)
+{
+    size_t size = VIEW_SEARCH_BLOCK;
+    byte *buf = g_malloc (size + 1);
+    offset_type base, found = INVALID_OFFSET;
+    size_t n, p, q, ls, le, pos;
+    gboolean bol, line_bol, eof;
+    int eflags, c;
 
-	buffer[i++] = ch;
+    base = view->search_start + ((view->search_length) ? 1 : 0);
+    c = (base > 0) ? get_byte (view, base - 1) : '\n';
+    bol = (c == '\n' || c == '\0');
 
-	if (pos == 0 && direction == -1)
+    enable_interrupt_key ();
+    for (;;) {
+	if (verbose) {
+	    view_percent (view, base);
+	    mc_refresh ();
+	}
+	if (got_interrupt ())
 	    break;
-
-	pos += direction;
-
-	if (ch == '\n' || ch == '\0') {
-	    i--;			/* Strip newline/zero */
+	n = view_get_block (view, base, buf, size);
+	if (n == 0)
 	    break;
-	}
+	eof = (n < size);
+
+	for (p = 0; p < n; p = le + 1, bol = TRUE) {
+	    q = p;
+	    if (lit != NULL) {
+		if (n - p < lit->len
+		    || (q = search_block (view, lit, buf + p, base + p, n - p,
+					  n - p - lit->len + 1, match_len)) == INVALID_OFFSET)
+		    q = n;	/* only the last line may still contain it */
+		else
+		    q -= base;
+		if (q == n && eof)
+		    goto done;
+	    }
+	    for (ls = q; ls > p && !is_line_end (buf[ls - 1]); ls--)
+		;
+	    for (le = q; le < n && !is_line_end (buf[le]); le++)
+		;
+	    line_bol = bol || ls > p;
+	    eflags = line_bol ? 0 : REG_NOTBOL;
+
+	    if (le == n && !eof) {
+		/* The line continues in the next block */
+		if (ls > 0) {
+		    base += ls;
+		    bol = line_bol;
+		    goto next_block;
+		}
+		if (size < VIEW_SEARCH_LINE_MAX) {
+		    size *= 2;
+		    buf = g_realloc (buf, size + 1);
+		    goto next_block;
+		}
+		/* The line is too long. Search it in parts. */
+		if (q < n && regexp_match_line (re, buf, 0, n, eflags | REG_NOTEOL,
+						FALSE, &pos, match_len)) {
+		    found = base + pos;
+		    goto done;
+		}
+		base += n;
+		bol = FALSE;
+		goto next_block;
+	    }
 
-	if (got_interrupt()) {
-	    g_free(buffer);
-	    return NULL;
+	    if (regexp_match_line (re, buf, ls, le, eflags, FALSE, &pos, match_len)) {
+		found = base + pos;
+		goto done;
+	    }
 	}
+	if (eof)
+	    break;
+	base += n;
+      next_block:
+	;
     }
+  done:
+    disable_interrupt_key ();
+    g_free (buf);
+    return found;
+}
 
-    if (buffer) {
-	buffer[0] = prev;
-	buffer[i] = '\0';
+/* Searches backward for the regular expression, like
+ * regexp_search_forward(). */
+static offset_type
+regexp_search_backward (WView *view, regex_t *re, struct search_pattern *lit,
+			offset_type *match_len)
+{
+    size_t size = VIEW_SEARCH_BLOCK;
+    byte *buf = g_malloc (size + 1);
+    offset_type lo, hi, found = INVALID_OFFSET;
+    size_t n, e, q, ls, le, pos;
+    gboolean eol, line_eol;
+    int eflags, c;
+
+    hi = view->search_start + ((view->search_length) ? 0 : 1);
+    if (hi > view_get_filesize (view))
+	hi = view_get_filesize (view);
+    c = get_byte (view, hi);
+    eol = (c == -1 || c == '\n' || c == '\0');
 
-	/* If we are searching backwards, reverse the string */
-	if (direction == -1) {
-	    g_strreverse (buffer + 1);
+    enable_interrupt_key ();
+    while (hi > 0) {
+	lo = (hi > size) ? hi - size : 0;
+	if (verbose) {
+	    view_percent (view, lo);
+	    mc_refresh ();
 	}
-    }
-
-    *p = pos;
-    return buffer;
-}
+	if (got_interrupt ())
+	    break;
+	n = view_get_block (view, lo, buf, hi - lo);
+	if (n < hi - lo)
+	    break;
 
-static void
-search_update_steps (WView *view)
-{
-    offset_type filesize = view_get_filesize (view);
-    if (filesize != 0)
-	view->update_steps = 40000;
-    else /* viewing a data stream, not a file */
-	view->update_steps = filesize / 100;
+	for (e = n;; e = ls - 1, eol = TRUE) {
+	    q = e;
+	    if (lit != NULL) {
+		if (e < lit->len
+		    || (q = search_block (view, lit, buf, lo, e, e - lit->len + 1,
+					  match_len)) == INVALID_OFFSET)
+		    q = 0;	/* only the first line may still contain it */
+		else
+		    q -= lo;
+		if (q == 0 && lo == 0)
+		    goto done;
+	    }
+	    for (ls = q; ls > 0 && !is_line_end (buf[ls - 1]); ls--)
+		;
+	    for (le = q; le < e && !is_line_end (buf[le]); le++)
+		;
+	    line_eol = eol || le < e;
+	    eflags = line_eol ? 0 : REG_NOTEOL;
+
+	    if (ls == 0 && lo > 0) {
+		/* The line starts in the previous block */
+		if (lo + le < hi) {
+		    hi = lo + le;
+		    eol = line_eol;
+		    goto next_block;
+		}
+		if (size < VIEW_SEARCH_LINE_MAX) {
+		    size *= 2;
+		    buf = g_realloc (buf, size + 1);
+		    goto next_block;
+		}
+		/* The line is too long. Search it in parts. */
+		if (q > 0 && regexp_match_line (re, buf, 0, e, eflags | REG_NOTBOL,
+						TRUE, &pos, match_len)) {
+		    found = lo + pos;
+		    goto done;
+		}
+		hi = lo;
+		eol = FALSE;
+		goto next_block;
+	    }
 
-    /* Do not update the percent display but every 20 ks */
-    if (view->update_steps < 20000)
-	view->update_steps = 20000;
+	    if (regexp_match_line (re, buf, ls, le, eflags, TRUE, &pos, match_len)) {
+		found = lo + pos;
+		goto done;
+	    }
+	    if (ls == 0)
+		goto done;
+	}
+      next_block:
+	;
+    }
+  done:
+    disable_interrupt_key ();
+    g_free (buf);
+    return found;
 }
 
+/* Searches for text or a regular expression in text mode */
 static void
-search (WView *view, char *text,
-	int (*search) (WView *, char *, char *, int))
+text_search (WView *view, const char *text)
 {
-    char *s = NULL;	/*  The line we read from the view buffer */
-    offset_type p, beginning, search_start;
-    int found_len;
-    int search_status;
+    struct search_pattern sp, *lit = NULL;
+    regex_t *re = NULL;
+    char *literal;
+    offset_type pos, match_len, line;
     Dlg_head *d = 0;
+    int c;
+
+    if (!*text) {
+	view->search_length = 0;
+	return;
+    }
 
-    /* Used to keep track of where the line starts, when looking forward
-     * is the index before transfering the line; the reverse case uses
-     * the position returned after the line has been read */
-    offset_type forward_line_start;
-    offset_type reverse_line_start;
-    offset_type t;
+    if (view->searchopt_regexp) {
+	if ((re = view_regexp_compile (view, text)) == NULL)
+	    return;
+	literal = regexp_literal (text, !view->searchopt_case);
+	if (literal != NULL) {
+	    search_pattern_init (&sp, literal, strlen (literal), !view->searchopt_case);
+	    lit = &sp;
+	    g_free (literal);
+	}
+    }
 
     if (verbose) {
 	d = create_message (D_NORMAL, _("Search"), _("Searching %s"), text);
 	mc_refresh ();
     }
 
-    found_len = view->search_length;
-    search_start = view->search_start;
-
-    if (view->direction == 1) {
-	p = search_start + ((found_len) ? 1 : 0);
-    } else {
-	p = search_start - ((found_len && search_start >= 1) ? 1 : 0);
-    }
-    beginning = p;
-
-    /* Compute the percent steps */
-    search_update_steps (view);
-    view->update_activate = 0;
-
-    enable_interrupt_key ();
-    for (;; g_free (s)) {
-	if (p >= view->update_activate) {
-	    view->update_activate += view->update_steps;
-	    if (verbose) {
-		view_percent (view, p);
-		mc_refresh ();
-	    }
-	}
-	forward_line_start = p;
-	s = get_line_at (view, &p, &t);
-	reverse_line_start = p;
-
-	if (!s)
-	    break;
-
-	search_status = (*search) (view, text, s + 1, match_normal);
-	if (search_status < 0) {
-	    g_free (s);
-	    break;
-	}
-
-	if (search_status == 0)
-	    continue;
-
-	/* We found the string */
-
-	/* Handle ^ and $ when regexp search starts at the middle of the line */
-	if (*s && !view->search_start && (search == regexp_view_search)) {
-	    if ((*text == '^' && view->direction == 1)
-		|| (view->direction == -1 && text[strlen (text) - 1] == '$')
-	       ) {
-		continue;
-	    }
-	}
-	/* Record the position used to continue the search */
+    if (re != NULL) {
 	if (view->direction == 1)
-	    t += forward_line_start;
+	    pos = regexp_search_forward (view, re, lit, &match_len);
 	else
-	    t = reverse_line_start ? reverse_line_start + 2 : 0;
-	view->search_start += t;
-
-	if (t != beginning) {
-	    view->dpy_start = t;
-	}
-
-	g_free (s);
-	break;
+	    pos = regexp_search_backward (view, re, lit, &match_len);
+	if (lit != NULL)
+	    g_free (sp.text);
+    } else {
+	search_pattern_init (&sp, text, strlen (text), !view->searchopt_case);
+	sp.whole = view->searchopt_whole;
+	sp.overstrike = TRUE;
+	pos = view_search_pattern (view, &sp, &match_len);
+	g_free (sp.text);
     }
-    disable_interrupt_key ();
+
     if (verbose) {
 	dlg_run_done (d);
 	destroy_dlg (d);
     }
-    if (!s) {
+
+    if (pos == INVALID_OFFSET) {
 	message (0, _("Search"), _(" Search string not found "));
 	view->search_length = 0;
+	return;
     }
-}
-
-/* Search buffer (its size is len) in the complete buffer
- * returns the position where the block was found or INVALID_OFFSET
- * if not found */
-static offset_type
-block_search (WView *view, const char *buffer, int len)
-{
-    int direction = view->direction;
-    const char *d = buffer;
-    char b;
-    offset_type e;
-
-    enable_interrupt_key ();
-    if (direction == 1)
-	e = view->search_start + ((view->search_length) ? 1 : 0);
-    else
-	e = view->search_start
-	  - ((view->search_length && view->search_start >= 1) ? 1 : 0);
-
-    search_update_steps (view);
-    view->update_activate = 0;
-
-    if (direction == -1) {
-	for (d += len - 1;; e--) {
-	    if (e <= view->update_activate) {
-		view->update_activate -= view->update_steps;
-		if (verbose) {
-		    view_percent (view, e);
-		    mc_refresh ();
-		}
-		if (got_interrupt ())
-		    break;
-	    }
-	    b = get_byte (view, e);
 
-	    if (*d == b) {
-		if (d == buffer) {
-		    disable_interrupt_key ();
-		    return e;
-		}
-		d--;
-	    } else {
-		e += buffer + len - 1 - d;
-		d = buffer + len - 1;
-	    }
-	    if (e == 0)
-		break;
-	}
-    } else {
-	while (get_byte (view, e) != -1) {
-	    if (e >= view->update_activate) {
-		view->update_activate += view->update_steps;
-		if (verbose) {
-		    view_percent (view, e);
-		    mc_refresh ();
-		}
-		if (got_interrupt ())
-		    break;
-	    }
-	    b = get_byte (view, e++);
+    view->search_start = pos;
+    view->search_length = match_len;
 
-	    if (*d == b) {
-		d++;
-		if (d - buffer == len) {
-		    disable_interrupt_key ();
-		    return e - len;
-		}
-	    } else {
-		e -= d - buffer;
-		d = buffer;
-	    }
-	}
+    /* Show the line containing the match */
+    for (line = pos; line > 0; line--) {
+	c = get_byte (view, line - 1);
+	if (c == '\n' || c == '\0' || c == -1)
+	    break;
     }
-    disable_interrupt_key ();
-    return INVALID_OFFSET;
+    view->dpy_start = line;
 }
 
 /*
@@ -2792,6 +3700,8 @@ hex_search (WView *view, const char *text)
     char *cur;			/* Current position in it */
     int block_len;		/* Length of the search string */
     offset_type pos;		/* Position of the string in the file */
+    offset_type match_len;
+    struct search_pattern sp;
     int parse_error = 0;
 
     if (!*text) {
@@ -2857,8 +3767,10 @@ hex_search (WView *view, const char *text)
     }
 
     /* Then start the search */
-    pos = block_search (view, buffer, block_len);
+    search_pattern_init (&sp, buffer, block_len, FALSE);
+    pos = view_search_pattern (view, &sp, &match_len);
 
+    g_free (sp.text);
     g_free (buffer);
 
     if (pos == INVALID_OFFSET) {
@@ -2877,73 +3789,13 @@ hex_search (WView *view, const char *text)
     view->dpy_start = pos - pos % view->bytes_per_line;
 }
 
-static int
-regexp_view_search (WView *view, char *pattern, char *string,
-		    int match_type)
-{
-    static regex_t r;
-    static char *old_pattern = NULL;
-    static int old_type;
-    static int old_flags;
-    regmatch_t pmatch[1];
-    int flags = view->searchopt_case ? 0 : REG_ICASE;
-
-    if (old_pattern == NULL || strcmp (old_pattern, pattern) != 0
-	|| old_type != match_type || old_flags != flags) {
-	if (old_pattern != NULL) {
-	    regfree (&r);
-	    g_free (old_pattern);
-	    old_pattern = 0;
-	}
-	if (regcomp (&r, pattern, flags | REG_EXTENDED
-#ifdef REG_ENHANCED
-	    | REG_ENHANCED
-#endif
-#ifdef REG_ADVANCED
-	    | REG_ADVANCED
-#endif
-	)) {
-	    message (1, MSG_ERROR, _(" Invalid regular expression "));
-	    return -1;
-	}
-	old_pattern = g_strdup (pattern);
-	old_type = match_type;
-	old_flags = flags;
-    }
-    if (view->direction == 1) {
-	if (regexec (&r, string, 1, pmatch, 0) != 0)
-	    return 0;
-    } else {
-	int found = 0;
-	char *p = string + strlen(string);
-	while (--p >= string) {
-	    if (regexec (&r, p, 1, pmatch, 0) == 0 && pmatch[0].rm_so == 0) {
-		pmatch[0].rm_so += p - string;
-		pmatch[0].rm_eo += p - string;
-		found = 1;
-		break;
-	    }
-	}
-	if (!found) {
-	    return 0;
-	}
-    }
-    view->search_length = pmatch[0].rm_eo - pmatch[0].rm_so;
-    view->search_start = pmatch[0].rm_so;
-    return 1;
-}
-
 static void
 do_normal_search (WView *view)
 {
     if (view->hex_mode)
 	hex_search (view, view->search_exp);
-    else if (view->searchopt_regexp)
-	search (view, view->search_exp, regexp_view_search);
-    else if (view->searchopt_case)
-	search (view, view->search_exp, case_search_p);
     else
-	search (view, view->search_exp, icase_search_p);
+	text_search (view, view->search_exp);
     /* Had a refresh here */
     view->dirty++;
     view_update (view);
@@ -3251,7 +4103,8 @@ view_labels (WView *view)
 	if (view->hexedit_mode) {
 	    my_define (h, 2, Q_("ButtonBar|View"),
 		view_toggle_hexedit_mode_cmd, view);
-	} else if (view->datasource == DS_FILE) {
+	} else if (view->datasource == DS_FILE
+		   || view->datasource == DS_MMAP) {
 	    my_define (h, 2, Q_("ButtonBar|Edit"),
 		view_toggle_hexedit_mode_cmd, view);
 	} else {
@@ -3677,21 +4530,17 @@ view_dialog_callback (Dlg_head *h, dlg_msg_t msg, int parm)
 	view_adjust_size (h);
 	return MSG_HANDLED;
     case DLG_IDLE: {
-	int c;
-	Gpm_Event event;
 	WView *view = (WView *)find_widget_type(h, view_callback);
-	/* XXX can't handle file truncations */
-	view_moveto_bottom(view);
-	view_update(view);
-	event.x = -1;
-	c = get_event (&event, h->mouse_status == MOU_REPEAT, 0);
-	if (c != EV_NONE) {
-	    dlg_process_event (h, c, &event);
-	    if (!h->running) {
-		set_idle_proc(h, 0);
-	    }
-	} else {
-	    sleep(1);
+	if (view->monitor_mode && view->monitor_fd == -1) {
+	    /* Check the file for changes once a second */
+	    view_monitor_update (view);
+	    (void) is_idle_wait (1000);
+	} else if (view->datasource != DS_MMAP
+		   || !view_ccache_index (view, NULL, CCACHE_OFFSET, VIEW_INDEX_STEP)) {
+	    /* Index the lines of mapped files in the background. Other
+	     * files are only indexed on demand, since reading them may
+	     * be expensive. */
+	    set_idle_proc (h, 0);
 	}
 	return MSG_HANDLED;
     }
@@ -3757,6 +4606,7 @@ mc_internal_viewer (const char *command, const char *file,
 	*move_dir_p = 0;
     succeeded = view_load (wview, command, file, start_line);
     if (succeeded) {
+	set_idle_proc (view_dlg, 1);
 	dlgswitch_add(view_dlg, DLG_TYPE_VIEW, file, wview);
 	view_run_viewer(view_dlg, wview, move_dir_p);
     } else {
@@ -3765,6 +4615,7 @@ mc_internal_viewer (const char *command, const char *file,
 #else
     succeeded = view_load (wview, command, file, start_line);
     if (succeeded) {
+	set_idle_proc (view_dlg, 1);
 	run_dlg (view_dlg);
 	if (move_dir_p)
 	    *move_dir_p = wview->move_dir;
@@ -3896,6 +4747,7 @@ view_new (int y, int x, int cols, int lines, int is_panel)
 
     view->hexedit_lownibble = FALSE;
     view->coord_cache       = NULL;
+    view->monitor_fd        = -1;
 
     view->dpy_frame_size    = is_panel ? 1 : 0;
     view->dpy_start = 0;
@@ -3924,8 +4776,6 @@ view_new (int y, int x, int cols, int lines, int is_panel)
 	view->marks[i] = 0;
 
     view->move_dir          = 0;
-    view->update_steps      = 0;
-    view->update_activate   = 0;
 
     if (default_hex_mode)
 	view_toggle_hex_mode (view);
@@ -47,6 +47,9 @@
 #define XDIFF_IN_RIGHT		(1 << 1)
 #define XDIFF_DIFFERENT		(1 << 2)
 
+#define XDIFF_BLOCK_SHIFT	16
+#define XDIFF_BLOCK		(1 << XDIFF_BLOCK_SHIFT)
+
 struct display_file {
     char *data;
     size_t sz;
@@ -82,6 +85,11 @@ typedef struct {
     int ord;
     int full;
     int last_found;
+
+    char *scan;			/* scratch buffers for hunk search */
+    unsigned char *eqmap;	/* bitmap of blocks known to be equal */
+    off_t eqlen;		/* number of blocks in eqmap */
+    off_t eqdelta;		/* offset delta eqmap is valid for */
 } WDiff;
 
 
@@ -122,6 +130,8 @@ redo_diff (WDiff *view, int flags)
 	}
 	view->f[0] = f[0];
 	view->f[1] = f[1];
+	free(view->eqmap);
+	view->eqmap = NULL;
     }
     if (flags & REINIT_REALLOC) {
 	if (pbytes > view->maxmem) {
@@ -213,84 +223,212 @@ scan_unsigned (const char **str, off_t *n)
 }
 
 
+/**
+ * Find the first mismatch between two buffers.
+ *
+ * \param s first buffer
+ * \param t second buffer
+ * \param n size of buffers
+ *
+ * \return number of leading bytes that are equal
+ */
+static size_t
+mem_mismatch (const char *s, const char *t, size_t n)
+{
+    size_t i = 0;
+    if (!memcmp(s, t, n)) {
+	return n;
+    }
+    /* let memcmp do the heavy lifting on large stretches */
+    while (n - i >= 256 && !memcmp(s + i, t + i, 256)) {
+	i += 256;
+    }
+    while (i < n && s[i] == t[i]) {
+	i++;
+    }
+    return i;
+}
+
+
+/**
+ * Find the last mismatch between two buffers.
+ *
+ * \param s first buffer
+ * \param t second buffer
+ * \param n size of buffers
+ *
+ * \return number of trailing bytes that are equal
+ */
+static size_t
+mem_mismatch_back (const char *s, const char *t, size_t n)
+{
+    size_t i = n;
+    if (!memcmp(s, t, n)) {
+	return n;
+    }
+    while (i >= 256 && !memcmp(s + i - 256, t + i - 256, 256)) {
+	i -= 256;
+    }
+    while (i > 0 && s[i - 1] == t[i - 1]) {
+	i--;
+    }
+    return n - i;
+}
+
+
+static size_t
+read_at (FBUF *f, off_t off, char *buf, size_t size)
+{
+    if (f_seek(f, off, SEEK_SET) != off) {
+	return 0;
+    }
+    return f_read(f, buf, size);
+}
+
+
 static int
-find_prev_hunk (WDiff *view)
+is_equal_block (const WDiff *view, off_t off)
 {
-    int i;
-    int pbytes = view->pbytes;
+    off_t k = off >> XDIFF_BLOCK_SHIFT;
+    return view->eqmap != NULL && k < view->eqlen && (view->eqmap[k >> 3] & (1 << (k & 7)));
+}
 
-    for (;;) {
-	int sub;
-	int sub1 = pbytes;
-	int sub2 = pbytes;
 
-	if (sub1 > view->df[0].offs) {
-	    sub1 = view->df[0].offs;
-	}
-	if (sub2 > view->df[1].offs) {
-	    sub2 = view->df[1].offs;
+static void
+set_equal_block (WDiff *view, off_t off)
+{
+    off_t k = off >> XDIFF_BLOCK_SHIFT;
+    if (view->eqmap == NULL) {
+	view->eqlen = (view->df[0].end >> XDIFF_BLOCK_SHIFT) + 1;
+	view->eqmap = calloc((view->eqlen + 7) / 8, 1);
+	if (view->eqmap == NULL) {
+	    return;
 	}
+    }
+    if (k < view->eqlen) {
+	view->eqmap[k >> 3] |= 1 << (k & 7);
+    }
+}
 
-	sub = sub1;
-	if (sub > sub2) {
-	    sub = sub2;
-	}
 
-	if (sub == 0) {
+/**
+ * Measure a run of equal or different bytes.
+ *
+ * \param view diff view
+ * \param pos start of run, relative to current offsets
+ * \param different nonzero to measure different bytes, zero for equal bytes
+ * \param back nonzero to measure backwards from `pos'
+ *
+ * \return length of run
+ *
+ * \note going forward, a run stops where the shorter file ends; going
+ *       backward, bytes present in only one file count as different
+ * \note both files are read in aligned blocks, and blocks found equal are
+ *       remembered, so they are skipped without reading next time
+ */
+static off_t
+scan_run (WDiff *view, off_t pos, int different, int back)
+{
+    off_t delta = view->df[1].offs - view->df[0].offs;
+    off_t start = view->df[0].offs + pos;
+    off_t run = 0;
+    char *buf0, *buf1;
+
+    if (view->scan == NULL) {
+	view->scan = malloc(2 * XDIFF_BLOCK);
+	if (view->scan == NULL) {
 	    return 0;
 	}
+    }
+    buf0 = view->scan;
+    buf1 = view->scan + XDIFF_BLOCK;
 
-	view->df[0].offs -= sub;
-	view->df[1].offs -= sub;
+    if (view->eqmap != NULL && view->eqdelta != delta) {
+	free(view->eqmap);
+	view->eqmap = NULL;
+    }
+    view->eqdelta = delta;
 
-	redo_diff(view, REINIT_READ_LEFT | REINIT_READ_RIGHT);
+    for (;;) {
+	off_t off;
+	size_t chunk, n0, n1, n, i;
 
-	i = sub;
-	while (i > 0 && !(view->diffs[i - 1] & XDIFF_DIFFERENT)) {
-	    i--;
+	if (!back) {
+	    off = start + run;
+	    chunk = XDIFF_BLOCK - (off & (XDIFF_BLOCK - 1));
+	} else {
+	    off = start - run;
+	    chunk = off & (XDIFF_BLOCK - 1);
+	    if (chunk == 0) {
+		chunk = XDIFF_BLOCK;
+	    }
+	    if ((off_t)chunk > off) {
+		chunk = off;
+	    }
+	    if ((off_t)chunk > off + delta) {
+		chunk = off + delta;
+	    }
+	    if (chunk == 0) {
+		break;
+	    }
+	    off -= chunk;
 	}
-	if (i > 0) {
-	    break;
+
+	if (!different && chunk == XDIFF_BLOCK && is_equal_block(view, off)) {
+	    run += chunk;
+	    continue;
 	}
-    }
 
-    for (;;) {
-	int sub;
-	int sub1 = pbytes;
-	int sub2 = pbytes;
+	n0 = read_at(view->f[0], off, buf0, chunk);
+	n1 = read_at(view->f[1], off + delta, buf1, chunk);
+	n = (n0 < n1) ? n0 : n1;
 
-	while (i > 0 && (view->diffs[i - 1] & XDIFF_DIFFERENT)) {
-	    i--;
-	}
-	if (i > 0) {
-	    view->df[0].offs += i;
-	    view->df[1].offs += i;
-	    break;
+	if (!back) {
+	    if (different) {
+		for (i = 0; i < n && buf0[i] != buf1[i]; i++) {
+		}
+	    } else {
+		i = mem_mismatch(buf0, buf1, n);
+	    }
+	} else {
+	    size_t m = (n0 > n1) ? n0 : n1;
+	    if (different) {
+		i = chunk;
+		if (m == chunk) {
+		    i = n;
+		    while (i > 0 && buf0[i - 1] != buf1[i - 1]) {
+			i--;
+		    }
+		}
+		i = chunk - i;
+	    } else {
+		i = (n == chunk) ? mem_mismatch_back(buf0, buf1, n) : 0;
+	    }
 	}
 
-	if (sub1 > view->df[0].offs) {
-	    sub1 = view->df[0].offs;
+	if (!different && i == XDIFF_BLOCK) {
+	    set_equal_block(view, off);
 	}
-	if (sub2 > view->df[1].offs) {
-	    sub2 = view->df[1].offs;
+	run += i;
+	if (i < chunk) {
+	    break;
 	}
+    }
 
-	sub = sub1;
-	if (sub > sub2) {
-	    sub = sub2;
-	}
+    return run;
+}
 
-	if (sub == 0) {
-	    return 0;
-	}
 
-	view->df[0].offs -= sub;
-	view->df[1].offs -= sub;
+static int
+find_prev_hunk (WDiff *view)
+{
+    off_t i;
 
-	redo_diff(view, REINIT_READ_LEFT | REINIT_READ_RIGHT);
+    i = scan_run(view, 0, 0, 1);
+    i += scan_run(view, -i, 1, 1);
 
-	i = sub;
-    }
+    view->df[0].offs -= i;
+    view->df[1].offs -= i;
     return 0;
 }
 
@@ -298,38 +436,17 @@ find_prev_hunk (WDiff *view)
 static int
 find_next_hunk (WDiff *view)
 {
-    int i;
-    int pbytes = view->pbytes;
+    off_t i;
 
-    if (!pbytes) {
+    if (!view->pbytes) {
 	return 0;
     }
 
-    for (;;) {
-	i = 0;
-	while (i < pbytes && (view->diffs[i] == (XDIFF_DIFFERENT | XDIFF_IN_LEFT | XDIFF_IN_RIGHT))) {
-	    i++;
-	}
-	if (i < pbytes) {
-	    break;
-	}
-	view->df[0].offs += i;
-	view->df[1].offs += i;
-	redo_diff(view, REINIT_READ_LEFT | REINIT_READ_RIGHT);
-    }
+    i = scan_run(view, 0, 1, 0);
+    i += scan_run(view, i, 0, 0);
 
-    for (;;) {
-	while (i < pbytes && !(view->diffs[i] & XDIFF_DIFFERENT) && view->diffs[i]) {
-	    i++;
-	}
-	view->df[0].offs += i;
-	view->df[1].offs += i;
-	if (i < pbytes) {
-	    break;
-	}
-	redo_diff(view, REINIT_READ_LEFT | REINIT_READ_RIGHT);
-	i = 0;
-    }
+    view->df[0].offs += i;
+    view->df[1].offs += i;
 
     if (view->df[0].offs >= view->df[0].end && view->df[1].offs >= view->df[1].end) {
 	view->df[0].offs--;
@@ -522,6 +639,9 @@ view_init (WDiff *view, const char *file1, const char *file2)
     view->df[1].data = NULL;
     view->df[0].move = 1;
     view->df[1].move = 1;
+    view->scan = NULL;
+    view->eqmap = NULL;
+    view->eqdelta = 0;
     view->df[0].end = f_seek(view->f[0], 0, SEEK_END);
     view->df[1].end = f_seek(view->f[1], 0, SEEK_END);
     view->max = view->df[0].end;
@@ -551,7 +671,11 @@ view_fini (WDiff *view, int free_mem)
 	free(view->diffs);
 	view->diffs = NULL;
 	view->maxmem = 0;
+	free(view->scan);
+	view->scan = NULL;
     }
+    free(view->eqmap);
+    view->eqmap = NULL;
 
     f_close(view->f[1]);
     f_close(view->f[0]);
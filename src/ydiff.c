@@ -19,6 +19,7 @@
 
 #include <config.h>
 #include <ctype.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include "global.h"
 #include "tty.h"
@@ -51,15 +52,13 @@ typedef int (*DFUNC) (void *ctx, int ch, int line, off_t off, size_t sz, const c
 
 #define HDIFF_ENABLE	1
 #define HDIFF_MINCTX	5
-#define HDIFF_DEPTH	10
+#define HDIFF_LIMIT	64
 
 typedef struct {
     int off;
     int len;
 } BRACKET[2];
 
-typedef int PAIR[2];
-
 #define TAB_SKIP(ts, pos)	((ts) - (pos) % (ts))
 
 typedef enum {
@@ -85,6 +84,16 @@ typedef struct {
     DSRC dsrc;
 } PRINTER_CTX;
 
+typedef struct {
+    int quality;
+    int strip_trailing_cr;
+    int ignore_tab_expansion;
+    int ignore_space_change;
+    int ignore_all_space;
+    int ignore_case;
+    int external;		/* use external diff instead of built-in */
+} DIFFOPT;
+
 typedef struct {
     Widget widget;
 
@@ -114,19 +123,12 @@ typedef struct {
     int full;
     int last_found;
 
-    struct {
-	int quality;
-	int strip_trailing_cr;
-	int ignore_tab_expansion;
-	int ignore_space_change;
-	int ignore_all_space;
-	int ignore_case;
-    } opt;
+    DIFFOPT opt;
 } WDiff;
 
 
 #define OPTX 50
-#define OPTY 12
+#define OPTY 13
 
 static const char *quality_str[] = {
     N_("&Normal"),
@@ -135,14 +137,15 @@ static const char *quality_str[] = {
 };
 
 static QuickWidget diffopt_widgets[] = {
-    { quick_button,   6,   10, 9, OPTY, N_("&Cancel"),                 0, B_CANCEL, NULL, NULL, NULL },
-    { quick_button,   3,   10, 9, OPTY, N_("&OK"),                     0, B_ENTER,  NULL, NULL, NULL },
+    { quick_button,   6,   10, 10, OPTY, N_("&Cancel"),                0, B_CANCEL, NULL, NULL, NULL },
+    { quick_button,   3,   10, 10, OPTY, N_("&OK"),                    0, B_ENTER,  NULL, NULL, NULL },
     { quick_radio,   34, OPTX, 4, OPTY, "",                            3, 2,        NULL, const_cast(char **, quality_str), NULL },
     { quick_checkbox, 4, OPTX, 7, OPTY, N_("strip trailing &CR"),      0, 0,        NULL, NULL, NULL },
     { quick_checkbox, 4, OPTX, 6, OPTY, N_("ignore all &Whitespace"),  0, 0,        NULL, NULL, NULL },
     { quick_checkbox, 4, OPTX, 5, OPTY, N_("ignore &Space change"),    0, 0,        NULL, NULL, NULL },
     { quick_checkbox, 4, OPTX, 4, OPTY, N_("ignore tab &Expansion"),   0, 0,        NULL, NULL, NULL },
     { quick_checkbox, 4, OPTX, 3, OPTY, N_("&Ignore case"),            0, 0,        NULL, NULL, NULL },
+    { quick_checkbox, 4, OPTX, 8, OPTY, N_("use external &Diff"),      0, 0,        NULL, NULL, NULL },
     NULL_QuickWidget
 };
 
@@ -342,6 +345,627 @@ dff_execute (const char *args, const char *extra, const char *file1, const char
 }
 
 
+/* internal diff *************************************************************/
+
+
+typedef struct {
+    size_t off;			/* offset of line text inside IDFILE::text */
+    size_t len;			/* line length, including newline */
+    unsigned int hash;
+} IDLINE;
+
+typedef struct {
+    char *buf;			/* file contents */
+    char *norm;			/* normalized lines, or NULL if not needed */
+    const char *text;		/* either buf or norm */
+    IDLINE *lines;
+    int nlines;
+    int *cls;			/* equivalence class of each line */
+    int *cv;			/* equivalence class of each compacted line */
+    int *map;			/* compacted index -> line number */
+    int n;			/* number of compacted lines */
+    char *chg;			/* change flag of each line */
+} IDFILE;
+
+typedef struct {
+    const char *p;
+    size_t len;
+    unsigned int hash;
+    int count[2];
+} IDCLASS;
+
+typedef struct {
+    const int *xv, *yv;		/* compacted classes */
+    const int *xmap, *ymap;	/* compacted index -> line number, or NULL */
+    char *xchg, *ychg;		/* change flags */
+    int *fd, *bd;		/* forward/backward diagonals */
+    int limit;			/* cost limit, 0 for no heuristic */
+} MYERS;
+
+
+/**
+ * Normalize line according to diff options.
+ *
+ * \param src line to normalize
+ * \param len line length, excluding newline
+ * \param dst buffer to write to, must hold at least 8 * len bytes
+ * \param opt diff options
+ *
+ * \return length of normalized line
+ */
+static size_t
+idf_normalize (const char *src, size_t len, char *dst, const DIFFOPT *opt)
+{
+    size_t i, j = 0;
+    int space = 0;
+    int col = 0;
+
+    if (opt->strip_trailing_cr && len && src[len - 1] == '\r') {
+	len--;
+    }
+
+    for (i = 0; i < len; i++) {
+	int c = (unsigned char)src[i];
+	if (opt->ignore_all_space || opt->ignore_space_change) {
+	    if (isspace(c)) {
+		space = 1;
+		continue;
+	    }
+	    if (space && !opt->ignore_all_space) {
+		dst[j++] = ' ';
+	    }
+	    space = 0;
+	} else if (c == '\t' && opt->ignore_tab_expansion) {
+	    do {
+		dst[j++] = ' ';
+	    } while (++col % 8);
+	    continue;
+	}
+	if (opt->ignore_case) {
+	    c = tolower(c);
+	}
+	dst[j++] = c;
+	col++;
+    }
+
+    return j;
+}
+
+
+/**
+ * Load file in memory and split it into hashed lines.
+ *
+ * \param f file to read
+ * \param idf file structure to fill
+ * \param opt diff options
+ *
+ * \return 0 if success, otherwise non-zero
+ */
+static int
+idf_load (FBUF *f, IDFILE *idf, const DIFFOPT *opt)
+{
+    size_t size = 0, max = 0;
+    size_t nsize = 0, nmax = 0;
+    size_t off, i;
+    int normalize;
+    int k;
+
+    memset(idf, 0, sizeof(IDFILE));
+
+    for (;;) {
+	size_t sz;
+	if (size == max) {
+	    char *p;
+	    max = max ? 2 * max : 65536;
+	    p = realloc(idf->buf, max);
+	    if (p == NULL) {
+		return -1;
+	    }
+	    idf->buf = p;
+	}
+	sz = f_read(f, idf->buf + size, max - size);
+	if (sz == 0) {
+	    break;
+	}
+	size += sz;
+    }
+
+    for (i = 0; i < size; i++) {
+	if (idf->buf[i] == '\n') {
+	    idf->nlines++;
+	}
+    }
+    if (size && idf->buf[size - 1] != '\n') {
+	idf->nlines++;
+    }
+
+    idf->lines = malloc((idf->nlines + 1) * sizeof(IDLINE));
+    idf->cls = malloc((idf->nlines + 1) * sizeof(int));
+    idf->cv = malloc((idf->nlines + 1) * sizeof(int));
+    idf->map = malloc((idf->nlines + 1) * sizeof(int));
+    idf->chg = calloc(idf->nlines + 1, 1);
+    if (idf->lines == NULL || idf->cls == NULL || idf->cv == NULL || idf->map == NULL || idf->chg == NULL) {
+	return -1;
+    }
+
+    normalize = opt->strip_trailing_cr || opt->ignore_tab_expansion ||
+		opt->ignore_space_change || opt->ignore_all_space || opt->ignore_case;
+
+    for (off = 0, k = 0; off < size; k++) {
+	IDLINE *line = &idf->lines[k];
+	const char *p = idf->buf + off;
+	const char *q = memchr(p, '\n', size - off);
+	size_t len = (q != NULL) ? (size_t)(q - p) : size - off;
+	unsigned int hash = 2166136261U;
+	const char *s;
+
+	if (normalize) {
+	    if (nsize + 8 * len + 1 > nmax) {
+		char *n;
+		while (nsize + 8 * len + 1 > nmax) {
+		    nmax = nmax ? 2 * nmax : 65536;
+		}
+		n = realloc(idf->norm, nmax);
+		if (n == NULL) {
+		    return -1;
+		}
+		idf->norm = n;
+	    }
+	    line->off = nsize;
+	    line->len = idf_normalize(p, len, idf->norm + nsize, opt);
+	    if (q != NULL) {
+		idf->norm[nsize + line->len++] = '\n';
+	    }
+	    nsize += line->len;
+	    s = idf->norm + line->off;
+	} else {
+	    line->off = off;
+	    line->len = len + (q != NULL);
+	    s = p;
+	}
+	for (i = 0; i < line->len; i++) {
+	    hash = (hash ^ (unsigned char)s[i]) * 16777619U;
+	}
+	line->hash = hash;
+
+	off += len + (q != NULL);
+    }
+
+    idf->text = normalize ? idf->norm : idf->buf;
+    return 0;
+}
+
+
+static void
+idf_free (IDFILE *idf)
+{
+    free(idf->chg);
+    free(idf->map);
+    free(idf->cv);
+    free(idf->cls);
+    free(idf->lines);
+    free(idf->norm);
+    free(idf->buf);
+}
+
+
+/**
+ * Assign equivalence classes to lines, so that equal lines get equal classes.
+ * Lines that do not occur in the other file are marked as changed and left
+ * out of the compacted arrays, because they can never be matched.
+ *
+ * \param idf both files
+ *
+ * \return 0 if success, otherwise non-zero
+ */
+static int
+idf_classify (IDFILE *idf)
+{
+    ARRAY classes;
+    int *bucket;
+    unsigned int mask;
+    int total = idf[0].nlines + idf[1].nlines;
+    int ord, k;
+
+    for (mask = 1; mask < 2 * (unsigned int)total; mask <<= 1) {
+    }
+    bucket = calloc(mask, sizeof(int));
+    if (bucket == NULL) {
+	return -1;
+    }
+    mask--;
+
+    arr_init(&classes, sizeof(IDCLASS), 0);
+
+    for (ord = 0; ord < 2; ord++) {
+	for (k = 0; k < idf[ord].nlines; k++) {
+	    const IDLINE *line = &idf[ord].lines[k];
+	    const char *p = idf[ord].text + line->off;
+	    unsigned int h = line->hash & mask;
+	    IDCLASS *c;
+	    while (bucket[h]) {
+		c = (IDCLASS *)classes.data + bucket[h] - 1;
+		if (c->hash == line->hash && c->len == line->len && !memcmp(c->p, p, line->len)) {
+		    break;
+		}
+		h = (h + 1) & mask;
+	    }
+	    if (!bucket[h]) {
+		c = arr_enlarge(&classes);
+		if (c == NULL) {
+		    free(bucket);
+		    arr_free(&classes, NULL);
+		    return -1;
+		}
+		c->p = p;
+		c->len = line->len;
+		c->hash = line->hash;
+		c->count[0] = 0;
+		c->count[1] = 0;
+		bucket[h] = classes.len;
+	    }
+	    c = (IDCLASS *)classes.data + bucket[h] - 1;
+	    c->count[ord]++;
+	    idf[ord].cls[k] = bucket[h] - 1;
+	}
+    }
+
+    free(bucket);
+
+    for (ord = 0; ord < 2; ord++) {
+	int n = 0;
+	for (k = 0; k < idf[ord].nlines; k++) {
+	    const IDCLASS *c = (IDCLASS *)classes.data + idf[ord].cls[k];
+	    if (c->count[ord ^ 1]) {
+		idf[ord].cv[n] = idf[ord].cls[k];
+		idf[ord].map[n++] = k;
+	    } else {
+		idf[ord].chg[k] = 1;
+	    }
+	}
+	idf[ord].n = n;
+    }
+
+    arr_free(&classes, NULL);
+    return 0;
+}
+
+
+/**
+ * Find the midpoint of the shortest edit script for a box (Myers).
+ *
+ * \param m context
+ * \param xoff start of first range
+ * \param xlim end of first range
+ * \param yoff start of second range
+ * \param ylim end of second range
+ * \param[out] px split point inside first range
+ * \param[out] py split point inside second range
+ *
+ * \note if the cost limit is exceeded, a good-enough split point is returned
+ */
+static void
+myers_split (MYERS *m, int xoff, int xlim, int yoff, int ylim, int *px, int *py)
+{
+    const int *xv = m->xv;
+    const int *yv = m->yv;
+    int *fd = m->fd;
+    int *bd = m->bd;
+    const int dmin = xoff - ylim;
+    const int dmax = xlim - yoff;
+    const int fmid = xoff - yoff;
+    const int bmid = xlim - ylim;
+    const int odd = (fmid - bmid) & 1;
+    int fmin = fmid, fmax = fmid;
+    int bmin = bmid, bmax = bmid;
+    int c, d;
+
+    fd[fmid] = xoff;
+    bd[bmid] = xlim;
+
+    for (c = 1;; c++) {
+	if (fmin > dmin) {
+	    fd[--fmin - 1] = -1;
+	} else {
+	    ++fmin;
+	}
+	if (fmax < dmax) {
+	    fd[++fmax + 1] = -1;
+	} else {
+	    --fmax;
+	}
+	for (d = fmax; d >= fmin; d -= 2) {
+	    int x, y;
+	    int tlo = fd[d - 1];
+	    int thi = fd[d + 1];
+	    x = (tlo >= thi) ? tlo + 1 : thi;
+	    y = x - d;
+	    while (x < xlim && y < ylim && xv[x] == yv[y]) {
+		x++;
+		y++;
+	    }
+	    fd[d] = x;
+	    if (odd && bmin <= d && d <= bmax && bd[d] <= x) {
+		*px = x;
+		*py = y;
+		return;
+	    }
+	}
+
+	if (bmin > dmin) {
+	    bd[--bmin - 1] = INT_MAX;
+	} else {
+	    ++bmin;
+	}
+	if (bmax < dmax) {
+	    bd[++bmax + 1] = INT_MAX;
+	} else {
+	    --bmax;
+	}
+	for (d = bmax; d >= bmin; d -= 2) {
+	    int x, y;
+	    int tlo = bd[d - 1];
+	    int thi = bd[d + 1];
+	    x = (tlo < thi) ? tlo : thi - 1;
+	    y = x - d;
+	    while (x > xoff && y > yoff && xv[x - 1] == yv[y - 1]) {
+		x--;
+		y--;
+	    }
+	    bd[d] = x;
+	    if (!odd && fmin <= d && d <= fmax && x <= fd[d]) {
+		*px = x;
+		*py = y;
+		return;
+	    }
+	}
+
+	if (m->limit && c >= m->limit) {
+	    /* too expensive: take the furthest reaching path in either direction */
+	    int fxybest = -1, fxbest = 0;
+	    int bxybest = INT_MAX, bxbest = 0;
+	    for (d = fmax; d >= fmin; d -= 2) {
+		int x = (fd[d] < xlim) ? fd[d] : xlim;
+		int y = x - d;
+		if (y > ylim) {
+		    x = ylim + d;
+		    y = ylim;
+		}
+		if (fxybest < x + y) {
+		    fxybest = x + y;
+		    fxbest = x;
+		}
+	    }
+	    for (d = bmax; d >= bmin; d -= 2) {
+		int x = (bd[d] > xoff) ? bd[d] : xoff;
+		int y = x - d;
+		if (y < yoff) {
+		    x = yoff + d;
+		    y = yoff;
+		}
+		if (x + y < bxybest) {
+		    bxybest = x + y;
+		    bxbest = x;
+		}
+	    }
+	    if ((xlim + ylim) - bxybest < fxybest - (xoff + yoff)) {
+		*px = fxbest;
+		*py = fxybest - fxbest;
+	    } else {
+		*px = bxbest;
+		*py = bxybest - bxbest;
+	    }
+	    return;
+	}
+    }
+}
+
+
+/**
+ * Compare two ranges and mark changed lines.
+ *
+ * \param m context
+ * \param xoff start of first range
+ * \param xlim end of first range
+ * \param yoff start of second range
+ * \param ylim end of second range
+ */
+static void
+myers_compare (MYERS *m, int xoff, int xlim, int yoff, int ylim)
+{
+    for (;;) {
+	int xmid, ymid;
+
+	while (xoff < xlim && yoff < ylim && m->xv[xoff] == m->yv[yoff]) {
+	    xoff++;
+	    yoff++;
+	}
+	while (xlim > xoff && ylim > yoff && m->xv[xlim - 1] == m->yv[ylim - 1]) {
+	    xlim--;
+	    ylim--;
+	}
+
+	if (xoff == xlim) {
+	    for (; yoff < ylim; yoff++) {
+		m->ychg[(m->ymap != NULL) ? m->ymap[yoff] : yoff] = 1;
+	    }
+	    return;
+	}
+	if (yoff == ylim) {
+	    for (; xoff < xlim; xoff++) {
+		m->xchg[(m->xmap != NULL) ? m->xmap[xoff] : xoff] = 1;
+	    }
+	    return;
+	}
+
+	myers_split(m, xoff, xlim, yoff, ylim, &xmid, &ymid);
+	myers_compare(m, xoff, xmid, yoff, ymid);
+	xoff = xmid;
+	yoff = ymid;
+    }
+}
+
+
+/**
+ * Slide runs of changed lines down as far as possible, so hunks start
+ * and end in the same places as GNU diff would put them.
+ *
+ * \param idf file structure
+ */
+static void
+idf_shift (IDFILE *idf)
+{
+    const int *cls = idf->cls;
+    char *chg = idf->chg;
+    int n = idf->nlines;
+    int i = 0;
+
+    for (;;) {
+	int start, end;
+	while (i < n && !chg[i]) {
+	    i++;
+	}
+	if (i == n) {
+	    break;
+	}
+	start = i;
+	while (i < n && chg[i]) {
+	    i++;
+	}
+	end = i;
+	while (end < n && cls[start] == cls[end]) {
+	    chg[start++] = 0;
+	    chg[end++] = 1;
+	    while (end < n && chg[end]) {
+		end++;
+	    }
+	}
+	i = end;
+    }
+}
+
+
+/**
+ * Compare files in-process and extract diff statements.
+ *
+ * \param f1 first file to compare
+ * \param f2 second file to compare
+ * \param opt diff options
+ * \param ops list of diff statements to fill
+ *
+ * \return positive number indicating number of hunks, otherwise negative
+ *
+ * \note both files are rewound on success
+ */
+static int
+dff_internal (FBUF *f1, FBUF *f2, const DIFFOPT *opt, ARRAY *ops)
+{
+    IDFILE idf[2];
+    MYERS m;
+    int *diag;
+    int i, j, n;
+    int rv = -1;
+
+    if (idf_load(f1, &idf[0], opt) != 0) {
+	idf_free(&idf[0]);
+	return -1;
+    }
+    if (idf_load(f2, &idf[1], opt) != 0) {
+	idf_free(&idf[1]);
+	idf_free(&idf[0]);
+	return -1;
+    }
+
+    if (idf_classify(idf) != 0) {
+	goto err;
+    }
+
+    n = idf[0].n + idf[1].n + 3;
+    diag = malloc(2 * n * sizeof(int));
+    if (diag == NULL) {
+	goto err;
+    }
+
+    m.xv = idf[0].cv;
+    m.yv = idf[1].cv;
+    m.xmap = idf[0].map;
+    m.ymap = idf[1].map;
+    m.xchg = idf[0].chg;
+    m.ychg = idf[1].chg;
+    m.fd = diag + idf[1].n + 1;
+    m.bd = diag + n + idf[1].n + 1;
+    m.limit = 0;
+    if (opt->quality == 0) {
+	for (m.limit = 1, i = n; i != 0; i >>= 2) {
+	    m.limit <<= 1;
+	}
+	if (m.limit < 4096) {
+	    m.limit = 4096;
+	}
+    } else if (opt->quality == 1) {
+	m.limit = 256;
+    }
+
+    myers_compare(&m, 0, idf[0].n, 0, idf[1].n);
+    free(diag);
+
+    idf_shift(&idf[0]);
+    idf_shift(&idf[1]);
+
+    arr_init(ops, sizeof(DIFFCMD), 64);
+    for (i = 0, j = 0; i < idf[0].nlines || j < idf[1].nlines;) {
+	if ((i < idf[0].nlines && idf[0].chg[i]) || (j < idf[1].nlines && idf[1].chg[j])) {
+	    DIFFCMD *op;
+	    int si = i, sj = j;
+	    while (i < idf[0].nlines && idf[0].chg[i]) {
+		i++;
+	    }
+	    while (j < idf[1].nlines && idf[1].chg[j]) {
+		j++;
+	    }
+	    op = arr_enlarge(ops);
+	    if (op == NULL) {
+		arr_free(ops, NULL);
+		goto err;
+	    }
+	    if (si == i) {
+		op->cmd = 'a';
+		op->a[0][0] = si;
+		op->a[0][1] = si;
+		op->a[1][0] = sj + 1;
+		op->a[1][1] = j;
+	    } else if (sj == j) {
+		op->cmd = 'd';
+		op->a[0][0] = si + 1;
+		op->a[0][1] = i;
+		op->a[1][0] = sj;
+		op->a[1][1] = sj;
+	    } else {
+		op->cmd = 'c';
+		op->a[0][0] = si + 1;
+		op->a[0][1] = i;
+		op->a[1][0] = sj + 1;
+		op->a[1][1] = j;
+	    }
+	} else {
+	    i++;
+	    j++;
+	}
+    }
+
+    if (f_seek(f1, 0, SEEK_SET) == 0 && f_seek(f2, 0, SEEK_SET) == 0) {
+	rv = ops->len;
+    } else {
+	arr_free(ops, NULL);
+    }
+
+  err:
+    idf_free(&idf[1]);
+    idf_free(&idf[0]);
+    return rv;
+}
+
+
 /**
  * Reparse and display file according to diff statements.
  *
@@ -492,161 +1116,109 @@ dff_reparse (int ord, FBUF *f, const ARRAY *ops, DFUNC printer, void *ctx)
 
 
 /**
- * Longest common substring.
+ * Scan for changed ranges inside a bracket and build ranges, merging
+ * changes separated by less than `min' common characters.
  *
  * \param s first string
- * \param m length of first string
  * \param t second string
- * \param n length of second string
- * \param ret list of offsets for longest common substrings inside each string
+ * \param bracket current limits for both of the strings
  * \param min minimum length of common substrings
+ * \param hdiff list of horizontal diff ranges to fill
  *
  * \return 0 if success, nonzero otherwise
+ *
+ * \note uses the same Myers engine as line diff, with a small cost limit,
+ *       so the running time stays close to linear even for very long lines
  */
 static int
-lcsubstr (const char *s, int m, const char *t, int n, ARRAY *ret, int min)
+hdiff_multi (const char *s, const char *t, const BRACKET bracket, int min, ARRAY *hdiff)
 {
-    int i, j;
-
-    int *Lprev, *Lcurr;
-
-    int z = 0;
-
-    arr_init(ret, sizeof(PAIR), 4);
-
-    if (m < min || n < min) {
-	/* XXX early culling */
-	return 0;
+    MYERS mm;
+    BRACKET *p;
+    int m = bracket[0].len;
+    int n = bracket[1].len;
+    int *xv, *diag;
+    char *chg;
+    int i, j, k;
+    int have = 0;
+    int ps = 0, pt = 0, pe = 0, pf = 0;
+
+    xv = malloc((m + n + 1) * sizeof(int));
+    diag = malloc(2 * (m + n + 3) * sizeof(int));
+    chg = calloc(m + n + 1, 1);
+    if (xv == NULL || diag == NULL || chg == NULL) {
+	free(chg);
+	free(diag);
+	free(xv);
+	return -1;
     }
 
-    Lprev = calloc(n + 1, sizeof(int));
-    if (Lprev == NULL) {
-	goto err_0;
+    for (k = 0; k < m; k++) {
+	xv[k] = (unsigned char)s[bracket[0].off + k];
     }
-    Lcurr = calloc(n + 1, sizeof(int));
-    if (Lcurr == NULL) {
-	goto err_1;
+    for (k = 0; k < n; k++) {
+	xv[m + k] = (unsigned char)t[bracket[1].off + k];
     }
 
-    for (i = 0; i < m; i++) {
-	int *L = Lprev;
-	Lprev = Lcurr;
-	Lcurr = L;
-#ifdef USE_MEMSET_IN_LCS
-	memset(Lcurr, 0, (n + 1) * sizeof(int));
-#endif
-	for (j = 0; j < n; j++) {
-#ifndef USE_MEMSET_IN_LCS
-	    Lcurr[j + 1] = 0;
-#endif
-	    if (s[i] == t[j]) {
-		int v = Lprev[j] + 1;
-		Lcurr[j + 1] = v;
-		if (z < v) {
-		    z = v;
-		    arr_reset(ret);
-		}
-		if (z == v && z >= min) {
-		    int off0 = i - z + 1;
-		    int off1 = j - z + 1;
-		    int k;
-		    PAIR *p;
-		    for (p = ret->data, k = 0; k < ret->len; k++, p++) {
-			if ((*p)[0] == off0) {
-			    break;
-			}
-			if ((*p)[1] >= off1) {
-			    break;
-			}
-		    }
-		    if (k == ret->len) {
-			p = arr_enlarge(ret);
-			if (p == NULL) {
-			    goto err_2;
-			}
-			(*p)[0] = off0;
-			(*p)[1] = off1;
-		    }
+    mm.xv = xv;
+    mm.yv = xv + m;
+    mm.xmap = NULL;
+    mm.ymap = NULL;
+    mm.xchg = chg;
+    mm.ychg = chg + m;
+    mm.fd = diag + n + 1;
+    mm.bd = diag + (m + n + 3) + n + 1;
+    mm.limit = HDIFF_LIMIT;
+    myers_compare(&mm, 0, m, 0, n);
+
+    for (i = 0, j = 0; i < m || j < n;) {
+	if ((i < m && mm.xchg[i]) || (j < n && mm.ychg[j])) {
+	    int si = i, sj = j;
+	    while (i < m && mm.xchg[i]) {
+		i++;
+	    }
+	    while (j < n && mm.ychg[j]) {
+		j++;
+	    }
+	    if (have && si - pe < min) {
+		pe = i;
+		pf = j;
+		continue;
+	    }
+	    if (have) {
+		p = arr_enlarge(hdiff);
+		if (p == NULL) {
+		    break;
 		}
+		(*p)[0].off = bracket[0].off + ps;
+		(*p)[0].len = pe - ps;
+		(*p)[1].off = bracket[1].off + pt;
+		(*p)[1].len = pf - pt;
 	    }
+	    have = 1;
+	    ps = si;
+	    pt = sj;
+	    pe = i;
+	    pf = j;
+	} else {
+	    i++;
+	    j++;
 	}
     }
-
-    free(Lcurr);
-    free(Lprev);
-    return z;
-
-  err_2:
-    free(Lcurr);
-  err_1:
-    free(Lprev);
-  err_0:
-    arr_free(ret, NULL);
-    return -1;
-}
-
-
-/**
- * Scan recursively for common substrings and build ranges.
- *
- * \param s first string
- * \param t second string
- * \param bracket current limits for both of the strings
- * \param min minimum length of common substrings
- * \param hdiff list of horizontal diff ranges to fill
- * \param depth recursion depth
- *
- * \return 0 if success, nonzero otherwise
- */
-static int
-hdiff_multi (const char *s, const char *t, const BRACKET bracket, int min, ARRAY *hdiff, unsigned int depth)
-{
-    BRACKET *p;
-
-    if (depth--) {
-	ARRAY ret;
-	BRACKET b;
-	int len = lcsubstr(s + bracket[0].off, bracket[0].len,
-			   t + bracket[1].off, bracket[1].len, &ret, min);
-	if (ret.len) {
-	    int k = 0;
-	    const PAIR *data = ret.data;
-
-	    b[0].off = bracket[0].off;
-	    b[0].len = data[k][0];
-	    b[1].off = bracket[1].off;
-	    b[1].len = data[k][1];
-	    hdiff_multi(s, t, b, min, hdiff, depth);
-
-	    for (k = 0; k < ret.len - 1; k++) {
-		b[0].off = bracket[0].off + data[k][0] + len;
-		b[0].len = data[k + 1][0] - data[k][0] - len;
-		b[1].off = bracket[1].off + data[k][1] + len;
-		b[1].len = data[k + 1][1] - data[k][1] - len;
-		hdiff_multi(s, t, b, min, hdiff, depth);
-	    }
-
-	    b[0].off = bracket[0].off + data[k][0] + len;
-	    b[0].len = bracket[0].len - data[k][0] - len;
-	    b[1].off = bracket[1].off + data[k][1] + len;
-	    b[1].len = bracket[1].len - data[k][1] - len;
-	    hdiff_multi(s, t, b, min, hdiff, depth);
-
-	    arr_free(&ret, NULL);
-	    return 0;
+    if (have) {
+	p = arr_enlarge(hdiff);
+	if (p != NULL) {
+	    (*p)[0].off = bracket[0].off + ps;
+	    (*p)[0].len = pe - ps;
+	    (*p)[1].off = bracket[1].off + pt;
+	    (*p)[1].len = pf - pt;
 	}
     }
 
-    p = arr_enlarge(hdiff);
-    if (p == NULL) {
-	return -1;
-    }
-    (*p)[0].off = bracket[0].off;
-    (*p)[0].len = bracket[0].len;
-    (*p)[1].off = bracket[1].off;
-    (*p)[1].len = bracket[1].len;
-
-    return 0;
+    free(chg);
+    free(diag);
+    free(xv);
+    return hdiff->error ? -1 : 0;
 }
 
 
@@ -659,15 +1231,15 @@ hdiff_multi (const char *s, const char *t, const BRACKET bracket, int min, ARRAY
  * \param n length of second string
  * \param min minimum length of common substrings
  * \param hdiff list of horizontal diff ranges to fill
- * \param depth recursion depth
  *
  * \return 0 if success, nonzero otherwise
  */
 static int
-hdiff_scan (const char *s, int m, const char *t, int n, int min, ARRAY *hdiff, unsigned int depth)
+hdiff_scan (const char *s, int m, const char *t, int n, int min, ARRAY *hdiff)
 {
     int i;
     BRACKET b;
+    BRACKET *p;
 
     /* dumbscan (single horizontal diff) -- does not compress whitespace */
 
@@ -683,12 +1255,19 @@ hdiff_scan (const char *s, int m, const char *t, int n, int min, ARRAY *hdiff, u
     /* smartscan (multiple horizontal diff) */
 
     arr_init(hdiff, sizeof(BRACKET), 4);
-    hdiff_multi(s, t, b, min, hdiff, depth);
-    if (hdiff->error) {
+    if (hdiff_multi(s, t, b, min, hdiff) == 0) {
+	return 0;
+    }
+
+    /* not enough memory for smartscan, settle for dumbscan */
+    arr_free(hdiff, NULL);
+    p = arr_enlarge(hdiff);
+    if (p == NULL) {
 	arr_free(hdiff, NULL);
 	return -1;
     }
-
+    (*p)[0] = b[0];
+    (*p)[1] = b[1];
     return 0;
 }
 
@@ -702,19 +1281,21 @@ hdiff_scan (const char *s, int m, const char *t, int n, int min, ARRAY *hdiff, u
  * \param k rank of character inside line
  * \param hdiff horizontal diff structure
  * \param ord 0 if reading from first file, 1 if reading from 2nd file
+ * \param[in,out] pos index of first range that may contain `k'
  *
  * \return TRUE if inside hdiff limits, FALSE otherwise
+ *
+ * \note ranges are sorted, so successive calls must have non-decreasing `k'
  */
 static int
-is_inside (int k, ARRAY *hdiff, int ord)
+is_inside (int k, ARRAY *hdiff, int ord, int *pos)
 {
-    int i;
-    BRACKET *b;
-    for (b = hdiff->data, i = 0; i < hdiff->len; i++, b++) {
+    const BRACKET *b = (BRACKET *)hdiff->data + *pos;
+    for (; *pos < hdiff->len; (*pos)++, b++) {
 	int start = (*b)[ord].off;
 	int end = start + (*b)[ord].len;
-	if (k >= start && k < end) {
-	    return 1;
+	if (k < end) {
+	    return k >= start;
 	}
     }
     return 0;
@@ -880,6 +1461,7 @@ cvt_mgeta (const char *src, size_t srcsize, char *dst, int dstsize, int skip, in
     int sz = 0;
     if (src != NULL) {
 	int i, k;
+	int pos = 0;
 	char *tmp = dst;
 	const int base = 0;
 	for (i = 0, k = 0; dstsize && srcsize && *src != '\n'; i++, k++, src++, srcsize--) {
@@ -891,7 +1473,7 @@ cvt_mgeta (const char *src, size_t srcsize, char *dst, int dstsize, int skip, in
 			skip--;
 		    } else if (dstsize) {
 			dstsize--;
-			*att++ = is_inside(k, hdiff, ord);
+			*att++ = is_inside(k, hdiff, ord, &pos);
 			*dst++ = ' ';
 		    }
 		}
@@ -899,13 +1481,13 @@ cvt_mgeta (const char *src, size_t srcsize, char *dst, int dstsize, int skip, in
 		if (!skip && show_cr) {
 		    if (dstsize > 1) {
 			dstsize -= 2;
-			*att++ = is_inside(k, hdiff, ord);
+			*att++ = is_inside(k, hdiff, ord, &pos);
 			*dst++ = '^';
-			*att++ = is_inside(k, hdiff, ord);
+			*att++ = is_inside(k, hdiff, ord, &pos);
 			*dst++ = 'M';
 		    } else {
 			dstsize--;
-			*att++ = is_inside(k, hdiff, ord);
+			*att++ = is_inside(k, hdiff, ord, &pos);
 			*dst++ = '.';
 		    }
 		}
@@ -915,7 +1497,7 @@ cvt_mgeta (const char *src, size_t srcsize, char *dst, int dstsize, int skip, in
 		    skip--;
 		} else {
 		    dstsize--;
-		    *att++ = is_inside(k, hdiff, ord);
+		    *att++ = is_inside(k, hdiff, ord, &pos);
 		    *dst++ = is_printable(*src) ? *src : '.';
 		}
 	    }
@@ -1144,38 +1726,42 @@ redo_diff (WDiff *view)
     int ndiff;
     int rv;
 
-    char extra[256];
-
-    extra[0] = '\0';
-    if (view->opt.quality == 2) {
-	strcat(extra, " -d");
-    }
-    if (view->opt.quality == 1) {
-	strcat(extra, " --speed-large-files");
-    }
-    if (view->opt.strip_trailing_cr) {
-	strcat(extra, " --strip-trailing-cr");
-    }
-    if (view->opt.ignore_tab_expansion) {
-	strcat(extra, " -E");
-    }
-    if (view->opt.ignore_space_change) {
-	strcat(extra, " -b");
-    }
-    if (view->opt.ignore_all_space) {
-	strcat(extra, " -w");
-    }
-    if (view->opt.ignore_case) {
-	strcat(extra, " -i");
-    }
-
     f[0] = f_open(view->file[0], O_RDONLY);
     f[1] = f_open(view->file[1], O_RDONLY);
     if (f[0] == NULL || f[1] == NULL) {
 	goto err;
     }
 
-    ndiff = dff_execute(view->args, extra, f_getname(f[0]), f_getname(f[1]), &ops);
+    if (view->opt.external) {
+	char extra[256];
+
+	extra[0] = '\0';
+	if (view->opt.quality == 2) {
+	    strcat(extra, " -d");
+	}
+	if (view->opt.quality == 1) {
+	    strcat(extra, " --speed-large-files");
+	}
+	if (view->opt.strip_trailing_cr) {
+	    strcat(extra, " --strip-trailing-cr");
+	}
+	if (view->opt.ignore_tab_expansion) {
+	    strcat(extra, " -E");
+	}
+	if (view->opt.ignore_space_change) {
+	    strcat(extra, " -b");
+	}
+	if (view->opt.ignore_all_space) {
+	    strcat(extra, " -w");
+	}
+	if (view->opt.ignore_case) {
+	    strcat(extra, " -i");
+	}
+
+	ndiff = dff_execute(view->args, extra, f_getname(f[0]), f_getname(f[1]), &ops);
+    } else {
+	ndiff = dff_internal(f[0], f[1], &view->opt, &ops);
+    }
     if (ndiff < 0) {
 	goto err;
     }
@@ -1453,6 +2039,7 @@ view_init (WDiff *view, const char *args, const char *file1, const char *file2,
     view->opt.ignore_space_change = 0;
     view->opt.ignore_all_space = 0;
     view->opt.ignore_case = 0;
+    view->opt.external = 0;
 
     view_compute_areas(view);
     return 0;
@@ -1544,7 +2131,7 @@ view_display_file (const WDiff *view, int ord,
 			if (s->line && q->line && s->ch == CHG_CH) {
 			    ARRAY *h = malloc(sizeof(ARRAY));
 			    if (h != NULL) {
-				int rv = hdiff_scan(s->p, s->u.len, q->p, q->u.len, HDIFF_MINCTX, h, HDIFF_DEPTH);
+				int rv = hdiff_scan(s->p, s->u.len, q->p, q->u.len, HDIFF_MINCTX, h);
 				if (rv != 0) {
 				    free(h);
 				    h = NULL;
@@ -1728,6 +2315,7 @@ view_redo (WDiff *view)
     diffopt_widgets[5].result = &view->opt.ignore_space_change;
     diffopt_widgets[6].result = &view->opt.ignore_tab_expansion;
     diffopt_widgets[7].result = &view->opt.ignore_case;
+    diffopt_widgets[8].result = &view->opt.external;
 
     if (quick_dialog(&diffopt) != B_CANCEL) {
 	view_fini(view);
@@ -42,6 +42,13 @@
 
 #define RECURSIVE_DEPTH 100
 
+#define CMP_BUFSIZ		65536
+
+#define ZDIFF_CACHE		".mc/zdiff.cache"
+#define ZDIFF_CACHE_TMP		".mc/zdiff.cache.tmp"
+#define ZDIFF_CACHE_MAGIC	"MC zdiff cache 1\n"
+#define ZDIFF_CACHE_ENTRIES	(1 << 17)
+
 #define ADD_CH	'+'
 #define DEL_CH	'-'
 #define CHG_CH	'*'
@@ -82,6 +89,12 @@ typedef struct {
     char *link[2];
 } LNODE;
 
+typedef struct {
+    unsigned long long key[8];	/* dev, ino, size, mtime of both files */
+    int same;
+    int used;			/* looked up or stored during this session */
+} CNODE;
+
 typedef struct {
     Widget widget;
 
@@ -90,6 +103,13 @@ typedef struct {
     ARRAY z;
     int ndiff;			/* number of hunks */
 
+    ARRAY cache;		/* known results of file compares */
+    int *chash;			/* hash index into cache */
+    unsigned int cmask;
+    int cdirty;
+    int cloaded;		/* saved results have been read */
+    char *cbuf;			/* compare buffers */
+
     regex_t irx;
     int ignore:1;
     int hideleft:1;
@@ -161,6 +181,214 @@ static QuickDialog search_input = {
 #define error_dialog(h, s) query_dialog(h, s, D_ERROR, 1, _("&Dismiss"))
 
 
+/* compare cache *************************************************************/
+
+
+static void
+cache_key (unsigned long long key[8], const struct stat st[2])
+{
+    int i;
+    for (i = 0; i < 2; i++) {
+	key[4 * i + 0] = st[i].st_dev;
+	key[4 * i + 1] = st[i].st_ino;
+	key[4 * i + 2] = st[i].st_size;
+	key[4 * i + 3] = st[i].st_mtime;
+    }
+}
+
+
+static unsigned int
+cache_hash (const unsigned long long key[8])
+{
+    unsigned long long h = 14695981039346656037ULL;
+    int i;
+    for (i = 0; i < 8; i++) {
+	h = (h ^ key[i]) * 1099511628211ULL;
+    }
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+
+/**
+ * Find compare result.
+ *
+ * \param view main view object
+ * \param key file identities
+ *
+ * \return cache entry, or NULL if not found
+ */
+static CNODE *
+cache_find (const WDiff *view, const unsigned long long key[8])
+{
+    unsigned int h;
+    if (view->chash == NULL) {
+	return NULL;
+    }
+    for (h = cache_hash(key) & view->cmask; view->chash[h]; h = (h + 1) & view->cmask) {
+	CNODE *n = (CNODE *)view->cache.data + view->chash[h] - 1;
+	if (!memcmp(n->key, key, sizeof(n->key))) {
+	    return n;
+	}
+    }
+    return NULL;
+}
+
+
+/**
+ * Store compare result.
+ *
+ * \param view main view object
+ * \param key file identities
+ * \param same nonzero if files are identical
+ *
+ * \return cache entry, or NULL if error
+ */
+static CNODE *
+cache_insert (WDiff *view, const unsigned long long key[8], int same)
+{
+    CNODE *n;
+    unsigned int h;
+
+    if (2 * (unsigned int)view->cache.len >= view->cmask) {
+	int i;
+	unsigned int mask = view->cmask ? 2 * view->cmask + 1 : 1023;
+	int *chash = calloc(mask + 1, sizeof(int));
+	if (chash == NULL) {
+	    return NULL;
+	}
+	for (i = 0; i < view->cache.len; i++) {
+	    n = (CNODE *)view->cache.data + i;
+	    for (h = cache_hash(n->key) & mask; chash[h]; h = (h + 1) & mask) {
+	    }
+	    chash[h] = i + 1;
+	}
+	free(view->chash);
+	view->chash = chash;
+	view->cmask = mask;
+    }
+
+    n = cache_find(view, key);
+    if (n == NULL) {
+	n = arr_enlarge(&view->cache);
+	if (n == NULL) {
+	    return NULL;
+	}
+	memcpy(n->key, key, sizeof(n->key));
+	for (h = cache_hash(key) & view->cmask; view->chash[h]; h = (h + 1) & view->cmask) {
+	}
+	view->chash[h] = view->cache.len;
+    }
+    n->same = same;
+    n->used = 1;
+    view->cdirty = 1;
+    return n;
+}
+
+
+/**
+ * Set up an empty cache.
+ *
+ * \param view main view object
+ */
+static void
+cache_init (WDiff *view)
+{
+    arr_init(&view->cache, sizeof(CNODE), 0);
+    view->chash = NULL;
+    view->cmask = 0;
+    view->cbuf = NULL;
+    view->cdirty = 0;
+    view->cloaded = 0;
+}
+
+
+/**
+ * Load compare results saved by previous sessions.
+ *
+ * \param view main view object
+ *
+ * \note this is done on the first lookup, not every compare needs it
+ */
+static void
+cache_load (WDiff *view)
+{
+    FILE *f;
+    char *fn;
+    char magic[sizeof(ZDIFF_CACHE_MAGIC) - 1];
+    unsigned long long rec[9];
+
+    view->cloaded = 1;
+    fn = concat_dir_and_file(home_dir, ZDIFF_CACHE);
+    f = fopen(fn, "rb");
+    g_free(fn);
+    if (f != NULL) {
+	if (fread(magic, sizeof(magic), 1, f) == 1 && !memcmp(magic, ZDIFF_CACHE_MAGIC, sizeof(magic))) {
+	    while (fread(rec, sizeof(rec), 1, f) == 1) {
+		CNODE *n = cache_insert(view, rec, rec[8] != 0);
+		if (n == NULL) {
+		    break;
+		}
+		n->used = 0;
+	    }
+	}
+	fclose(f);
+    }
+    view->cdirty = 0;
+}
+
+
+/**
+ * Save compare results and free the cache.
+ *
+ * \param view main view object
+ * \param save nonzero to write results to disk
+ *
+ * \note entries used during this session are kept first
+ */
+static void
+cache_done (WDiff *view, int save)
+{
+    if (save && view->cdirty) {
+	char *tmp = concat_dir_and_file(home_dir, ZDIFF_CACHE_TMP);
+	char *fn = concat_dir_and_file(home_dir, ZDIFF_CACHE);
+	FILE *t = fopen(tmp, "wb");
+	if (t != NULL) {
+	    int i, used, count = 0;
+	    int ok = (fputs(ZDIFF_CACHE_MAGIC, t) != EOF);
+	    for (used = 1; used >= 0 && ok; used--) {
+		const CNODE *n = view->cache.data;
+		for (i = 0; i < view->cache.len && count < ZDIFF_CACHE_ENTRIES; i++, n++) {
+		    unsigned long long rec[9];
+		    if (n->used != used) {
+			continue;
+		    }
+		    memcpy(rec, n->key, sizeof(n->key));
+		    rec[8] = n->same;
+		    if (fwrite(rec, sizeof(rec), 1, t) != 1) {
+			ok = 0;
+			break;
+		    }
+		    count++;
+		}
+	    }
+	    if (fclose(t) == 0 && ok) {
+		rename(tmp, fn);
+	    } else {
+		unlink(tmp);
+	    }
+	}
+	g_free(fn);
+	g_free(tmp);
+    }
+    free(view->cbuf);
+    view->cbuf = NULL;
+    free(view->chash);
+    view->chash = NULL;
+    view->cmask = 0;
+    arr_free(&view->cache, NULL);
+}
+
+
 /* diff parse ****************************************************************/
 
 
@@ -395,30 +623,85 @@ check(const char *path, struct stat *st, char link[MC_MAXPATHLEN], int *mode)
 }
 
 
+/**
+ * Read as many bytes as possible.
+ *
+ * \param fd file descriptor
+ * \param buf destination buffer
+ * \param size size of buffer
+ *
+ * \return number of bytes read, -1 if error
+ */
+static ssize_t
+read_full (int fd, char *buf, size_t size)
+{
+    size_t j = 0;
+    while (j < size) {
+	ssize_t n = mc_read(fd, buf + j, size - j);
+	if (n < 0) {
+	    return -1;
+	}
+	if (n == 0) {
+	    break;
+	}
+	j += n;
+    }
+    return j;
+}
+
+
 /**
  * Compare two binary files.
  *
+ * \param view main view object
  * \param p0 1st filename
  * \param p1 2nd filename
  * \param st array of two stat structs
  *
  * \return 0 if files are identical, 1 if different, -1 if error
+ *
+ * \note results for local files are cached by (dev, ino, size, mtime)
  */
 static int
-diff_binary (const char *p0, const char *p1, const struct stat st[2])
+diff_binary (WDiff *view, const char *p0, const char *p1, const struct stat st[2])
 {
     int rv = 0;
     int fd0, fd1;
     off_t size;
+    int local, cacheable;
+    unsigned long long key[8];
+    char *buf0, *buf1;
 
     if (st[0].st_size != st[1].st_size) {
 	return 1;
     }
-    if (st[0].st_ino == st[1].st_ino && vfs_file_is_local(p0) && vfs_file_is_local(p1)) {
-	return 0;
+    local = vfs_file_is_local(p0) && vfs_file_is_local(p1);
+    if (local) {
+	CNODE *n;
+	if (st[0].st_ino == st[1].st_ino && st[0].st_dev == st[1].st_dev) {
+	    return 0;
+	}
+	if (!view->cloaded) {
+	    cache_load(view);
+	}
+	cache_key(key, st);
+	n = cache_find(view, key);
+	if (n != NULL) {
+	    n->used = 1;
+	    return !n->same;
+	}
     }
     size = st[0].st_size;
 
+    if (view->cbuf == NULL) {
+	view->cbuf = malloc(2 * CMP_BUFSIZ);
+	if (view->cbuf == NULL) {
+	    return -1;
+	}
+    }
+    buf0 = view->cbuf;
+    buf1 = view->cbuf + CMP_BUFSIZ;
+
     fd0 = mc_open(p0, O_RDONLY | O_BINARY);
     if (fd0 < 0) {
 	return -1;
@@ -429,11 +712,13 @@ diff_binary (const char *p0, const char *p1, const struct stat st[2])
 	return -1;
     }
 
+    cacheable = local;
     while (size > 0) {
-	char buf0[BUFSIZ], buf1[BUFSIZ];
-	int n0 = mc_read(fd0, buf0, sizeof(buf0));
-	int n1 = mc_read(fd1, buf1, sizeof(buf1));
+	ssize_t n0 = read_full(fd0, buf0, CMP_BUFSIZ);
+	ssize_t n1 = read_full(fd1, buf1, CMP_BUFSIZ);
 	if (n0 != n1) {
+	    /* read error or file changed: the result is not worth keeping */
+	    cacheable = 0;
 	    rv = 1;
 	    break;
 	}
@@ -450,6 +735,14 @@ diff_binary (const char *p0, const char *p1, const struct stat st[2])
 
     mc_close(fd1);
     mc_close(fd0);
+
+    /* files touched within the current second may still change unnoticed */
+    if (cacheable && rv >= 0) {
+	time_t now = time(NULL);
+	if (st[0].st_mtime < now && st[1].st_mtime < now) {
+	    cache_insert(view, key, rv == 0);
+	}
+    }
     return rv;
 }
 
@@ -663,7 +956,7 @@ diff_file (WDiff *view, const char *r0, const char *f0, const char *r1, const ch
 	}
 	return printer(ctx, EQU_CH, f0, f1, NULL, NULL, 1);
     }
-    rv = diff_binary(p0, p1, st);
+    rv = diff_binary(view, p0, p1, st);
     free_2nd_path(p1);
     free_1st_path(p0);
     if (rv < 0) {
@@ -932,8 +1225,11 @@ view_init (WDiff *view, int recursive, const char *dir1, const char *dir2)
     view->hideident = 0;
     view->ignore = 0;
 
+    cache_init(view);
+
     ndiff = redo_diff(view);
     if (ndiff < 0) {
+	cache_done(view, 0);
 	return -1;
     }
 
@@ -1847,6 +2143,7 @@ zdiff_view (const char *dir1, const char *dir2)
 	run_dlg(view_dlg);
 	view_search(view, -1);
 	view_fini(view);
+	cache_done(view, 1);
     }
     destroy_dlg(view_dlg);
 
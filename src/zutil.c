@@ -180,6 +180,16 @@ f_read (FBUF *fs, char *buf, size_t size)
 	    break;
 	}
 
+	if (size - j >= FILE_READ_BUF) {
+	    /* large request: bypass the cache */
+	    ssize_t rv;
+	    FILE_DIRTY(fs);
+	    while (j < size && (rv = read(fs->fd, buf + j, size - j)) > 0) {
+		j += rv;
+	    }
+	    break;
+	}
+
 	fs->pos = 0;
 	fs->len = read(fs->fd, fs->buf, FILE_READ_BUF);
     } while (fs->len > 0);
@@ -113,6 +113,28 @@ filesize bytes) and follows them with (with no preceding newline) ###
 Note that there's no way to abort running RETR command - except
 closing the connection.
 
+#RETR /some/name <offset>
+tail -c +<offset+1> /some/name (or dd bs=1 skip=<offset> where tail
+can't do it)
+
+Same as above, but the data starts at byte <offset>; the size line
+still carries the full file size. Used to reget partially copied
+files.
+
+Several commands may be written before their replies are read: mc
+sends RETR (and one LIST) for marked files ahead of a copy and
+consumes the replies in order, so the server must not need anything
+beyond handling commands one after another on stdin.
+
+Likewise, when deleting or changing modes of many files, mc sends the
+#DELE, #RMD, #CHMOD etc. commands in batches of up to 64.  Within a
+batch, each command's shell part ends with
+
+&& echo '### 000' || echo '### 500'
+
+and the server should answer ### 500 for an operation that failed,
+which mc then reports for that file.
+
 #STOR <size> /file/name
 > /file/name; echo '### 001'; ( dd bs=4096 count=<size/4096>; dd bs=<size%4096> count=1 ) 2>/dev/null | ( cat > %s; cat > /dev/null ); echo '### 200'
 
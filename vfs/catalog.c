@@ -0,0 +1,561 @@
+/* Persistent catalog of archive listings for tar-like filesystems.
+ *
+ * Reading the headers of a big tar or cpio archive takes a while, and
+ * it is done again every time the vfs garbage collector has thrown the
+ * superblock away.  After a complete scan the directory tree is saved
+ * under ~/.mc/cache, keyed by the archive name.  When the archive is
+ * opened again and its device, inode, size and mtime still match, the
+ * tree is taken from the catalog instead.  The catalog is mapped into
+ * memory as it is, and a directory is turned into entries only when it
+ * is looked into for the first time.
+ *
+ * The file is in native byte order -- it is a cache, not an exchange
+ * format.  */
+
+#include <config.h>
+#include <errno.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#include "../src/global.h"
+#include "utilvfs.h"
+#include "vfs-impl.h"
+#include "xdirentry.h"
+
+#define CATALOG_DIR	".mc" PATH_SEP_STR "cache"
+#define CATALOG_MAGIC	"MCcat01"
+
+/* Smaller archives are scanned quickly enough */
+#define CATALOG_MIN_SIZE	(1024 * 1024)
+
+/* Catalogs unused for this long are removed, then the oldest ones
+   until the rest fit in CATALOG_MAX_TOTAL */
+#define CATALOG_MAX_AGE		(30 * 24 * 60 * 60)
+#define CATALOG_MAX_TOTAL	(64 * 1024 * 1024)
+
+#define CATALOG_ALIGN(x)	(((x) + 7) & ~(size_t) 7)
+
+struct catalog_header {
+    char magic[8];
+    int record_size;		/* sizeof (struct catalog_inode) */
+    int type;			/* u.arch.type of the archive */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    unsigned int name_len;	/* archive name follows the header */
+    unsigned int inodes;
+    unsigned int entries;
+    unsigned int strings;	/* size of the string table */
+};
+
+struct catalog_inode {
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    dev_t rdev;
+    off_t size;
+    time_t mtime, atime, ctime;
+    long data_offset;
+    unsigned int linkname;	/* offset in the string table, 0 if none */
+    unsigned int first;		/* entries of a directory */
+    unsigned int count;
+};
+
+struct catalog_entry {
+    unsigned int name;
+    unsigned int ino;
+};
+
+struct vfs_s_catalog {
+    char *map;
+    size_t len;
+    int mapped;
+    const struct catalog_inode *inode;
+    const struct catalog_entry *entry;
+    const char *strings;
+    unsigned int inodes, entries, strings_len;
+    struct vfs_s_inode **made;	/* inodes created so far, by number */
+};
+
+static int
+catalog_wanted (struct vfs_s_super *super)
+{
+    return home_dir != NULL
+	&& super->u.arch.st.st_size >= CATALOG_MIN_SIZE
+	&& vfs_file_is_local (super->name);
+}
+
+static char *
+catalog_path (struct vfs_class *me, const char *name)
+{
+    unsigned int hash = 5381;
+    char file[64];
+    char *dir, *path;
+
+    for (; *name; name++)
+	hash = (hash * 33) ^ (unsigned char) *name;
+    g_snprintf (file, sizeof (file), "%s-%08x", me->name, hash);
+
+    dir = concat_dir_and_file (home_dir, CATALOG_DIR);
+    path = concat_dir_and_file (dir, file);
+    g_free (dir);
+    return path;
+}
+
+/* {{{ saving */
+
+struct catalog_writer {
+    struct vfs_s_inode **inodes;
+    struct catalog_inode *records;
+    unsigned int inodes_count, inodes_size;
+    struct catalog_entry *entries;
+    unsigned int entries_count, entries_size;
+    char *strings;
+    unsigned int strings_len, strings_size;
+};
+
+static unsigned int
+catalog_add_string (struct catalog_writer *w, const char *s)
+{
+    unsigned int len = strlen (s) + 1;
+    unsigned int at = w->strings_len;
+
+    while (w->strings_len + len > w->strings_size) {
+	w->strings_size = w->strings_size ? w->strings_size * 2 : 4096;
+	w->strings = g_realloc (w->strings, w->strings_size);
+    }
+    memcpy (w->strings + at, s, len);
+    w->strings_len += len;
+    return at;
+}
+
+/*
+ * Number the inode.  The catalog field of the inodes is free while the
+ * tree is written (a tree taken from a catalog is never saved again), so
+ * it holds the number + 1 of the inodes seen already, i.e. hardlinks.
+ */
+static unsigned int
+catalog_add_inode (struct catalog_writer *w, struct vfs_s_inode *ino)
+{
+    struct catalog_inode *r;
+
+    if (ino->catalog != 0)
+	return ino->catalog - 1;
+
+    if (w->inodes_count == w->inodes_size) {
+	w->inodes_size = w->inodes_size ? w->inodes_size * 2 : 256;
+	w->inodes = g_realloc (w->inodes,
+			       w->inodes_size * sizeof (w->inodes[0]));
+	w->records = g_realloc (w->records,
+				w->inodes_size * sizeof (w->records[0]));
+    }
+
+    r = &w->records[w->inodes_count];
+    memset (r, 0, sizeof (*r));
+    r->mode = ino->st.st_mode;
+    r->uid = ino->st.st_uid;
+    r->gid = ino->st.st_gid;
+    r->rdev = ino->st.st_rdev;
+    r->size = ino->st.st_size;
+    r->mtime = ino->st.st_mtime;
+    r->atime = ino->st.st_atime;
+    r->ctime = ino->st.st_ctime;
+    r->data_offset = ino->data_offset;
+    if (ino->linkname != NULL)
+	r->linkname = catalog_add_string (w, ino->linkname);
+
+    w->inodes[w->inodes_count] = ino;
+    ino->catalog = ++w->inodes_count;
+    return w->inodes_count - 1;
+}
+
+static void
+catalog_add_entry (struct catalog_writer *w, struct vfs_s_entry *ent)
+{
+    struct catalog_entry *e;
+
+    if (w->entries_count == w->entries_size) {
+	w->entries_size = w->entries_size ? w->entries_size * 2 : 256;
+	w->entries = g_realloc (w->entries,
+				w->entries_size * sizeof (w->entries[0]));
+    }
+    e = &w->entries[w->entries_count++];
+    e->name = catalog_add_string (w, ent->name);
+    e->ino = catalog_add_inode (w, ent->ino);
+}
+
+static int
+catalog_write (int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+	n = write (fd, p, len);
+	if (n == -1 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    return -1;
+	p += n;
+	len -= n;
+    }
+    return 0;
+}
+
+static int
+catalog_write_file (int fd, struct vfs_s_super *super,
+		    struct catalog_writer *w)
+{
+    static const char zeros[8];
+    struct catalog_header h;
+    size_t head;
+
+    memset (&h, 0, sizeof (h));
+    strcpy (h.magic, CATALOG_MAGIC);
+    h.record_size = sizeof (struct catalog_inode);
+    h.type = super->u.arch.type;
+    h.dev = super->u.arch.st.st_dev;
+    h.ino = super->u.arch.st.st_ino;
+    h.size = super->u.arch.st.st_size;
+    h.mtime = super->u.arch.st.st_mtime;
+    h.name_len = strlen (super->name);
+    h.inodes = w->inodes_count;
+    h.entries = w->entries_count;
+    h.strings = w->strings_len;
+
+    head = sizeof (h) + h.name_len + 1;
+    if (catalog_write (fd, &h, sizeof (h)) == -1
+	|| catalog_write (fd, super->name, h.name_len + 1) == -1
+	|| catalog_write (fd, zeros, CATALOG_ALIGN (head) - head) == -1
+	|| catalog_write (fd, w->records,
+			  h.inodes * sizeof (struct catalog_inode)) == -1
+	|| catalog_write (fd, w->entries,
+			  h.entries * sizeof (struct catalog_entry)) == -1
+	|| catalog_write (fd, w->strings, h.strings) == -1)
+	return -1;
+    return 0;
+}
+
+struct catalog_file {
+    char *path;
+    time_t mtime;
+    off_t size;
+};
+
+static int
+catalog_file_cmp (const void *a, const void *b)
+{
+    const struct catalog_file *x = a, *y = b;
+
+    return x->mtime < y->mtime ? -1 : x->mtime > y->mtime;
+}
+
+/*
+ * Keep the cache directory from growing without bounds.  A catalog's
+ * mtime is refreshed whenever it is used, so the least recently used
+ * ones go first.
+ */
+static void
+catalog_expire (const char *dir)
+{
+    struct catalog_file *files = NULL;
+    unsigned int n = 0, size = 0, i;
+    struct dirent *dirent;
+    struct stat st;
+    DIR *d;
+    char *path;
+    time_t now = time (NULL);
+    off_t total = 0;
+
+    if ((d = opendir (dir)) == NULL)
+	return;
+    while ((dirent = readdir (d)) != NULL) {
+	if (dirent->d_name[0] == '.')
+	    continue;
+	path = concat_dir_and_file (dir, dirent->d_name);
+	if (lstat (path, &st) == -1 || !S_ISREG (st.st_mode)) {
+	    g_free (path);
+	    continue;
+	}
+	if (st.st_mtime < now - CATALOG_MAX_AGE) {
+	    unlink (path);
+	    g_free (path);
+	    continue;
+	}
+	if (n == size) {
+	    size = size ? size * 2 : 64;
+	    files = g_realloc (files, size * sizeof (struct catalog_file));
+	}
+	files[n].path = path;
+	files[n].mtime = st.st_mtime;
+	files[n].size = st.st_size;
+	total += st.st_size;
+	n++;
+    }
+    closedir (d);
+
+    qsort (files, n, sizeof (struct catalog_file), catalog_file_cmp);
+    for (i = 0; i < n; i++) {
+	if (total > CATALOG_MAX_TOTAL) {
+	    unlink (files[i].path);
+	    total -= files[i].size;
+	}
+	g_free (files[i].path);
+    }
+    g_free (files);
+}
+
+/* Write the catalog of a freshly scanned archive */
+void
+vfs_s_catalog_save (struct vfs_class *me, struct vfs_s_super *super)
+{
+    struct catalog_writer w;
+    struct vfs_s_entry *ent;
+    unsigned int i;
+    char *path, *tmp, *dir;
+    int fd, ok;
+
+    if (!catalog_wanted (super))
+	return;
+
+    memset (&w, 0, sizeof (w));
+    catalog_add_string (&w, "");	/* offset 0 means no string */
+    catalog_add_inode (&w, super->root);
+
+    /* Entries of a directory are stored together, in the same order */
+    for (i = 0; i < w.inodes_count; i++) {
+	if (!S_ISDIR (w.inodes[i]->st.st_mode))
+	    continue;
+	w.records[i].first = w.entries_count;
+	for (ent = w.inodes[i]->subdir; ent != NULL; ent = ent->next)
+	    catalog_add_entry (&w, ent);
+	w.records[i].count = w.entries_count - w.records[i].first;
+    }
+
+    for (i = 0; i < w.inodes_count; i++)
+	w.inodes[i]->catalog = 0;
+
+    dir = concat_dir_and_file (home_dir, CATALOG_DIR);
+    mkdir (dir, 0700);
+    catalog_expire (dir);
+    g_free (dir);
+
+    path = catalog_path (me, super->name);
+    tmp = g_strconcat (path, ".tmp", (char *) NULL);
+    fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd != -1) {
+	ok = catalog_write_file (fd, super, &w) == 0;
+	if (close (fd) == -1)
+	    ok = 0;
+	if (!ok || rename (tmp, path) == -1)
+	    unlink (tmp);
+    }
+    g_free (tmp);
+    g_free (path);
+
+    g_free (w.inodes);
+    g_free (w.records);
+    g_free (w.entries);
+    g_free (w.strings);
+}
+
+/* }}} */
+
+/* {{{ loading */
+
+static void
+catalog_release (struct vfs_s_catalog *c)
+{
+#ifdef HAVE_MMAP
+    if (c->mapped)
+	munmap (c->map, c->len);
+    else
+#endif
+	g_free (c->map);
+    g_free (c->made);
+    g_free (c);
+}
+
+/* Check that the catalog belongs to the archive and is sane */
+static int
+catalog_check (struct vfs_s_super *super, struct vfs_s_catalog *c)
+{
+    const struct catalog_header *h = (const struct catalog_header *) c->map;
+    size_t at;
+
+    if (c->len < sizeof (*h)
+	|| memcmp (h->magic, CATALOG_MAGIC, sizeof (CATALOG_MAGIC)) != 0
+	|| h->record_size != sizeof (struct catalog_inode)
+	|| h->dev != super->u.arch.st.st_dev
+	|| h->ino != super->u.arch.st.st_ino
+	|| h->size != super->u.arch.st.st_size
+	|| h->mtime != super->u.arch.st.st_mtime
+	|| h->name_len != strlen (super->name)
+	|| c->len < sizeof (*h) + h->name_len + 1
+	|| memcmp (c->map + sizeof (*h), super->name, h->name_len + 1) != 0)
+	return 0;
+
+    at = CATALOG_ALIGN (sizeof (*h) + h->name_len + 1);
+    if (h->inodes == 0 || h->strings == 0
+	|| (c->len - at) / sizeof (struct catalog_inode) < h->inodes)
+	return 0;
+    c->inode = (const struct catalog_inode *) (c->map + at);
+    at += (size_t) h->inodes * sizeof (struct catalog_inode);
+
+    if ((c->len - at) / sizeof (struct catalog_entry) < h->entries)
+	return 0;
+    c->entry = (const struct catalog_entry *) (c->map + at);
+    at += (size_t) h->entries * sizeof (struct catalog_entry);
+
+    if (c->len - at != h->strings || c->map[c->len - 1] != '\0')
+	return 0;
+    c->strings = c->map + at;
+
+    if (!S_ISDIR (c->inode[0].mode))
+	return 0;
+
+    c->inodes = h->inodes;
+    c->entries = h->entries;
+    c->strings_len = h->strings;
+    super->u.arch.type = h->type;
+    return 1;
+}
+
+/*
+ * Take the tree of the archive from its catalog.  super->name,
+ * u.arch.st and the root inode must be set up already.  Returns 1 if
+ * the catalog was used, 0 if the archive has to be scanned.
+ */
+int
+vfs_s_catalog_load (struct vfs_class *me, struct vfs_s_super *super)
+{
+    struct vfs_s_catalog *c;
+    struct stat st;
+    char *path;
+    int fd;
+
+    if (!catalog_wanted (super))
+	return 0;
+
+    path = catalog_path (me, super->name);
+    fd = open (path, O_RDONLY);
+    if (fd == -1) {
+	g_free (path);
+	return 0;
+    }
+    if (fstat (fd, &st) == -1 || st.st_size < (off_t) sizeof (struct catalog_header)) {
+	close (fd);
+	g_free (path);
+	return 0;
+    }
+
+    c = g_new0 (struct vfs_s_catalog, 1);
+    c->len = st.st_size;
+#ifdef HAVE_MMAP
+    c->map = mmap (NULL, c->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (c->map == (char *) MAP_FAILED)
+	c->map = NULL;
+    else
+	c->mapped = 1;
+#endif
+    if (c->map == NULL) {
+	c->map = g_malloc (c->len);
+	if (read (fd, c->map, c->len) != (ssize_t) c->len) {
+	    close (fd);
+	    catalog_release (c);
+	    g_free (path);
+	    return 0;
+	}
+    }
+    close (fd);
+
+    if (!catalog_check (super, c)) {
+	catalog_release (c);
+	g_free (path);
+	return 0;
+    }
+
+    /* Mark it as recently used for catalog_expire() */
+    utime (path, NULL);
+    g_free (path);
+
+    c->made = g_new0 (struct vfs_s_inode *, c->inodes);
+    c->made[0] = super->root;
+    super->root->catalog = 1;
+    super->u.arch.catalog = c;
+    return 1;
+}
+
+static struct vfs_s_inode *
+catalog_inode (struct vfs_class *me, struct vfs_s_super *super,
+	       struct vfs_s_catalog *c, unsigned int n)
+{
+    const struct catalog_inode *r = &c->inode[n];
+    struct vfs_s_inode *ino;
+    struct stat st;
+
+    if (c->made[n] != NULL)
+	return c->made[n];
+
+    memset (&st, 0, sizeof (st));
+    st.st_mode = r->mode;
+    st.st_uid = r->uid;
+    st.st_gid = r->gid;
+    st.st_rdev = r->rdev;
+    st.st_size = r->size;
+    st.st_mtime = r->mtime;
+    st.st_atime = r->atime;
+    st.st_ctime = r->ctime;
+
+    ino = vfs_s_new_inode (me, super, &st);
+    ino->data_offset = r->data_offset;
+    if (r->linkname != 0 && r->linkname < c->strings_len)
+	ino->linkname = g_strdup (c->strings + r->linkname);
+    if (S_ISDIR (r->mode) && r->count != 0)
+	ino->catalog = n + 1;
+    c->made[n] = ino;
+    return ino;
+}
+
+/* Create the entries of a directory that was not looked into yet */
+void
+vfs_s_catalog_expand (struct vfs_s_inode *dir)
+{
+    struct vfs_s_super *super = dir->super;
+    struct vfs_s_catalog *c = super->u.arch.catalog;
+    struct vfs_class *me = super->me;
+    const struct catalog_inode *r;
+    const struct catalog_entry *e;
+    unsigned int n = dir->catalog - 1;
+    unsigned int i;
+
+    dir->catalog = 0;
+    if (c == NULL || n >= c->inodes)
+	return;
+
+    r = &c->inode[n];
+    if (r->first > c->entries || r->count > c->entries - r->first)
+	return;
+
+    for (i = r->first; i < r->first + r->count; i++) {
+	e = &c->entry[i];
+	if (e->ino == 0 || e->ino >= c->inodes || e->name >= c->strings_len)
+	    continue;
+	vfs_s_insert_entry (me, dir,
+			    vfs_s_new_entry (me, c->strings + e->name,
+					     catalog_inode (me, super, c,
+							    e->ino)));
+    }
+}
+
+void
+vfs_s_catalog_free (struct vfs_s_super *super)
+{
+    if (super->u.arch.catalog != NULL)
+	catalog_release (super->u.arch.catalog);
+    super->u.arch.catalog = NULL;
+}
+
+/* }}} */
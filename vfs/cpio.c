@@ -145,32 +145,28 @@ static void cpio_free_archive(struct vfs_class *me, struct vfs_s_super *super)
 	g_free (l);
     }
     super->u.arch.deferred = NULL;
+    vfs_s_catalog_free (super);
 }
 
+/* Open the archive file, through a decompressor if it is compressed */
 static int
-cpio_open_cpio_file (struct vfs_class *me, struct vfs_s_super *super,
-		     const char *name)
+cpio_open_fd (struct vfs_class *me, struct vfs_s_super *super)
 {
     int fd, type;
-    mode_t mode;
-    struct vfs_s_inode *root;
 
-    if ((fd = mc_open (name, O_RDONLY)) == -1) {
-	message (1, MSG_ERROR, _("Cannot open cpio archive\n%s"), name);
+    (void) me;
+
+    if ((fd = mc_open (super->name, O_RDONLY)) == -1) {
+	message (1, MSG_ERROR, _("Cannot open cpio archive\n%s"), super->name);
 	return -1;
     }
 
-    super->name = g_strdup (name);
-    super->u.arch.fd = -1;	/* for now */
-    mc_stat (name, &(super->u.arch.st));
-    super->u.arch.type = CPIO_UNKNOWN;
-
     type = get_compression_type (fd);
     if (type != COMPRESSION_NONE) {
 	char *s;
 
 	mc_close (fd);
-	s = g_strconcat (name, decompress_extension (type), (char *) NULL);
+	s = g_strconcat (super->name, decompress_extension (type), (char *) NULL);
 	if ((fd = mc_open (s, O_RDONLY)) == -1) {
 	    message (1, MSG_ERROR, _("Cannot open cpio archive\n%s"), s);
 	    g_free (s);
@@ -180,6 +176,23 @@ cpio_open_cpio_file (struct vfs_class *me, struct vfs_s_super *super,
     }
 
     super->u.arch.fd = fd;
+    CPIO_SEEK_SET (super, 0);
+
+    return fd;
+}
+
+static void
+cpio_open_cpio_file (struct vfs_class *me, struct vfs_s_super *super,
+		     const char *name)
+{
+    mode_t mode;
+    struct vfs_s_inode *root;
+
+    super->name = g_strdup (name);
+    super->u.arch.fd = -1;	/* for now */
+    mc_stat (name, &(super->u.arch.st));
+    super->u.arch.type = CPIO_UNKNOWN;
+
     mode = super->u.arch.st.st_mode & 07777;
     mode |= (mode & 0444) >> 2;	/* set eXec where Read is */
     mode |= S_IFDIR;
@@ -191,10 +204,6 @@ cpio_open_cpio_file (struct vfs_class *me, struct vfs_s_super *super,
     root->st.st_dev = MEDATA->rdev++;
 
     super->root = root;
-
-    CPIO_SEEK_SET (super, 0);
-
-    return fd;
 }
 
 static int cpio_read_head(struct vfs_class *me, struct vfs_s_super *super)
@@ -570,7 +579,13 @@ cpio_open_archive (struct vfs_class *me, struct vfs_s_super *super,
 
     (void) op;
 
-    if (cpio_open_cpio_file (me, super, name) == -1)
+    cpio_open_cpio_file (me, super, name);
+
+    /* The archive is opened on demand if the listing is known */
+    if (vfs_s_catalog_load (me, super))
+	return 0;
+
+    if (cpio_open_fd (me, super) == -1)
 	return -1;
 
     for (;;) {
@@ -583,6 +598,7 @@ cpio_open_archive (struct vfs_class *me, struct vfs_s_super *super,
 	case STATUS_OK:
 	    continue;
 	case STATUS_TRAIL:
+	    vfs_s_catalog_save (me, super);
 	    break;
 	}
 	break;
@@ -648,10 +664,11 @@ static int cpio_read(void *fh, char *buffer, int count)
 
 static int cpio_fh_open(struct vfs_class *me, struct vfs_s_fh *fh, int flags, int mode)
 {
-    (void) fh;
     (void) mode;
 
     if ((flags & O_ACCMODE) != O_RDONLY) ERRNOR (EROFS, -1);
+    if (FH_SUPER->u.arch.fd == -1 && cpio_open_fd (me, FH_SUPER) == -1)
+	ERRNOR (EIO, -1);
     return 0;
 }
 
@@ -38,8 +38,91 @@
 
 #define CALL(x) if (MEDATA->x) MEDATA->x
 
+/* Directories with at least this many entries get a hash index */
+#define VFS_S_HASH_MIN	64
+
 static volatile int total_inodes = 0, total_entries = 0;
 
+static unsigned int
+vfs_s_hash_name (const char *name, size_t len)
+{
+    unsigned int h = 0;
+
+    while (len--)
+	h = h * 31 + (unsigned char) *name++;
+    return h;
+}
+
+/* Chains keep list order, so that duplicates resolve as without index */
+static void
+vfs_s_hash_add (struct vfs_s_inode *dir, struct vfs_s_entry *ent)
+{
+    struct vfs_s_entry **ep;
+    unsigned int h;
+
+    h = vfs_s_hash_name (ent->name, strlen (ent->name)) & (dir->hash_size - 1);
+    for (ep = &dir->hash[h]; *ep != NULL; ep = &(*ep)->hash_next)
+	;
+    ent->hash_next = NULL;
+    *ep = ent;
+}
+
+/* (Re)build the index of dir with room for its current entries */
+static void
+vfs_s_hash_build (struct vfs_s_inode *dir)
+{
+    struct vfs_s_entry *ent;
+    unsigned int size = VFS_S_HASH_MIN;
+
+    while (size < (unsigned int) dir->subdir_count)
+	size <<= 1;
+
+    g_free (dir->hash);
+    dir->hash = g_new0 (struct vfs_s_entry *, size);
+    dir->hash_size = size;
+    for (ent = dir->subdir; ent != NULL; ent = ent->next)
+	vfs_s_hash_add (dir, ent);
+}
+
+static void
+vfs_s_hash_remove (struct vfs_s_inode *dir, struct vfs_s_entry *ent)
+{
+    struct vfs_s_entry **ep;
+    unsigned int h;
+
+    h = vfs_s_hash_name (ent->name, strlen (ent->name)) & (dir->hash_size - 1);
+    for (ep = &dir->hash[h]; *ep != NULL; ep = &(*ep)->hash_next)
+	if (*ep == ent) {
+	    *ep = ent->hash_next;
+	    break;
+	}
+}
+
+/* Find the entry called name (of length len) directly in dir */
+struct vfs_s_entry *
+vfs_s_lookup (struct vfs_s_inode *dir, const char *name, size_t len)
+{
+    struct vfs_s_entry *ent;
+
+    if (dir->catalog != 0)
+	vfs_s_catalog_expand (dir);
+    if (dir->hash == NULL && dir->subdir_count >= VFS_S_HASH_MIN)
+	vfs_s_hash_build (dir);
+
+    if (dir->hash == NULL) {
+	for (ent = dir->subdir; ent != NULL; ent = ent->next)
+	    if (strlen (ent->name) == len && !strncmp (ent->name, name, len))
+		return ent;
+	return NULL;
+    }
+
+    ent = dir->hash[vfs_s_hash_name (name, len) & (dir->hash_size - 1)];
+    for (; ent != NULL; ent = ent->hash_next)
+	if (strlen (ent->name) == len && !strncmp (ent->name, name, len))
+	    return ent;
+    return NULL;
+}
+
 struct vfs_s_inode *
 vfs_s_new_inode (struct vfs_class *me, struct vfs_s_super *super, struct stat *initstat)
 {
@@ -82,7 +165,7 @@ vfs_s_new_entry (struct vfs_class *me, const char *name, struct vfs_s_inode *ino
     return entry;
 }
 
-static void
+void
 vfs_s_free_inode (struct vfs_class *me, struct vfs_s_inode *ino)
 {
     if (!ino)
@@ -95,6 +178,7 @@ vfs_s_free_inode (struct vfs_class *me, struct vfs_s_inode *ino)
 	}
 
 	CALL (free_inode) (me, ino);
+	g_free (ino->hash);
 	g_free (ino->linkname);
 	if (ino->localname){
 	    unlink (ino->localname);
@@ -113,6 +197,11 @@ vfs_s_free_entry (struct vfs_class *me, struct vfs_s_entry *ent)
 	*ent->prevp = ent->next;
 	if (ent->next)
 	    ent->next->prevp = ent->prevp;
+	else
+	    ent->dir->subdir_tail = ent->prevp;
+	ent->dir->subdir_count--;
+	if (ent->dir->hash)
+	    vfs_s_hash_remove (ent->dir, ent);
     }
 
     g_free (ent->name);
@@ -135,12 +224,20 @@ vfs_s_insert_entry (struct vfs_class *me, struct vfs_s_inode *dir, struct vfs_s_
 
     (void) me;
 
-    for (ep = &dir->subdir; *ep != NULL; ep = &((*ep)->next))
-	;
+    ep = dir->subdir_tail ? dir->subdir_tail : &dir->subdir;
     ent->prevp = ep;
     ent->next = NULL;
     ent->dir = dir;
     *ep = ent;
+    dir->subdir_tail = &ent->next;
+
+    dir->subdir_count++;
+    if (dir->hash) {
+	if ((unsigned int) dir->subdir_count > 2 * dir->hash_size)
+	    vfs_s_hash_build (dir);
+	else
+	    vfs_s_hash_add (dir, ent);
+    }
 
     ent->ino->st.st_nlink++;
 }
@@ -264,11 +361,7 @@ vfs_s_find_entry_tree (struct vfs_class *me, struct vfs_s_inode *root,
 
 	for (pseg = 0; path[pseg] && path[pseg] != PATH_SEP; pseg++);
 
-	for (ent = root->subdir; ent != NULL; ent = ent->next)
-	    if (strlen (ent->name) == pseg
-		&& (!strncmp (ent->name, path, pseg)))
-		/* FOUND! */
-		break;
+	ent = vfs_s_lookup (root, path, pseg);
 
 	if (!ent && (flags & (FL_MKFILE | FL_MKDIR)))
 	    ent = vfs_s_automake (me, root, path, flags);
@@ -340,9 +433,7 @@ vfs_s_find_entry_linear (struct vfs_class *me, struct vfs_s_inode *root,
 	return retval;
     }
 
-    for (ent = root->subdir; ent != NULL; ent = ent->next)
-	if (!strcmp (ent->name, path))
-	    break;
+    ent = vfs_s_lookup (root, path, strlen (path));
 
     if (ent && (!(MEDATA->dir_uptodate) (me, ent->ino))) {
 #if 1
@@ -366,9 +457,7 @@ vfs_s_find_entry_linear (struct vfs_class *me, struct vfs_s_inode *root,
 	}
 	vfs_s_insert_entry (me, root, ent);
 
-	for (ent = root->subdir; ent != NULL; ent = ent->next)
-	    if (!strcmp (ent->name, path))
-		break;
+	ent = vfs_s_lookup (root, path, strlen (path));
     }
     if (!ent)
 	vfs_die ("find_linear: success but directory is not there\n");
@@ -608,6 +697,8 @@ vfs_s_opendir (struct vfs_class *me, const char *dirname)
     if (!S_ISDIR (dir->st.st_mode))
 	ERRNOR (ENOTDIR, NULL);
 
+    if (dir->catalog != 0)
+	vfs_s_catalog_expand (dir);
     dir->st.st_nlink++;
 #if 0
     if (!dir->subdir)	/* This can actually happen if we allow empty directories */
@@ -775,11 +866,9 @@ vfs_s_open (struct vfs_class *me, const char *file, int flags, int mode)
     fh->changed = was_changed;
     fh->linear = 0;
 
-    if (IS_LINEAR (flags)) {
-	if (MEDATA->linear_start) {
-	    print_vfs_message (_("Starting linear transfer..."));
-	    fh->linear = LS_LINEAR_PREOPEN;
-	}
+    if (IS_LINEAR (flags) && MEDATA->linear_start) {
+	print_vfs_message (_("Starting linear transfer..."));
+	fh->linear = LS_LINEAR_PREOPEN;
     } else if ((MEDATA->fh_open)
 	       && (MEDATA->fh_open (me, fh, flags, mode))) {
 	g_free (fh);
@@ -1046,7 +1135,7 @@ vfs_s_ungetlocalcopy (struct vfs_class *me, const char *path,
     return 0;
 }
 
-static int
+int
 vfs_s_setctl (struct vfs_class *me, const char *path, int ctlop, void *arg)
 {
     switch (ctlop) {
@@ -19,7 +19,7 @@
    License along with this program; if not, write to the Free Software
    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.  */
 
-/* Namespace: init_extfs */
+/* Namespace: init_extfs, extfs_copyout */
 
 #include <config.h>
 #include <stdio.h>
@@ -64,6 +64,7 @@ struct inode {
     time_t atime;
     time_t ctime;
     char *local_filename;
+    int pending;	/* local_filename is still being extracted */
 };
 
 struct entry {
@@ -92,12 +93,27 @@ struct archive {
     struct archive *next;
 };
 
+/* Files being extracted by copyout-batch, see extfs_prefetch() */
+struct extfs_batch {
+    struct archive *archive;
+    pid_t pid;
+    int fd;			/* reports of the helper */
+    struct inode **inodes;	/* in the order given to the helper */
+    int count, size;
+    int done;			/* number of reports read */
+    char line[32];
+    int len;
+};
+
+static struct extfs_batch *extfs_batch = NULL;
+
 static struct entry *extfs_find_entry (struct entry *dir, char *name,
 				       int make_dirs, int make_file);
 static int extfs_which (struct vfs_class *me, const char *path);
 static void extfs_remove_entry (struct entry *e);
 static void extfs_free (vfsid id);
 static void extfs_free_entry (struct entry *e);
+static void extfs_batch_end (int abort);
 
 static struct vfs_class vfs_extfs_ops;
 static struct archive *first_archive = NULL;
@@ -106,6 +122,7 @@ static int my_errno = 0;
 #define MAXEXTFS 32
 static char *extfs_prefixes [MAXEXTFS];
 static char extfs_need_archive [MAXEXTFS];
+static char extfs_no_batch [MAXEXTFS];	/* helper lacks copyout-batch */
 static int extfs_no = 0;
 
 static void
@@ -175,6 +192,7 @@ static struct entry *extfs_generate_entry (struct archive *archive,
     inode = g_new (struct inode, 1);
     entry->inode = inode;
     inode->local_filename = NULL;
+    inode->pending = 0;
     inode->linkname = NULL;
     inode->last_in_subdir = NULL;
     inode->inode = (archive->inode_counter)++;
@@ -207,6 +225,8 @@ static void extfs_free_entries (struct entry *entry)
 
 static void extfs_free_archive (struct archive *archive)
 {
+    if (extfs_batch != NULL && extfs_batch->archive == archive)
+	extfs_batch_end (1);
     extfs_free_entry (archive->root_entry);
     if (archive->local_name != NULL) {
         struct stat my;
@@ -383,6 +403,7 @@ extfs_read_archive (int fstype, const char *name, struct archive **pparc)
 		    inode = g_new (struct inode, 1);
 		    entry->inode = inode;
 		    inode->local_filename = NULL;
+		    inode->pending = 0;
 		    inode->inode = (current_archive->inode_counter)++;
 		    inode->nlink = 1;
 		    inode->dev = current_archive->rdev;
@@ -636,6 +657,36 @@ extfs_cmd (const char *extfs_cmd, struct archive *archive,
     return retval;
 }
 
+/*
+ * Extract `file' of `archive' to `local' with the helper `prefix'.  Used
+ * by native filesystems for the members they cannot decode themselves.
+ */
+int
+extfs_copyout (const char *prefix, const char *archive, const char *file,
+	       const char *local)
+{
+    char *quoted_file, *quoted_archive, *quoted_local;
+    char *mc_extfsdir, *cmd;
+    int retval;
+
+    quoted_file = name_quote (file, 0);
+    quoted_archive = name_quote (archive, 0);
+    quoted_local = name_quote (local, 0);
+    mc_extfsdir = concat_dir_and_file (mc_home, "extfs" PATH_SEP_STR);
+    cmd = g_strconcat (mc_extfsdir, prefix, " copyout ", quoted_archive,
+		       " ", quoted_file, " ", quoted_local, (char *) NULL);
+    g_free (quoted_file);
+    g_free (quoted_archive);
+    g_free (quoted_local);
+    g_free (mc_extfsdir);
+
+    open_error_pipe ();
+    retval = my_system (EXECUTE_AS_SHELL, shell, cmd);
+    g_free (cmd);
+    close_error_pipe (1, NULL);
+    return retval;
+}
+
 static void
 extfs_run (struct vfs_class *me, const char *file)
 {
@@ -659,6 +710,215 @@ extfs_run (struct vfs_class *me, const char *file)
     g_free (cmd);
 }
 
+/* {{{ batched copyout */
+
+/*
+ * Copying many files out of an archive runs the helper's copyout once
+ * for every file, and each run reads the archive again.  When a file
+ * operation announces the files it is about to read
+ * (VFS_SETCTL_PREFETCH), the helper is started just once with
+ *
+ *	prefix copyout-batch archivename
+ *
+ * It reads pairs of lines from its standard input, the stored name and
+ * the local file to extract it to, and writes one line with the exit
+ * status of every extraction to its standard output.  The helper works
+ * in the background while the files it has reported are copied, and
+ * extfs_open() of a file that is still in the batch waits for its
+ * report.  Files that fail, and helpers that do not know the command,
+ * fall back to the plain copyout.
+ */
+
+static void
+extfs_batch_fail (struct inode *inode)
+{
+    unlink (inode->local_filename);
+    free (inode->local_filename);
+    inode->local_filename = NULL;
+    inode->pending = 0;
+}
+
+/* Stop the batch, the files not reported yet go back to copyout */
+static void
+extfs_batch_end (int abort)
+{
+    struct extfs_batch *b = extfs_batch;
+    int status;
+
+    extfs_batch = NULL;
+    if (b->pid > 0) {
+	if (abort)
+	    kill (b->pid, SIGTERM);
+	close (b->fd);
+	while (waitpid (b->pid, &status, 0) == -1 && errno == EINTR);
+	if (!abort && b->done == 0)
+	    extfs_no_batch[b->archive->fstype] = 1;
+    }
+    for (; b->done < b->count; b->done++)
+	extfs_batch_fail (b->inodes[b->done]);
+    g_free (b->inodes);
+    g_free (b);
+}
+
+/* Read reports until `inode' is extracted */
+static void
+extfs_batch_wait (struct inode *inode)
+{
+    struct extfs_batch *b = extfs_batch;
+    char *nl;
+    int n;
+
+    while (inode->pending) {
+	nl = memchr (b->line, '\n', b->len);
+	if (nl != NULL) {
+	    struct inode *done = b->inodes[b->done++];
+
+	    if (nl == b->line + 1 && b->line[0] == '0')
+		done->pending = 0;
+	    else
+		extfs_batch_fail (done);
+	    b->len -= nl + 1 - b->line;
+	    memmove (b->line, nl + 1, b->len);
+	    continue;
+	}
+	if (b->len == sizeof (b->line))
+	    break;		/* garbage */
+	n = read (b->fd, b->line + b->len, sizeof (b->line) - b->len);
+	if (n == -1 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    break;
+	b->len += n;
+    }
+
+    if (inode->pending || b->done == b->count)
+	extfs_batch_end (0);
+}
+
+/* Add the regular files of `entry' to the batch list */
+static void
+extfs_batch_collect (struct extfs_batch *b, struct entry *entry, FILE *list)
+{
+    struct inode *inode = entry->inode;
+    char *local_filename, *file;
+    int fd;
+
+    if (S_ISDIR (inode->mode)) {
+	for (entry = inode->first_in_subdir; entry != NULL;
+	     entry = entry->next_in_dir)
+	    if (strcmp (entry->name, ".") && strcmp (entry->name, ".."))
+		extfs_batch_collect (b, entry, list);
+	return;
+    }
+
+    if (!S_ISREG (inode->mode) || inode->local_filename != NULL)
+	return;
+
+    file = extfs_get_path_from_entry (entry);
+    if (strchr (file, '\n') != NULL) {
+	g_free (file);
+	return;
+    }
+    fd = vfs_mkstemps (&local_filename, "extfs", entry->name);
+    if (fd == -1) {
+	g_free (file);
+	return;
+    }
+    close (fd);
+    fprintf (list, "%s\n%s\n", file, local_filename);
+    g_free (file);
+
+    if (b->count == b->size) {
+	b->size = b->size ? b->size * 2 : 64;
+	b->inodes = g_realloc (b->inodes, b->size * sizeof (b->inodes[0]));
+    }
+    b->inodes[b->count++] = inode;
+    inode->local_filename = local_filename;
+    inode->pending = 1;
+}
+
+static void
+extfs_prefetch (struct vfs_class *me, const char *path, char **names)
+{
+    struct archive *archive = NULL;
+    struct extfs_batch *b;
+    struct entry *dir, *entry;
+    char *q, *list_name, *mc_extfsdir, *helper;
+    int list_fd, pipefd[2];
+    FILE *list;
+
+    if (extfs_batch != NULL)
+	extfs_batch_end (1);
+
+    if ((q = extfs_get_path (me, path, &archive, 0)) == NULL)
+	return;
+    dir = extfs_find_entry (archive->root_entry, q, 0, 0);
+    g_free (q);
+    if (extfs_no_batch[archive->fstype] || dir == NULL
+	|| (dir = extfs_resolve_symlinks (dir)) == NULL
+	|| !S_ISDIR (dir->inode->mode))
+	return;
+
+    list_fd = vfs_mkstemps (&list_name, "extfs", "batch");
+    if (list_fd == -1)
+	return;
+    unlink (list_name);
+    free (list_name);
+    list = fdopen (list_fd, "w+");
+    if (list == NULL) {
+	close (list_fd);
+	return;
+    }
+
+    b = g_new0 (struct extfs_batch, 1);
+    b->archive = archive;
+    extfs_batch = b;
+    for (; *names != NULL; names++) {
+	q = g_strdup (*names);
+	entry = extfs_find_entry (dir, q, 0, 0);
+	g_free (q);
+	if (entry != NULL)
+	    extfs_batch_collect (b, entry, list);
+    }
+
+    if (b->count == 0 || fflush (list) != 0 || pipe (pipefd) == -1) {
+	fclose (list);
+	extfs_batch_end (0);
+	return;
+    }
+    rewind (list);
+
+    mc_extfsdir = concat_dir_and_file (mc_home, "extfs" PATH_SEP_STR);
+    helper = concat_dir_and_file (mc_extfsdir, extfs_prefixes[archive->fstype]);
+    g_free (mc_extfsdir);
+
+    b->pid = fork ();
+    if (b->pid == 0) {
+	int null_fd = open ("/dev/null", O_WRONLY);
+
+	dup2 (fileno (list), 0);
+	dup2 (pipefd[1], 1);
+	if (null_fd != -1)
+	    dup2 (null_fd, 2);
+	close (pipefd[0]);
+	execl (helper, helper, "copyout-batch",
+	       extfs_get_archive_name (archive), (char *) NULL);
+	_exit (127);
+    }
+    g_free (helper);
+    fclose (list);
+    close (pipefd[1]);
+    b->fd = pipefd[0];
+    if (b->pid == -1) {
+	close (b->fd);
+	extfs_batch_end (0);
+	return;
+    }
+    fcntl (b->fd, F_SETFD, FD_CLOEXEC);
+}
+
+/* }}} */
+
 static void *
 extfs_open (struct vfs_class *me, const char *file, int flags, int mode)
 {
@@ -687,6 +947,9 @@ extfs_open (struct vfs_class *me, const char *file, int flags, int mode)
     if (S_ISDIR (entry->inode->mode))
 	ERRNOR (EISDIR, NULL);
 
+    if (entry->inode->pending)
+	extfs_batch_wait (entry->inode);
+
     if (entry->inode->local_filename == NULL) {
 	char *local_filename;
 
@@ -1193,6 +1456,8 @@ static void extfs_remove_entry (struct entry *e)
 	pe->inode->last_in_subdir = prev;
 
     if (i <= 0) {
+	if (e->inode->pending)
+	    extfs_batch_end (1);
         if (e->inode->local_filename != NULL) {
             unlink (e->inode->local_filename);
             free (e->inode->local_filename);
@@ -1374,12 +1639,14 @@ static void extfs_done (struct vfs_class *me)
 static int
 extfs_setctl (struct vfs_class *me, const char *path, int ctlop, void *arg)
 {
-    (void) arg;
-
     if (ctlop == VFS_SETCTL_RUN) {
 	extfs_run (me, path);
 	return 1;
     }
+    if (ctlop == VFS_SETCTL_PREFETCH) {
+	extfs_prefetch (me, path, (char **) arg);
+	return 1;
+    }
     return 0;
 }
 
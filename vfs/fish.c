@@ -118,6 +118,212 @@ static int fish_get_reply (struct vfs_class *me, int sock, char *string_buf, int
 
 #define SUP super->u.fish
 
+/*
+ * Requests may be sent ahead of time, see fish_setctl().  The shell
+ * runs them one after another and their replies wait in the pipe.
+ * fish_command() does not send such a request again when it is the
+ * next one pending, it just goes on to read the reply.  Any other
+ * request first reads the pending replies, so that replies never get
+ * out of order.  The files read that way are kept as local copies.
+ */
+#define FISH_PENDING_LIST	1
+#define FISH_PENDING_RETR	2
+
+/* Only small files are read ahead */
+#define FISH_PENDING_MAX	32
+#define FISH_PENDING_SIZE	(256 * 1024)
+
+struct fish_pending {
+    struct fish_pending *next;
+    int type;
+    char *command;
+    struct vfs_s_inode *ino;	/* RETR: file, referenced while pending */
+};
+
+static void
+fish_pending_free (struct vfs_class *me, struct fish_pending *p)
+{
+    if (p->ino)
+	vfs_s_free_inode (me, p->ino);
+    g_free (p->command);
+    g_free (p);
+}
+
+/* Read the reply to a request sent ahead.  The data of a file goes to
+   its local copy */
+static void
+fish_pending_reply (struct vfs_class *me, struct vfs_s_super *super,
+		    struct fish_pending *p)
+{
+    char buffer[8192];
+#ifdef HAVE_LONG_LONG
+    long long total;
+#else
+    long total;
+#endif
+    int n, h = -1;
+
+    if (p->type == FISH_PENDING_LIST) {
+	while (vfs_s_get_line (me, SUP.sockr, buffer, sizeof (buffer), '\n'))
+	    if (!strncmp (buffer, "### ", 4))
+		break;
+	return;
+    }
+
+    if (fish_get_reply (me, SUP.sockr, buffer, sizeof (buffer)) != PRELIM)
+	return;
+#ifdef HAVE_LONG_LONG
+    if (sscanf (buffer, "%llu", &total) != 1)
+#else
+    if (sscanf (buffer, "%lu", &total) != 1)
+#endif
+	return;
+
+    if (!p->ino->localname && p->ino->ent)
+	h = vfs_mkstemps (&p->ino->localname, me->name, p->ino->ent->name);
+    while (total > 0) {
+	n = read (SUP.sockr, buffer, MIN (sizeof (buffer), total));
+	if (n <= 0)
+	    break;
+	if (h != -1 && write (h, buffer, n) != n) {
+	    close (h);
+	    h = -1;
+	    unlink (p->ino->localname);
+	    g_free (p->ino->localname);
+	    p->ino->localname = NULL;
+	}
+	total -= n;
+    }
+    if (fish_get_reply (me, SUP.sockr, NULL, 0) != COMPLETE && h != -1) {
+	close (h);
+	h = -1;
+	unlink (p->ino->localname);
+	g_free (p->ino->localname);
+	p->ino->localname = NULL;
+    }
+    if (h != -1)
+	close (h);
+}
+
+static void
+fish_pending_flush (struct vfs_class *me, struct vfs_s_super *super)
+{
+    struct fish_pending *p;
+
+    while ((p = SUP.pending) != NULL) {
+	print_vfs_message (_("fish: Reading ahead..."));
+	fish_pending_reply (me, super, p);
+	SUP.pending = p->next;
+	fish_pending_free (me, p);
+    }
+}
+
+/* Forget the pending requests without reading their replies */
+static void
+fish_pending_drop (struct vfs_class *me, struct vfs_s_super *super)
+{
+    struct fish_pending *p;
+
+    while ((p = SUP.pending) != NULL) {
+	SUP.pending = p->next;
+	fish_pending_free (me, p);
+    }
+}
+
+/*
+ * Between VFS_SETCTL_BATCH_BEGIN and VFS_SETCTL_BATCH_END the
+ * operations are not sent one by one but appended to a script, which
+ * is sent when it gets long or when any request other than a listing
+ * needs to go out.  Each operation in it prints a status line of its
+ * own, so the ones that failed can be reported afterwards.
+ */
+#define FISH_BATCH_MAX		64
+
+struct fish_batch {
+    int level;			/* Nesting of BATCH_BEGIN */
+    int count;			/* Operations in script */
+    char *script;
+    GList *paths;		/* Their paths, in order */
+    GList *failed;		/* Paths of failed operations */
+};
+
+/* Reply of a batched operation: echo 500 rather than 000 on failure */
+static const char *
+fish_status (struct vfs_s_super *super)
+{
+    return SUP.batch ? " && echo '### 000' || echo '### 500'\n"
+		     : "\necho '### 000'\n";
+}
+
+static void
+fish_batch_flush (struct vfs_class *me, struct vfs_s_super *super)
+{
+    struct fish_batch *b = SUP.batch;
+    FILE *logfile = MEDATA->logfile;
+    GList *l;
+    int status;
+
+    if (!b || !b->count)
+	return;
+
+    fish_pending_flush (me, super);
+    print_vfs_message (_("fish: Sending %d queued operations"), b->count);
+
+    if (logfile) {
+	fwrite (b->script, strlen (b->script), 1, logfile);
+	fflush (logfile);
+    }
+
+    enable_interrupt_key ();
+    status = write (SUP.sockw, b->script, strlen (b->script));
+    disable_interrupt_key ();
+
+    for (l = b->paths; l; l = l->next) {
+	if (status < 0 || fish_get_reply (me, SUP.sockr, NULL, 0) != COMPLETE)
+	    b->failed = g_list_append (b->failed, l->data);
+	else
+	    g_free (l->data);
+    }
+    g_list_free (b->paths);
+    b->paths = NULL;
+    g_free (b->script);
+    b->script = NULL;
+    b->count = 0;
+
+    vfs_stamp_create (&vfs_fish_ops, super);
+    vfs_s_invalidate (me, super);
+}
+
+static void
+fish_batch_add (struct vfs_class *me, struct vfs_s_super *super,
+		const char *path, const char *cmd)
+{
+    struct fish_batch *b = SUP.batch;
+    char *script;
+
+    script = g_strconcat (b->script ? b->script : "", cmd, (char *) NULL);
+    g_free (b->script);
+    b->script = script;
+    b->paths = g_list_append (b->paths, g_strdup (path));
+    if (++b->count >= FISH_BATCH_MAX)
+	fish_batch_flush (me, super);
+}
+
+static void
+fish_batch_free (struct fish_batch *b)
+{
+    GList *l;
+
+    for (l = b->paths; l; l = l->next)
+	g_free (l->data);
+    g_list_free (b->paths);
+    for (l = b->failed; l; l = l->next)
+	g_free (l->data);
+    g_list_free (b->failed);
+    g_free (b->script);
+    g_free (b);
+}
+
 static int
 fish_command (struct vfs_class *me, struct vfs_s_super *super,
 	      int wait_reply, const char *fmt, ...)
@@ -132,19 +338,35 @@ fish_command (struct vfs_class *me, struct vfs_s_super *super,
     str = g_strdup_vprintf (fmt, ap);
     va_end (ap);
 
-    if (logfile) {
-	fwrite (str, strlen (str), 1, logfile);
-	fflush (logfile);
-    }
+    /* A listing does not depend on the queued operations: the cache
+       does not reflect them before the batch is sent either */
+    if (SUP.batch && strncmp (str, "#LIST ", 6))
+	fish_batch_flush (me, super);
 
-    enable_interrupt_key ();
+    if (SUP.pending && !strcmp (SUP.pending->command, str)) {
+	/* Already sent, its reply comes next */
+	struct fish_pending *p = SUP.pending;
 
-    status = write (SUP.sockw, str, strlen (str));
-    g_free (str);
+	SUP.pending = p->next;
+	fish_pending_free (me, p);
+	g_free (str);
+    } else {
+	fish_pending_flush (me, super);
 
-    disable_interrupt_key ();
-    if (status < 0)
-	return TRANSIENT;
+	if (logfile) {
+	    fwrite (str, strlen (str), 1, logfile);
+	    fflush (logfile);
+	}
+
+	enable_interrupt_key ();
+
+	status = write (SUP.sockw, str, strlen (str));
+	g_free (str);
+
+	disable_interrupt_key ();
+	if (status < 0)
+	    return TRANSIENT;
+    }
 
     if (wait_reply)
 	return fish_get_reply (me, SUP.sockr,
@@ -159,11 +381,17 @@ fish_free_archive (struct vfs_class *me, struct vfs_s_super *super)
     if ((SUP.sockw != -1) || (SUP.sockr != -1)) {
 	print_vfs_message (_("fish: Disconnecting from %s"),
 			   super->name ? super->name : "???");
+	/* The shell dies of SIGPIPE if it is still sending */
+	fish_pending_drop (me, super);
 	fish_command (me, super, NONE, "#BYE\nexit\n");
 	close (SUP.sockw);
 	close (SUP.sockr);
 	SUP.sockw = SUP.sockr = -1;
     }
+    if (SUP.batch) {
+	fish_batch_free (SUP.batch);
+	SUP.batch = NULL;
+    }
     g_free (SUP.host);
     g_free (SUP.user);
     g_free (SUP.cwdir);
@@ -355,23 +583,13 @@ fish_archive_same (struct vfs_class *me, struct vfs_s_super *super,
     return flags;
 }
 
-static int
-fish_dir_load(struct vfs_class *me, struct vfs_s_inode *dir, char *remote_path)
+static char *
+fish_list_command (const char *remote_path)
 {
-    struct vfs_s_super *super = dir->super;
-    char buffer[8192];
-    struct vfs_s_entry *ent = NULL;
-    FILE *logfile;
-    char *quoted_path;
+    char *quoted_path, *cmd;
 
-    logfile = MEDATA->logfile;
-
-    print_vfs_message(_("fish: Reading directory %s..."), remote_path);
-
-    gettimeofday(&dir->timestamp, NULL);
-    dir->timestamp.tv_sec += fish_directory_timeout;
     quoted_path = name_quote (remote_path, 0);
-    fish_command (me, super, NONE,
+    cmd = g_strdup_printf (
 	    /* XXX no -L here, unless -L in RETR; otherwise we'll be inconsistent */
 	    /* XXX The trailing slash is needed to accomodate directory symlinks */
 	    "#LIST /%s\n"
@@ -388,6 +606,86 @@ fish_dir_load(struct vfs_class *me, struct vfs_s_inode *dir, char *remote_path)
 	    "echo '### 200'\n",
 	    remote_path, quoted_path, quoted_path);
     g_free (quoted_path);
+    return cmd;
+}
+
+/* `name' is the remote name without the leading slash.  From a non-zero
+   offset on, the data is sent by tail, or by dd where tail cannot do
+   it; the size line still tells the size of the whole file */
+static char *
+fish_retr_command (const char *name, off_t offset)
+{
+    char *quoted_name, *cmd;
+    char skip[32], from[32];
+
+    quoted_name = name_quote (name, 0);
+    if (!offset) {
+	cmd = g_strdup_printf (
+		"#RETR /%s\n"
+		"if dd if=/%s of=/dev/null bs=1 count=1 2>/dev/null; then\n"
+		"ls -ln /%s 2>/dev/null | (\n"
+		  "read p l u g s r\n"
+		  "echo \"$s\"\n"
+		")\n"
+		"echo '### 100'\n"
+		"cat /%s\n"
+		"echo '### 200'\n"
+		"else\n"
+		"echo '### 500'\n"
+		"fi\n",
+		quoted_name, quoted_name, quoted_name, quoted_name);
+	g_free (quoted_name);
+	return cmd;
+    }
+
+#ifdef HAVE_LONG_LONG
+    g_snprintf (skip, sizeof (skip), "%llu", (unsigned long long) offset);
+    g_snprintf (from, sizeof (from), "%llu", (unsigned long long) offset + 1);
+#else
+    g_snprintf (skip, sizeof (skip), "%lu", (unsigned long) offset);
+    g_snprintf (from, sizeof (from), "%lu", (unsigned long) offset + 1);
+#endif
+    cmd = g_strdup_printf (
+		"#RETR /%s %s\n"
+		"if dd if=/%s of=/dev/null bs=1 count=1 2>/dev/null; then\n"
+		"ls -ln /%s 2>/dev/null | (\n"
+		  "read p l u g s r\n"
+		  "echo \"$s\"\n"
+		")\n"
+		"echo '### 100'\n"
+		"if tail -c +1 /dev/null >/dev/null 2>&1; then\n"
+		"tail -c +%s /%s\n"
+		"else\n"
+		"dd if=/%s bs=1 skip=%s 2>/dev/null\n"
+		"fi\n"
+		"echo '### 200'\n"
+		"else\n"
+		"echo '### 500'\n"
+		"fi\n",
+		quoted_name, skip, quoted_name, quoted_name,
+		from, quoted_name, quoted_name, skip);
+    g_free (quoted_name);
+    return cmd;
+}
+
+static int
+fish_dir_load(struct vfs_class *me, struct vfs_s_inode *dir, char *remote_path)
+{
+    struct vfs_s_super *super = dir->super;
+    char buffer[8192];
+    struct vfs_s_entry *ent = NULL;
+    FILE *logfile;
+    char *cmd;
+
+    logfile = MEDATA->logfile;
+
+    print_vfs_message(_("fish: Reading directory %s..."), remote_path);
+
+    gettimeofday(&dir->timestamp, NULL);
+    dir->timestamp.tv_sec += fish_directory_timeout;
+    cmd = fish_list_command (remote_path);
+    fish_command (me, super, NONE, "%s", cmd);
+    g_free (cmd);
     ent = vfs_s_generate_entry(me, NULL, dir, 0);
     while (1) {
 	int res = vfs_s_get_line_interruptible (me, buffer, sizeof (buffer), SUP.sockr); 
@@ -631,38 +929,29 @@ error_return:
 static int
 fish_linear_start (struct vfs_class *me, struct vfs_s_fh *fh, off_t offset)
 {
-    char *name;
-    char *quoted_name;
+    char *name, *cmd;
 #ifdef HAVE_LONG_LONG
     long long total;
 #else
     long total;
 #endif
-    if (offset)
-        ERRNOR (E_NOTSUPP, 0);
+    int reply;
+
+    /* There is a local copy, which vfs_s_open() has opened */
+    if (fh->handle != -1) {
+	fh->linear = LS_NOT_LINEAR;
+	return 1;
+    }
+
     name = vfs_s_fullpath (me, fh->ino);
     if (!name)
 	return 0;
-    quoted_name = name_quote (name, 0);
+    cmd = fish_retr_command (name, offset);
     g_free (name);
-    name = quoted_name;
     fh->u.fish.append = 0;
-    offset = fish_command (me, FH_SUPER, WANT_STRING,
-		"#RETR /%s\n"
-		"if dd if=/%s of=/dev/null bs=1 count=1 2>/dev/null; then\n"
-		"ls -ln /%s 2>/dev/null | (\n"
-		  "read p l u g s r\n"
-		  "echo \"$s\"\n"
-		")\n"
-		"echo '### 100'\n"
-		"cat /%s\n"
-		"echo '### 200'\n"
-		"else\n"
-		"echo '### 500'\n"
-		"fi\n",
-		name, name, name, name );
-    g_free (name);
-    if (offset != PRELIM) ERRNOR (E_REMOTE, 0);
+    reply = fish_command (me, FH_SUPER, WANT_STRING, "%s", cmd);
+    g_free (cmd);
+    if (reply != PRELIM) ERRNOR (E_REMOTE, 0);
     fh->linear = LS_LINEAR_OPEN;
     fh->u.fish.got = 0;
 #ifdef HAVE_LONG_LONG
@@ -671,7 +960,8 @@ fish_linear_start (struct vfs_class *me, struct vfs_s_fh *fh, off_t offset)
     if (sscanf( reply_str, "%lu", &total )!=1)
 #endif
 	ERRNOR (E_REMOTE, 0);
-    fh->u.fish.total = total;
+    /* Only the part past the offset is sent */
+    fh->u.fish.total = MAX (total - offset, 0);
     return 1;
 }
 
@@ -754,10 +1044,16 @@ fish_ctl (void *fh, int ctlop, void *arg)
 }
 
 static int
-fish_send_command(struct vfs_class *me, struct vfs_s_super *super, const char *cmd, int flags)
+fish_send_command(struct vfs_class *me, struct vfs_s_super *super,
+		  const char *path, const char *cmd, int flags)
 {
     int r;
 
+    if (SUP.batch) {
+	fish_batch_add (me, super, path, cmd);
+	return 0;
+    }
+
     r = fish_command (me, super, WAIT_REPLY, "%s", cmd);
     vfs_stamp_create (&vfs_fish_ops, super);
     if (r != COMPLETE) ERRNOR (E_REMOTE, -1);
@@ -780,17 +1076,16 @@ fish_send_command(struct vfs_class *me, struct vfs_s_super *super, const char *c
 
 #define POSTFIX(flags) \
     g_free (rpath); \
-    return fish_send_command(me, super, buf, flags);
+    return fish_send_command(me, super, path, buf, flags);
 
 static int
 fish_chmod (struct vfs_class *me, const char *path, int mode)
 {
     PREFIX
     g_snprintf(buf, sizeof(buf), "#CHMOD %4.4o /%s\n"
-				 "chmod %4.4o \"/%s\" 2>/dev/null\n"
-				 "echo '### 000'\n", 
+				 "chmod %4.4o \"/%s\" 2>/dev/null%s",
 	    mode & 07777, rpath,
-	    mode & 07777, rpath);
+	    mode & 07777, rpath, fish_status (super));
     POSTFIX(OPT_FLUSH);
 }
 
@@ -814,19 +1109,18 @@ static int fish_##name (struct vfs_class *me, const char *path1, const char *pat
     g_free (mpath1); \
     rpath2 = name_quote (crpath2, 0); \
     g_free (mpath2); \
-    g_snprintf(buf, sizeof(buf), string "\n", rpath1, rpath2, rpath1, rpath2); \
+    g_snprintf(buf, sizeof(buf), string, rpath1, rpath2, rpath1, rpath2, \
+	       fish_status (super2)); \
     g_free (rpath1); \
     g_free (rpath2); \
-    return fish_send_command(me, super2, buf, OPT_FLUSH); \
+    return fish_send_command(me, super2, path2, buf, OPT_FLUSH); \
 }
 
 #define XTEST if (bucket1 != bucket2) { ERRNOR (EXDEV, -1); }
 FISH_OP(rename, XTEST, "#RENAME /%s /%s\n"
-		       "mv /%s /%s 2>/dev/null\n"
-		       "echo '### 000'" )
+		       "mv /%s /%s 2>/dev/null%s" )
 FISH_OP(link,   XTEST, "#LINK /%s /%s\n"
-		       "ln /%s /%s 2>/dev/null\n"
-		       "echo '### 000'" )
+		       "ln /%s /%s 2>/dev/null%s" )
 
 static int fish_symlink (struct vfs_class *me, const char *setto, const char *path)
 {
@@ -835,9 +1129,8 @@ static int fish_symlink (struct vfs_class *me, const char *setto, const char *pa
     qsetto = name_quote (setto, 0);
     g_snprintf(buf, sizeof(buf),
             "#SYMLINK %s /%s\n"
-	    "ln -s %s /%s 2>/dev/null\n"
-	    "echo '### 000'\n",
-	    qsetto, rpath, qsetto, rpath);
+	    "ln -s %s /%s 2>/dev/null%s",
+	    qsetto, rpath, qsetto, rpath, fish_status (super));
     g_free (qsetto);
     POSTFIX(OPT_FLUSH);
 }
@@ -861,18 +1154,16 @@ fish_chown (struct vfs_class *me, const char *path, int owner, int group)
 	PREFIX
 	g_snprintf (buf, sizeof(buf),
     	    "#CHOWN /%s /%s\n"
-	    "chown %s /%s 2>/dev/null\n"
-	    "echo '### 000'\n", 
+	    "chown %s /%s 2>/dev/null%s",
 	    sowner, rpath,
-	    sowner, rpath);
-	fish_send_command (me, super, buf, OPT_FLUSH); 
+	    sowner, rpath, fish_status (super));
+	fish_send_command (me, super, path, buf, OPT_FLUSH);
 	/* FIXME: what should we report if chgrp succeeds but chown fails? */
 	g_snprintf (buf, sizeof(buf),
             "#CHGRP /%s /%s\n"
-	    "chgrp %s /%s 2>/dev/null\n"
-	    "echo '### 000'\n", 
+	    "chgrp %s /%s 2>/dev/null%s",
 	    sgroup, rpath,
-	    sgroup, rpath);
+	    sgroup, rpath, fish_status (super));
 	/* fish_send_command(me, super, buf, OPT_FLUSH); */
 	POSTFIX (OPT_FLUSH)
     }
@@ -883,9 +1174,8 @@ static int fish_unlink (struct vfs_class *me, const char *path)
     PREFIX
     g_snprintf(buf, sizeof(buf),
             "#DELE /%s\n"
-	    "rm -f /%s 2>/dev/null\n"
-	    "echo '### 000'\n",
-	    rpath, rpath);
+	    "rm -f /%s 2>/dev/null%s",
+	    rpath, rpath, fish_status (super));
     POSTFIX(OPT_FLUSH);
 }
 
@@ -897,9 +1187,8 @@ static int fish_mkdir (struct vfs_class *me, const char *path, mode_t mode)
 
     g_snprintf(buf, sizeof(buf),
             "#MKD /%s\n"
-	    "mkdir /%s 2>/dev/null\n"
-	    "echo '### 000'\n",
-	    rpath, rpath);
+	    "mkdir /%s 2>/dev/null%s",
+	    rpath, rpath, fish_status (super));
     POSTFIX(OPT_FLUSH);
 }
 
@@ -908,9 +1197,8 @@ static int fish_rmdir (struct vfs_class *me, const char *path)
     PREFIX
     g_snprintf(buf, sizeof(buf),
             "#RMD /%s\n"
-	    "rmdir /%s 2>/dev/null\n"
-	    "echo '### 000'\n",
-	    rpath, rpath);
+	    "rmdir /%s 2>/dev/null%s",
+	    rpath, rpath, fish_status (super));
     POSTFIX(OPT_FLUSH);
 }
 
@@ -942,6 +1230,137 @@ fish_fh_open (struct vfs_class *me, struct vfs_s_fh *fh, int flags,
     return 0;
 }
 
+static int
+fish_batch_setctl (struct vfs_class *me, const char *path, int ctlop,
+		   void *arg)
+{
+    struct vfs_s_super *super;
+    struct fish_batch *b;
+    GList *l;
+    char *mpath = g_strdup (path);
+
+    if (!vfs_s_get_path_mangle (me, mpath, &super, 0)) {
+	g_free (mpath);
+	return 0;
+    }
+    g_free (mpath);
+
+    if (ctlop == VFS_SETCTL_BATCH_BEGIN) {
+	if (SUP.sockw == -1)
+	    return 0;
+	if (!SUP.batch)
+	    SUP.batch = g_new0 (struct fish_batch, 1);
+	SUP.batch->level++;
+	return 1;
+    }
+
+    if (!(b = SUP.batch))
+	return 0;
+    fish_batch_flush (me, super);
+    if (arg) {
+	*(GList **) arg = b->failed;
+	b->failed = NULL;
+    } else {
+	for (l = b->failed; l; l = l->next)
+	    g_free (l->data);
+	g_list_free (b->failed);
+	b->failed = NULL;
+    }
+    if (!--b->level) {
+	fish_batch_free (b);
+	SUP.batch = NULL;
+    }
+    return 1;
+}
+
+/* Send the requests for the marked files ahead, so that the shell
+   already works on the next one while the current one is copied.
+   Only the first directory is listed ahead: once mc looks into it,
+   the files that are still pending are read into local copies */
+static int
+fish_setctl (struct vfs_class *me, const char *path, int ctlop, void *arg)
+{
+    char **names = arg;
+    struct vfs_s_super *super;
+    struct vfs_s_inode *ino;
+    struct fish_pending *p, **tail;
+    FILE *logfile = MEDATA->logfile;
+    const char *crpath;
+    char *mpath, *name, *cmd;
+    int n, listed = 0;
+
+    switch (ctlop) {
+    case VFS_SETCTL_PREFETCH:
+	break;
+    case VFS_SETCTL_BATCH_BEGIN:
+    case VFS_SETCTL_BATCH_END:
+	return fish_batch_setctl (me, path, ctlop, arg);
+    default:
+	return vfs_s_setctl (me, path, ctlop, arg);
+    }
+
+    mpath = g_strdup (path);
+    if (!(crpath = vfs_s_get_path_mangle (me, mpath, &super, 0))
+	|| SUP.pending || SUP.sockw == -1) {
+	g_free (mpath);
+	return 0;
+    }
+
+    tail = &SUP.pending;
+    for (n = 0; *names && n < FISH_PENDING_MAX; names++) {
+	int type = FISH_PENDING_RETR;
+
+	name = *crpath ? g_strconcat (crpath, PATH_SEP_STR, *names,
+				      (char *) NULL) : g_strdup (*names);
+	ino = vfs_s_find_inode (me, super, name, LINK_NO_FOLLOW, FL_NONE);
+	if (ino == NULL || S_ISLNK (ino->st.st_mode)) {
+	    g_free (name);
+	    continue;
+	}
+	if (S_ISDIR (ino->st.st_mode)) {
+	    /* Unless it has been listed already */
+	    type = FISH_PENDING_LIST;
+	    cmd = listed++ || vfs_s_lookup (super->root, name, strlen (name))
+		? NULL : fish_list_command (name);
+	} else if (S_ISREG (ino->st.st_mode)
+		   && ino->st.st_size <= FISH_PENDING_SIZE
+		   && ino->localname == NULL) {
+	    char *full = vfs_s_fullpath (me, ino);
+
+	    cmd = full ? fish_retr_command (full, 0) : NULL;
+	    g_free (full);
+	} else
+	    cmd = NULL;
+	g_free (name);
+	if (cmd == NULL)
+	    continue;
+
+	if (logfile) {
+	    fwrite (cmd, strlen (cmd), 1, logfile);
+	    fflush (logfile);
+	}
+	if (write (SUP.sockw, cmd, strlen (cmd)) != (ssize_t) strlen (cmd)) {
+	    g_free (cmd);
+	    break;
+	}
+	p = g_new (struct fish_pending, 1);
+	p->next = NULL;
+	p->type = type;
+	p->command = cmd;
+	p->ino = NULL;
+	if (type == FISH_PENDING_RETR) {
+	    p->ino = ino;
+	    ino->st.st_nlink++;
+	}
+	*tail = p;
+	tail = &p->next;
+	n++;
+    }
+
+    g_free (mpath);
+    return 1;
+}
+
 static void
 fish_fill_names (struct vfs_class *me, fill_names_f func)
 {
@@ -1010,5 +1429,6 @@ init_fish (void)
     vfs_fish_ops.mkdir = fish_mkdir;
     vfs_fish_ops.rmdir = fish_rmdir;
     vfs_fish_ops.ctl = fish_ctl;
+    vfs_fish_ops.setctl = fish_setctl;
     vfs_register_class (&vfs_fish_ops);
 }
@@ -120,6 +120,9 @@ int ftpfs_use_unix_list_options = 1;
 /* First "CWD <path>", then "LIST -la ." */
 int ftpfs_first_cd_then_ls = 1;
 
+/* Use MLSD rather than LIST if the server has it (RFC 3659) */
+int ftpfs_use_mlsd = 1;
+
 /* Use the ~/.netrc */
 int use_netrc = 1;
 
@@ -133,6 +136,10 @@ char *ftpfs_proxy_host = NULL;
 /* wether we have to use proxy by default? */
 int ftpfs_always_use_proxy;
 
+/* Control connections per host, the first one included.  The others
+   run transfers in parallel to it */
+int ftpfs_max_connections = 4;
+
 #ifdef FIXME_LATER_ALIGATOR
 static struct linklist *connections_list;
 #endif
@@ -165,6 +172,7 @@ static int ftpfs_command (struct vfs_class *me, struct vfs_s_super *super, int w
 static int ftpfs_open_socket (struct vfs_class *me, struct vfs_s_super *super);
 static int ftpfs_login_server (struct vfs_class *me, struct vfs_s_super *super, const char *netrcpass);
 static int ftpfs_netrc_lookup (const char *host, char **login, char **pass);
+static void ftpfs_pool_free (struct vfs_class *me, struct vfs_s_super *super);
 
 static char *
 ftpfs_translate_path (struct vfs_class *me, struct vfs_s_super *super, const char *remote_path)
@@ -403,6 +411,7 @@ ftpfs_free_archive (struct vfs_class *me, struct vfs_s_super *super)
 {
     if (SUP.sock != -1){
 	print_vfs_message (_("ftpfs: Disconnecting from %s"), SUP.host);
+	ftpfs_pool_free (me, super);
 	ftpfs_command(me, super, NONE, "QUIT");
 	close(SUP.sock);
     }
@@ -722,6 +731,25 @@ ftpfs_open_socket (struct vfs_class *me, struct vfs_s_super *super)
     return my_socket;
 }
 
+/* Ask the server what it supports.  MLSD comes with MLST */
+static void
+ftpfs_get_features (struct vfs_class *me, struct vfs_s_super *super)
+{
+    char answer[BUF_1K];
+
+    SUP.use_mlsd = 0;
+    if (!ftpfs_use_mlsd || ftpfs_command (me, super, NONE, "FEAT") != COMPLETE)
+	return;
+
+    while (vfs_s_get_line (me, SUP.sock, answer, sizeof (answer), '\n')) {
+	if (answer[0] == ' ' && !g_strncasecmp (answer + 1, "MLST", 4))
+	    SUP.use_mlsd = 1;
+	/* The last line of the reply, or an error */
+	if (isdigit ((unsigned char) answer[0]) && answer[3] != '-')
+	    break;
+    }
+}
+
 static int
 ftpfs_open_archive_int (struct vfs_class *me, struct vfs_s_super *super)
 {
@@ -769,6 +797,7 @@ ftpfs_open_archive_int (struct vfs_class *me, struct vfs_s_super *super)
     SUP.cwdir = ftpfs_get_current_directory (me, super);
     if (!SUP.cwdir)
         SUP.cwdir = g_strdup (PATH_SEP_STR);
+    ftpfs_get_features (me, super);
     return 0;
 }
 
@@ -951,7 +980,7 @@ again:
 
 static int
 ftpfs_open_data_connection (struct vfs_class *me, struct vfs_s_super *super, const char *cmd,
-		      const char *remote, int isbinary, int reget)
+		      const char *remote, int isbinary, off_t reget)
 {
     struct sockaddr_in from;
     int s, j, data;
@@ -962,7 +991,13 @@ ftpfs_open_data_connection (struct vfs_class *me, struct vfs_s_super *super, con
     if (ftpfs_changetype (me, super, isbinary) == -1)
         return -1;
     if (reget > 0){
-	j = ftpfs_command (me, super, WAIT_REPLY, "REST %d", reget);
+#ifdef HAVE_LONG_LONG
+	j = ftpfs_command (me, super, WAIT_REPLY, "REST %llu",
+			   (unsigned long long) reget);
+#else
+	j = ftpfs_command (me, super, WAIT_REPLY, "REST %lu",
+			   (unsigned long) reget);
+#endif
 	if (j != CONTINUE)
 	    return -1;
     }
@@ -1040,6 +1075,567 @@ ftpfs_linear_abort (struct vfs_class *me, struct vfs_s_fh *fh)
 	ftpfs_get_reply (me, SUP.sock, NULL, 0);
 }
 
+/*
+ * Extra control connections.  While the first one is busy with a
+ * linear transfer or listings, the others fetch the marked files
+ * ahead (see ftpfs_setctl()) or ranges of a big file, each into a
+ * local file.  MC does not wait on them: their data is moved to the
+ * local files whenever ftpfs waits for data anyway, see
+ * ftpfs_pool_pump().
+ */
+
+/* Marked files up to this size are fetched ahead */
+#define FTPFS_PREFETCH_MAX	32
+#define FTPFS_PREFETCH_SIZE	(1024 * 1024)
+
+/* Files of at least two ranges of this size are fetched in ranges */
+#define FTPFS_SPLIT_SIZE	(4 * 1024 * 1024)
+#define FTPFS_SPLIT_MAX		8
+
+#define XFER_QUEUED	0
+#define XFER_RUNNING	1
+#define XFER_DONE	2
+#define XFER_FAILED	3
+
+struct ftpfs_conn {
+    struct ftpfs_conn *next;
+    int sock;
+    int isbinary;
+    char *cwdir;
+};
+
+/* RETR of a file, or of a range of it, on an extra connection */
+struct ftpfs_xfer {
+    struct ftpfs_xfer *next;
+    struct vfs_s_inode *ino;	/* Referenced while in the list */
+    struct ftpfs_conn *conn;	/* While running */
+    char *localname;
+    int sock, fd;		/* Data connection, local file */
+    off_t offset, end;		/* Range, end is -1 for all the rest */
+    off_t got;
+    int state;
+    int split;			/* Range of a file being read, the
+				   reader frees it */
+};
+
+/* A file being read in ranges, see ftpfs_linear_start() */
+struct ftpfs_split {
+    int count;
+    struct ftpfs_xfer *part[FTPFS_SPLIT_MAX];
+    char *localname;
+    int fd;
+    off_t pos;
+    int eof;
+};
+
+/* Make conn the connection ftpfs_command() talks to, or back */
+static void
+ftpfs_pool_swap (struct vfs_s_super *super, struct ftpfs_conn *conn)
+{
+    int sock = SUP.sock, isbinary = SUP.isbinary;
+    char *cwdir = SUP.cwdir;
+
+    SUP.sock = conn->sock;
+    SUP.isbinary = conn->isbinary;
+    SUP.cwdir = conn->cwdir;
+    conn->sock = sock;
+    conn->isbinary = isbinary;
+    conn->cwdir = cwdir;
+}
+
+/* Log in on a new connection like ftpfs_login_server(), but without
+   asking anything: a server which won't have another connection from
+   us is no error */
+static int
+ftpfs_pool_login (struct vfs_class *me, struct vfs_s_super *super)
+{
+    const char *pass = SUP.password;
+    char *name;
+    int r;
+
+    if (!pass && (!strcmp (SUP.user, "anonymous") || !strcmp (SUP.user, "ftp")))
+	pass = ftpfs_anonymous_passwd;
+    if (!pass)
+	return 0;
+
+    if (SUP.proxy)
+	name = g_strconcat (SUP.user, "@",
+			    SUP.host[0] == '!' ? SUP.host + 1 : SUP.host,
+			    (char *) NULL);
+    else
+	name = g_strdup (SUP.user);
+
+    r = ftpfs_get_reply (me, SUP.sock, NULL, 0);
+    if (r == COMPLETE)
+	r = ftpfs_command (me, super, WAIT_REPLY, "USER %s", name);
+    if (r == CONTINUE)
+	r = ftpfs_command (me, super, WAIT_REPLY, "PASS %s", pass);
+    g_free (name);
+    return r == COMPLETE;
+}
+
+static struct ftpfs_conn *
+ftpfs_pool_get (struct vfs_class *me, struct vfs_s_super *super)
+{
+    struct ftpfs_conn *conn;
+    int ok = 0;
+
+    if ((conn = SUP.idle) != NULL) {
+	SUP.idle = conn->next;
+	return conn;
+    }
+    if (SUP.conns_refused || SUP.conns >= ftpfs_max_connections - 1)
+	return NULL;
+
+    conn = g_new0 (struct ftpfs_conn, 1);
+    conn->isbinary = TYPE_UNKNOWN;
+    conn->sock = ftpfs_open_socket (me, super);
+    if (conn->sock != -1) {
+	ftpfs_pool_swap (super, conn);
+	ok = ftpfs_pool_login (me, super);
+	ftpfs_pool_swap (super, conn);
+    }
+    if (!ok) {
+	if (conn->sock != -1)
+	    close (conn->sock);
+	g_free (conn);
+	SUP.conns_refused = 1;
+	return NULL;
+    }
+    SUP.conns++;
+    return conn;
+}
+
+static void
+ftpfs_pool_put (struct vfs_s_super *super, struct ftpfs_conn *conn)
+{
+    conn->next = SUP.idle;
+    SUP.idle = conn;
+}
+
+/* Close a connection, e.g. because it is in the middle of a transfer */
+static void
+ftpfs_pool_drop (struct vfs_s_super *super, struct ftpfs_conn *conn)
+{
+    close (conn->sock);
+    g_free (conn->cwdir);
+    g_free (conn);
+    SUP.conns--;
+}
+
+static struct ftpfs_xfer *
+ftpfs_xfer_new (struct vfs_s_inode *ino, const char *localname,
+		off_t offset, off_t end)
+{
+    struct ftpfs_xfer *x = g_new0 (struct ftpfs_xfer, 1);
+
+    x->ino = ino;
+    ino->st.st_nlink++;
+    x->localname = g_strdup (localname);
+    x->sock = x->fd = -1;
+    x->offset = offset;
+    x->end = end;
+    x->state = XFER_QUEUED;
+    return x;
+}
+
+/* Stop a transfer and take it off the list.  A whole file fetched
+   ahead becomes the local copy of the file */
+static void
+ftpfs_xfer_free (struct vfs_class *me, struct vfs_s_super *super,
+		 struct ftpfs_xfer *x)
+{
+    struct ftpfs_xfer **xp;
+
+    for (xp = &SUP.xfers; *xp; xp = &(*xp)->next)
+	if (*xp == x) {
+	    *xp = x->next;
+	    break;
+	}
+
+    if (x->sock != -1)
+	close (x->sock);
+    if (x->fd != -1)
+	close (x->fd);
+    if (x->conn)
+	ftpfs_pool_drop (super, x->conn);
+    if (!x->split) {
+	if (x->state == XFER_DONE && !x->ino->localname) {
+	    x->ino->localname = x->localname;
+	    x->localname = NULL;
+	} else
+	    unlink (x->localname);
+    }
+    g_free (x->localname);
+    vfs_s_free_inode (me, x->ino);
+    g_free (x);
+}
+
+static void
+ftpfs_xfer_finish (struct vfs_class *me, struct vfs_s_super *super,
+		   struct ftpfs_xfer *x, int state)
+{
+    x->state = state;
+    if (x->conn) {
+	/* In the middle of the transfer, no use any more */
+	ftpfs_pool_drop (super, x->conn);
+	x->conn = NULL;
+    }
+    if (x->sock != -1) {
+	close (x->sock);
+	x->sock = -1;
+    }
+    if (x->fd != -1) {
+	close (x->fd);
+	x->fd = -1;
+    }
+    if (!x->split)
+	ftpfs_xfer_free (me, super, x);
+}
+
+static int
+ftpfs_xfer_start (struct vfs_class *me, struct vfs_s_super *super,
+		  struct ftpfs_xfer *x, struct ftpfs_conn *conn)
+{
+    char *name = vfs_s_fullpath (me, x->ino);
+
+    if (name) {
+	ftpfs_pool_swap (super, conn);
+	x->sock = ftpfs_open_data_connection (me, super, "RETR", name,
+					      TYPE_BINARY, x->offset);
+	ftpfs_pool_swap (super, conn);
+	g_free (name);
+    }
+    if (x->sock == -1) {
+	ftpfs_pool_put (super, conn);
+	return -1;
+    }
+
+    x->conn = conn;
+    x->state = XFER_RUNNING;
+    x->fd = open (x->localname, O_WRONLY);
+    if (x->fd == -1 || lseek (x->fd, x->offset, SEEK_SET) == -1)
+	return -1;
+    return 0;
+}
+
+/* Start the queued transfers there are connections for */
+static void
+ftpfs_pool_start (struct vfs_class *me, struct vfs_s_super *super)
+{
+    struct ftpfs_xfer *x, *next;
+    struct ftpfs_conn *conn;
+    int running = 0;
+
+    for (x = SUP.xfers; x; x = x->next)
+	if (x->state == XFER_RUNNING)
+	    running++;
+
+    for (x = SUP.xfers; x; x = next) {
+	next = x->next;
+	if (x->state != XFER_QUEUED)
+	    continue;
+	if (!(conn = ftpfs_pool_get (me, super))) {
+	    /* Nothing would ever start them */
+	    if (!running)
+		ftpfs_xfer_finish (me, super, x, XFER_FAILED);
+	    continue;
+	}
+	if (ftpfs_xfer_start (me, super, x, conn) == -1)
+	    ftpfs_xfer_finish (me, super, x, XFER_FAILED);
+	else
+	    running++;
+    }
+}
+
+static void
+ftpfs_xfer_read (struct vfs_class *me, struct vfs_s_super *super,
+		 struct ftpfs_xfer *x)
+{
+    char buf[8192];
+    ssize_t n, want = sizeof (buf);
+    struct ftpfs_conn *conn = x->conn;
+
+    if (x->end != -1)
+	want = MIN (want, x->end - x->offset - x->got);
+    n = read (x->sock, buf, want);
+    if (n < 0 && errno == EINTR)
+	return;
+
+    if (n > 0) {
+	if (write (x->fd, buf, n) != n) {
+	    ftpfs_xfer_finish (me, super, x, XFER_FAILED);
+	    return;
+	}
+	x->got += n;
+	if (x->end == -1 || x->offset + x->got < x->end)
+	    return;
+	/* The rest belongs to the next range */
+	ftpfs_xfer_finish (me, super, x, XFER_DONE);
+	return;
+    }
+
+    close (x->sock);
+    x->sock = -1;
+    x->conn = NULL;
+    if (n == 0 && ftpfs_get_reply (me, conn->sock, NULL, 0) == COMPLETE) {
+	ftpfs_pool_put (super, conn);
+	ftpfs_xfer_finish (me, super, x, XFER_DONE);
+    } else {
+	ftpfs_pool_drop (super, conn);
+	ftpfs_xfer_finish (me, super, x, XFER_FAILED);
+    }
+}
+
+/* Move what has arrived for the running transfers to their local
+   files, waiting at most msec for anything to arrive, and start the
+   queued ones.  Returns -1 if interrupted */
+static int
+ftpfs_pool_pump (struct vfs_class *me, struct vfs_s_super *super, int msec)
+{
+    struct ftpfs_xfer *x, *next;
+    struct timeval tv;
+    fd_set mask;
+    int n, maxfd = -1;
+
+    ftpfs_pool_start (me, super);
+
+    FD_ZERO (&mask);
+    for (x = SUP.xfers; x; x = x->next)
+	if (x->state == XFER_RUNNING) {
+	    FD_SET (x->sock, &mask);
+	    maxfd = MAX (maxfd, x->sock);
+	}
+    if (maxfd == -1)
+	return 0;
+
+    tv.tv_sec = msec / 1000;
+    tv.tv_usec = (msec % 1000) * 1000;
+    enable_interrupt_key ();
+    n = select (maxfd + 1, &mask, NULL, NULL, &tv);
+    if (n < 0 && errno == EINTR && got_interrupt ()) {
+	disable_interrupt_key ();
+	return -1;
+    }
+    disable_interrupt_key ();
+
+    if (n > 0)
+	for (x = SUP.xfers; x; x = next) {
+	    next = x->next;
+	    if (x->state == XFER_RUNNING && FD_ISSET (x->sock, &mask))
+		ftpfs_xfer_read (me, super, x);
+	}
+
+    ftpfs_pool_start (me, super);
+    return 0;
+}
+
+/* Wait for the file fetched ahead on an extra connection.  Returns 1
+   if it has become the local copy */
+static int
+ftpfs_pool_wait (struct vfs_class *me, struct vfs_s_super *super,
+		 struct vfs_s_inode *ino)
+{
+    struct ftpfs_xfer *x;
+
+    for (;;) {
+	for (x = SUP.xfers; x; x = x->next)
+	    if (x->ino == ino && !x->split)
+		break;
+	if (!x)
+	    return ino->localname != NULL;
+	if (x->state == XFER_QUEUED) {
+	    /* Rather than wait for a connection, use the main one */
+	    ftpfs_xfer_finish (me, super, x, XFER_FAILED);
+	    return 0;
+	}
+	print_vfs_message (_("ftpfs: Getting file %s: %lu bytes transferred"),
+			   ino->ent ? ino->ent->name : "",
+			   (unsigned long) x->got);
+	if (ftpfs_pool_pump (me, super, 1000) == -1)
+	    return 0;
+    }
+}
+
+/* Stop all transfers on extra connections and close them */
+static void
+ftpfs_pool_free (struct vfs_class *me, struct vfs_s_super *super)
+{
+    struct ftpfs_conn *conn;
+
+    while (SUP.xfers) {
+	SUP.xfers->split = 0;
+	ftpfs_xfer_free (me, super, SUP.xfers);
+    }
+    while ((conn = SUP.idle) != NULL) {
+	SUP.idle = conn->next;
+	ftpfs_pool_swap (super, conn);
+	ftpfs_command (me, super, NONE, "QUIT");
+	ftpfs_pool_swap (super, conn);
+	ftpfs_pool_drop (super, conn);
+    }
+}
+
+/* Fetch a big file in ranges, one per extra connection.  NULL if
+   there are not enough of them, or if the server would not start
+   every range */
+static struct ftpfs_split *
+ftpfs_split_start (struct vfs_class *me, struct vfs_s_super *super,
+		   struct vfs_s_inode *ino)
+{
+    struct ftpfs_split *s;
+    struct ftpfs_xfer *x;
+    off_t size = ino->st.st_size, chunk;
+    int i, n, h;
+
+    n = MIN (ftpfs_max_connections - 1, FTPFS_SPLIT_MAX);
+    n = MIN (n, size / FTPFS_SPLIT_SIZE);
+    if (n < 2 || SUP.conns_refused || !ino->ent)
+	return NULL;
+
+    s = g_new0 (struct ftpfs_split, 1);
+    h = vfs_mkstemps (&s->localname, me->name, ino->ent->name);
+    if (h == -1) {
+	g_free (s);
+	return NULL;
+    }
+    close (h);
+
+    /* Before anything fetched ahead */
+    chunk = size / n;
+    for (i = n - 1; i >= 0; i--) {
+	x = ftpfs_xfer_new (ino, s->localname, i * chunk,
+			    i == n - 1 ? -1 : (i + 1) * chunk);
+	x->split = 1;
+	x->next = SUP.xfers;
+	SUP.xfers = x;
+	s->part[i] = x;
+    }
+    s->count = n;
+    ftpfs_pool_start (me, super);
+
+    s->fd = open (s->localname, O_RDONLY);
+    for (i = 0; i < n; i++)
+	if (s->part[i]->state != XFER_RUNNING)
+	    break;
+    if (s->fd == -1 || i < n) {
+	if (s->fd != -1)
+	    close (s->fd);
+	for (i = 0; i < n; i++)
+	    ftpfs_xfer_free (me, super, s->part[i]);
+	unlink (s->localname);
+	g_free (s->localname);
+	g_free (s);
+	return NULL;
+    }
+    return s;
+}
+
+/* The whole file is kept as its local copy */
+static void
+ftpfs_split_close (struct vfs_class *me, struct vfs_s_fh *fh)
+{
+    struct vfs_s_super *super = FH_SUPER;
+    struct ftpfs_split *s = fh->u.ftp.split;
+    int i;
+
+    for (i = 0; i < s->count; i++)
+	ftpfs_xfer_free (me, super, s->part[i]);
+    close (s->fd);
+    if (s->eof && !fh->ino->localname)
+	fh->ino->localname = s->localname;
+    else {
+	unlink (s->localname);
+	g_free (s->localname);
+    }
+    g_free (s);
+    fh->u.ftp.split = NULL;
+}
+
+static int ftpfs_linear_read (struct vfs_class *me, struct vfs_s_fh *fh,
+			      void *buf, int len);
+
+/* A range failed, or ended before it should have.  Give up the split
+   and read the rest of the file on the main connection */
+static int
+ftpfs_split_fallback (struct vfs_class *me, struct vfs_s_fh *fh)
+{
+    struct vfs_s_super *super = FH_SUPER;
+    off_t pos = fh->u.ftp.split->pos;
+    char *name, buf[8192];
+    ssize_t n;
+
+    fh->u.ftp.split->eof = 0;	/* not a complete local copy */
+    ftpfs_split_close (me, fh);
+
+    if (!(name = vfs_s_fullpath (me, fh->ino)))
+	ERRNOR (E_REMOTE, -1);
+    FH_SOCK = ftpfs_open_data_connection (me, super, "RETR", name,
+					  TYPE_BINARY, pos);
+    if (FH_SOCK == -1 && pos > 0) {
+	/* No REST, skip what has been read already */
+	FH_SOCK = ftpfs_open_data_connection (me, super, "RETR", name,
+					      TYPE_BINARY, 0);
+	SUP.ctl_connection_busy = 1;
+	while (FH_SOCK != -1 && pos > 0) {
+	    n = read (FH_SOCK, buf, MIN ((off_t) sizeof (buf), pos));
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    if (n <= 0)
+		ftpfs_linear_abort (me, fh);
+	    else
+		pos -= n;
+	}
+    }
+    g_free (name);
+    if (FH_SOCK == -1)
+	ERRNOR (E_REMOTE, -1);
+    SUP.ctl_connection_busy = 1;
+    return 0;
+}
+
+static int
+ftpfs_split_read (struct vfs_class *me, struct vfs_s_fh *fh, void *buf,
+		  int len)
+{
+    struct vfs_s_super *super = FH_SUPER;
+    struct ftpfs_split *s = fh->u.ftp.split;
+    struct ftpfs_xfer *x;
+    off_t avail;
+    int i, n;
+
+    for (;;) {
+	for (i = s->count - 1; i > 0; i--)
+	    if (s->part[i]->offset <= s->pos)
+		break;
+	x = s->part[i];
+	avail = x->offset + x->got - s->pos;
+	if (avail > 0)
+	    break;
+	if (x->state == XFER_DONE && x->end == -1) {
+	    s->eof = 1;
+	    return 0;
+	}
+	if (x->state == XFER_DONE || x->state == XFER_FAILED) {
+	    if (ftpfs_split_fallback (me, fh) == -1)
+		return -1;
+	    return ftpfs_linear_read (me, fh, buf, len);
+	}
+	if (ftpfs_pool_pump (me, super, 1000) == -1)
+	    ERRNOR (EINTR, -1);
+    }
+
+    if (lseek (s->fd, s->pos, SEEK_SET) == -1
+	|| (n = read (s->fd, buf, MIN (len, avail))) < 0)
+	ERRNOR (errno, -1);
+    s->pos += n;
+
+    /* Keep the others going */
+    if (ftpfs_pool_pump (me, super, 0) == -1)
+	ERRNOR (EINTR, -1);
+    return n;
+}
+
 #if 0
 static void
 resolve_symlink_without_ls_options(struct vfs_class *me, struct vfs_s_super *super, struct vfs_s_inode *dir)
@@ -1193,8 +1789,169 @@ resolve_symlink(struct vfs_class *me, struct vfs_s_super *super, struct vfs_s_in
 }
 #endif
 
+/* "modify" fact of MLSD: YYYYMMDDHHMMSS[.sss] in UTC */
+static time_t
+ftpfs_mlsd_time (const char *s)
+{
+    static const int yday[12] =
+	{ 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+    int y, mo, d, h, mi, sec;
+    long days;
+
+    if (sscanf (s, "%4d%2d%2d%2d%2d%2d", &y, &mo, &d, &h, &mi, &sec) != 6
+	|| y < 1970 || mo < 1 || mo > 12)
+	return 0;
+
+    /* Leap days of the years before, then of this one */
+    days = (y - 1970) * 365L + (y - 1969) / 4 - (y - 1901) / 100
+	+ (y - 1601) / 400 + yday[mo - 1] + d - 1;
+    if (mo > 2 && y % 4 == 0 && (y % 100 != 0 || y % 400 == 0))
+	days++;
+    return ((days * 24 + h) * 60 + mi) * 60 + sec;
+}
+
+/* Make an entry of a line of MLSD output: "fact=value;...; name".
+   NULL for "." and "..", or if the line makes no sense */
+static struct vfs_s_entry *
+ftpfs_parse_mlsd (struct vfs_class *me, struct vfs_s_inode *dir, char *line)
+{
+    struct vfs_s_entry *ent;
+    struct stat *st;
+    char *name, *fact, *next, *value, *linkname = NULL;
+    mode_t type = S_IFREG;
+    int mode = -1, uid = -1, gid = -1;
+    off_t size = 0;
+    time_t mtime = 0;
+
+    if (!(name = strchr (line, ' ')))
+	return NULL;
+    *name++ = '\0';
+    if ((next = strchr (name, '\r')) != NULL)
+	*next = '\0';
+
+    for (fact = line; *fact; fact = next) {
+	if ((next = strchr (fact, ';')) != NULL)
+	    *next++ = '\0';
+	else
+	    next = fact + strlen (fact);
+	if (!(value = strchr (fact, '=')))
+	    continue;
+	*value++ = '\0';
+
+	if (!g_strcasecmp (fact, "type")) {
+	    if (!g_strcasecmp (value, "cdir") || !g_strcasecmp (value, "pdir"))
+		return NULL;
+	    if (!g_strcasecmp (value, "dir"))
+		type = S_IFDIR;
+	    else if (!g_strncasecmp (value, "OS.unix=slink:", 14)) {
+		type = S_IFLNK;
+		linkname = value + 14;
+	    }
+	} else if (!g_strcasecmp (fact, "size"))
+#ifdef HAVE_ATOLL
+	    size = (off_t) atoll (value);
+#else
+	    size = (off_t) atof (value);
+#endif
+	else if (!g_strcasecmp (fact, "modify"))
+	    mtime = ftpfs_mlsd_time (value);
+	else if (!g_strcasecmp (fact, "UNIX.mode"))
+	    mode = strtol (value, NULL, 8);
+	else if (!g_strcasecmp (fact, "UNIX.uid")
+		 || !g_strcasecmp (fact, "UNIX.owner"))
+	    uid = isdigit ((unsigned char) *value) ? atoi (value)
+		: vfs_finduid (value);
+	else if (!g_strcasecmp (fact, "UNIX.gid")
+		 || !g_strcasecmp (fact, "UNIX.group"))
+	    gid = isdigit ((unsigned char) *value) ? atoi (value)
+		: vfs_findgid (value);
+    }
+
+    /* Some servers give the whole path */
+    if (strrchr (name, '/'))
+	name = strrchr (name, '/') + 1;
+    if (!*name || !strcmp (name, ".") || !strcmp (name, ".."))
+	return NULL;
+
+    ent = vfs_s_generate_entry (me, name, dir,
+				type | (type == S_IFREG ? 0666 : 0777));
+    st = &ent->ino->st;
+    if (mode != -1)
+	st->st_mode = type | (mode & 07777);
+    st->st_size = size;
+    if (mtime)
+	st->st_mtime = st->st_atime = st->st_ctime = mtime;
+    if (uid != -1)
+	st->st_uid = uid;
+    if (gid != -1)
+	st->st_gid = gid;
+    if (linkname)
+	ent->ino->linkname = g_strdup (linkname);
+    return ent;
+}
+
+/* Returns 1 if LIST should be used instead */
 static int
-ftpfs_dir_load (struct vfs_class *me, struct vfs_s_inode *dir, char *remote_path)
+ftpfs_dir_load_mlsd (struct vfs_class *me, struct vfs_s_inode *dir,
+		     char *remote_path)
+{
+    struct vfs_s_entry *ent;
+    struct vfs_s_super *super = dir->super;
+    int sock, num_entries = 0;
+    char buffer[BUF_8K];
+
+    print_vfs_message (_("ftpfs: Reading FTP directory %s..."), remote_path);
+
+    gettimeofday (&dir->timestamp, NULL);
+    dir->timestamp.tv_sec += ftpfs_directory_timeout;
+    sock = ftpfs_open_data_connection (me, super, "MLSD", remote_path,
+				       TYPE_ASCII, 0);
+    if (sock == -1) {
+	/* Not understood after all */
+	if (code / 100 == 5 && code != 550)
+	    SUP.use_mlsd = 0;
+	return 1;
+    }
+
+    while (1) {
+	int res =
+	    vfs_s_get_line_interruptible (me, buffer, sizeof (buffer),
+					  sock);
+	if (!res)
+	    break;
+
+	if (res == EINTR) {
+	    me->verrno = ECONNRESET;
+	    close (sock);
+	    ftpfs_get_reply (me, SUP.sock, NULL, 0);
+	    print_vfs_message (_("%s: failure"), me->name);
+	    return -1;
+	}
+
+	if (MEDATA->logfile) {
+	    fputs (buffer, MEDATA->logfile);
+	    fputs ("\n", MEDATA->logfile);
+	    fflush (MEDATA->logfile);
+	}
+
+	if (!(ent = ftpfs_parse_mlsd (me, dir, buffer)))
+	    continue;
+	vfs_s_insert_entry (me, dir, ent);
+	if (!(++num_entries % 1000))
+	    print_vfs_message (_("ftpfs: Reading FTP directory %s... %d"),
+			       remote_path, num_entries);
+    }
+
+    close (sock);
+    if (ftpfs_get_reply (me, SUP.sock, NULL, 0) != COMPLETE)
+	ERRNOR (E_REMOTE, -1);
+
+    print_vfs_message (_("%s: done."), me->name);
+    return 0;
+}
+
+static int
+ftpfs_dir_load_int (struct vfs_class *me, struct vfs_s_inode *dir, char *remote_path)
 {
     struct vfs_s_entry *ent;
     struct vfs_s_super *super = dir->super;
@@ -1202,6 +1959,11 @@ ftpfs_dir_load (struct vfs_class *me, struct vfs_s_inode *dir, char *remote_path
     char buffer[BUF_8K];
     int cd_first;
 
+    if (SUP.use_mlsd
+	&& (num_entries = ftpfs_dir_load_mlsd (me, dir, remote_path)) != 1)
+	return num_entries;
+    num_entries = 0;
+
     cd_first = ftpfs_first_cd_then_ls || (SUP.strict == RFC_STRICT)
 	|| (strchr (remote_path, ' ') != NULL);
 
@@ -1316,6 +2078,24 @@ ftpfs_dir_load (struct vfs_class *me, struct vfs_s_inode *dir, char *remote_path
     ERRNOR (EACCES, -1);
 }
 
+static int
+ftpfs_dir_load (struct vfs_class *me, struct vfs_s_inode *dir, char *remote_path)
+{
+    struct vfs_s_super *super = dir->super;
+    struct ftpfs_conn *conn;
+    int result;
+
+    /* Don't get in the way of a transfer on the main connection */
+    if (!SUP.ctl_connection_busy || !(conn = ftpfs_pool_get (me, super)))
+	return ftpfs_dir_load_int (me, dir, remote_path);
+
+    ftpfs_pool_swap (super, conn);
+    result = ftpfs_dir_load_int (me, dir, remote_path);
+    ftpfs_pool_swap (super, conn);
+    ftpfs_pool_put (super, conn);
+    return result;
+}
+
 static int
 ftpfs_file_store (struct vfs_class *me, struct vfs_s_fh *fh, char *name,
 		  char *localname)
@@ -1400,8 +2180,35 @@ ftpfs_file_store (struct vfs_class *me, struct vfs_s_fh *fh, char *name,
 static int 
 ftpfs_linear_start (struct vfs_class *me, struct vfs_s_fh *fh, off_t offset)
 {
-    char *name = vfs_s_fullpath (me, fh->ino);
+    struct vfs_s_super *super = FH_SUPER;
+    char *name;
+
+    fh->u.ftp.split = NULL;
+
+    /* The file may have been fetched ahead.  A local copy vfs_s_open()
+       has opened is at the right offset already */
+    if (fh->handle == -1 && !fh->ino->localname
+	&& ftpfs_pool_wait (me, super, fh->ino)) {
+	fh->handle = open (fh->ino->localname, O_RDONLY);
+	if (fh->handle != -1 && lseek (fh->handle, offset, SEEK_SET) == -1) {
+	    close (fh->handle);
+	    fh->handle = -1;
+	}
+    }
+    if (fh->handle != -1) {
+	fh->linear = LS_NOT_LINEAR;
+	return 1;
+    }
 
+    if (offset == 0
+	&& (fh->u.ftp.split = ftpfs_split_start (me, super, fh->ino))) {
+	FH_SOCK = -1;
+	fh->linear = LS_LINEAR_OPEN;
+	fh->u.ftp.append = 0;
+	return 1;
+    }
+
+    name = vfs_s_fullpath (me, fh->ino);
     if (!name)
 	return 0;
     FH_SOCK = ftpfs_open_data_connection(me, FH_SUPER, "RETR", name, TYPE_BINARY, offset);
@@ -1420,6 +2227,13 @@ ftpfs_linear_read (struct vfs_class *me, struct vfs_s_fh *fh, void *buf, int len
     int n;
     struct vfs_s_super *super = FH_SUPER;
 
+    if (fh->u.ftp.split)
+	return ftpfs_split_read (me, fh, buf, len);
+
+    /* Keep the transfers on the other connections going */
+    if (SUP.xfers)
+	ftpfs_pool_pump (me, super, 0);
+
     enable_interrupt_key();
     while ((n = read (FH_SOCK, buf, len))<0) {
         if ((errno == EINTR) && !got_interrupt())
@@ -1445,7 +2259,9 @@ ftpfs_linear_read (struct vfs_class *me, struct vfs_s_fh *fh, void *buf, int len
 static void
 ftpfs_linear_close (struct vfs_class *me, struct vfs_s_fh *fh)
 {
-    if (FH_SOCK != -1)
+    if (fh->u.ftp.split)
+	ftpfs_split_close (me, fh);
+    else if (FH_SOCK != -1)
         ftpfs_linear_abort(me, fh);
 }
 
@@ -1458,9 +2274,13 @@ static int ftpfs_ctl (void *fh, int ctlop, void *arg)
 	    {
 	        int v;
 		
+		/* A local copy has taken the place of the transfer */
+		if (!FH->linear && FH->handle != -1)
+		    return 0;
 		if (!FH->linear)
 		    vfs_die ("You may not do this");
-		if (FH->linear == LS_LINEAR_CLOSED || FH->linear == LS_LINEAR_PREOPEN)
+		if (FH->linear == LS_LINEAR_CLOSED || FH->linear == LS_LINEAR_PREOPEN
+		    || FH->u.ftp.split)
 		    return 0;
 
 		v = vfs_s_select_on_two (FH->u.ftp.sock, 0);
@@ -1685,6 +2505,62 @@ static int ftpfs_fh_close (struct vfs_class *me, struct vfs_s_fh *fh)
     return 0;
 }
 
+/* Fetch the marked files ahead on extra connections */
+static int
+ftpfs_setctl (struct vfs_class *me, const char *path, int ctlop, void *arg)
+{
+    char **names = arg;
+    struct vfs_s_super *super;
+    struct vfs_s_inode *ino;
+    struct ftpfs_xfer *x, **tail;
+    const char *crpath;
+    char *mpath, *name, *localname;
+    int h, n = 0;
+
+    if (ctlop != VFS_SETCTL_PREFETCH)
+	return vfs_s_setctl (me, path, ctlop, arg);
+    if (ftpfs_max_connections < 2)
+	return 0;
+
+    mpath = g_strdup (path);
+    if (!(crpath = vfs_s_get_path_mangle (me, mpath, &super, 0))
+	|| SUP.conns_refused) {
+	g_free (mpath);
+	return 0;
+    }
+
+    for (tail = &SUP.xfers; *tail; tail = &(*tail)->next)
+	n++;
+    for (; *names && n < FTPFS_PREFETCH_MAX; names++) {
+	name = *crpath ? g_strconcat (crpath, PATH_SEP_STR, *names,
+				      (char *) NULL) : g_strdup (*names);
+	ino = vfs_s_find_inode (me, super, name, LINK_NO_FOLLOW, FL_NONE);
+	g_free (name);
+	if (ino == NULL || !S_ISREG (ino->st.st_mode) || ino->localname
+	    || ino->st.st_size > FTPFS_PREFETCH_SIZE || !ino->ent)
+	    continue;
+	for (x = SUP.xfers; x; x = x->next)
+	    if (x->ino == ino)
+		break;
+	if (x)
+	    continue;
+
+	localname = NULL;
+	h = vfs_mkstemps (&localname, me->name, ino->ent->name);
+	if (h == -1)
+	    break;
+	close (h);
+	*tail = ftpfs_xfer_new (ino, localname, 0, -1);
+	tail = &(*tail)->next;
+	g_free (localname);
+	n++;
+    }
+    g_free (mpath);
+
+    ftpfs_pool_start (me, super);
+    return 1;
+}
+
 static void
 ftpfs_done (struct vfs_class *me)
 {
@@ -2015,5 +2891,6 @@ init_ftpfs (void)
     vfs_ftpfs_ops.mkdir = ftpfs_mkdir;
     vfs_ftpfs_ops.rmdir = ftpfs_rmdir;
     vfs_ftpfs_ops.ctl = ftpfs_ctl;
+    vfs_ftpfs_ops.setctl = ftpfs_setctl;
     vfs_register_class (&vfs_ftpfs_ops);
 }
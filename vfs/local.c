@@ -286,6 +286,18 @@ local_ungetlocalcopy (struct vfs_class *me, const char *path,
     return 0;
 }
 
+static int
+local_ctl (void *data, int ctlop, void *arg)
+{
+    switch (ctlop) {
+    case VFS_CTL_GETFD:
+	*(int *) arg = * (int *) data;
+	return 1;
+    default:
+	return 0;
+    }
+}
+
 static int
 local_which (struct vfs_class *me, const char *path)
 {
@@ -321,6 +333,7 @@ init_localfs (void)
     vfs_local_ops.rename = local_rename;
     vfs_local_ops.chdir = local_chdir;
     vfs_local_ops.ferrno = local_errno;
+    vfs_local_ops.ctl = local_ctl;
     vfs_local_ops.lseek = local_lseek;
     vfs_local_ops.mknod = local_mknod;
     vfs_local_ops.getlocalcopy = local_getlocalcopy;
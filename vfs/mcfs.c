@@ -36,6 +36,7 @@
 #include <netdb.h>		/* struct hostent */
 #include <sys/socket.h>		/* AF_INET */
 #include <netinet/in.h>		/* struct in_addr */
+#include <netinet/tcp.h>	/* TCP_NODELAY */
 #ifdef HAVE_ARPA_INET_H
 #include <arpa/inet.h>
 #endif
@@ -65,6 +66,11 @@
 
 #define MCFS_MAX_CONNECTIONS 32
 
+/* Files open for reading are read ahead with up to this many requests
+   of this size on the wire at once */
+#define MCFS_READ_AHEAD 8
+#define MCFS_READ_CHUNK 32768
+
 static struct _mcfs_connection {
     char *host;
     char *user;
@@ -72,6 +78,7 @@ static struct _mcfs_connection {
     int sock;
     int port;
     int version;
+    struct _mcfs_handle *reading;	/* Has reads in flight */
 } mcfs_connections[MCFS_MAX_CONNECTIONS];
 
 
@@ -79,9 +86,17 @@ static struct _mcfs_connection {
 
 typedef struct _mcfs_connection mcfs_connection;
 
-typedef struct {
+typedef struct _mcfs_handle {
     int handle;
     mcfs_connection *conn;
+    int read_ahead;		/* Opened read-only */
+    int ahead;			/* Reads sent, not answered yet */
+    int window;			/* How many to send, grows up to
+				   MCFS_READ_AHEAD while they come back full */
+    int eof;
+    int error;			/* errno of a read sent ahead */
+    char *buf;			/* Data that came in ahead */
+    int buf_pos, buf_len;
 } mcfs_handle;
 
 static char *mcfs_gethome (mcfs_connection * mc);
@@ -129,9 +144,12 @@ mcfs_login_server (int my_socket, char *user, int port,
 	return 0;
 
     if (result != MC_VERSION_OK) {
+	close (my_socket);
+	/* Let the caller try the oldest version */
+	if (*version > 1)
+	    return -1;
 	message (1, _(" MCFS "),
 		    _(" The server does not support this version "));
-	close (my_socket);
 	return 0;
     }
 
@@ -207,7 +225,7 @@ mcfs_get_remote_port (struct sockaddr_in *sin, int *version)
 	if (port = pmap_getport (sin, RPC_PROGNUM, *version, IPPROTO_TCP))
 	    return port;
 #endif				/* HAVE_PMAP_GETPORT */
-    *version = 1;
+    *version = RPC_PROGVER;
     return mcserver_port;
 #endif				/* HAVE_PMAP_GETMAPS */
 }
@@ -248,7 +266,7 @@ mcfs_create_tcp_link (const char *host, int *port, int *version, const char *cal
 	if (*port < 1)
 	    return 0;
     } else
-	*version = 1;
+	*version = RPC_PROGVER;
 
     server_address.sin_port = htons (*port);
 
@@ -264,6 +282,14 @@ mcfs_create_tcp_link (const char *host, int *port, int *version, const char *cal
 	close (my_socket);
 	return 0;
     }
+#ifdef TCP_NODELAY
+    {
+	/* Requests are small and sent ahead of the replies */
+	int yes = 1;
+	setsockopt (my_socket, IPPROTO_TCP, TCP_NODELAY, (char *) &yes,
+		    sizeof (yes));
+    }
+#endif
     return my_socket;
 }
 
@@ -282,8 +308,19 @@ mcfs_open_tcp_link (char *host, char *user,
        implements our version of the RPC mechanism and then login
        the user.
      */
-    return mcfs_login_server (my_socket, user, *port, old_port == 0,
-			      netrcpass, version);
+    my_socket = mcfs_login_server (my_socket, user, *port, old_port == 0,
+				   netrcpass, version);
+    if (my_socket != -1)
+	return my_socket;
+
+    /* An old server, which only knows version 1 for sure */
+    my_socket = mcfs_create_tcp_link (host, port, version, " MCfs ");
+    if (my_socket <= 0)
+	return 0;
+    *version = 1;
+    my_socket = mcfs_login_server (my_socket, user, *port, old_port == 0,
+				   netrcpass, version);
+    return my_socket == -1 ? 0 : my_socket;
 }
 
 static int mcfs_get_free_bucket_init = 1;
@@ -346,6 +383,7 @@ mcfs_open_link (char *host, char *user, int *port, char *netrcpass)
     bucket->port = *port;
     bucket->sock = sock;
     bucket->version = version;
+    bucket->reading = NULL;
 
     return bucket;
 }
@@ -370,6 +408,51 @@ mcfs_set_error (int result, int errno_num)
     return result;
 }
 
+/* Takes in the answer to a read sent ahead */
+static int
+mcfs_read_reply (mcfs_handle *h)
+{
+    int result, error;
+    int sock = h->conn->sock;
+
+    h->ahead--;
+    if (!rpc_get (sock, RPC_INT, &result, RPC_INT, &error, RPC_END))
+	goto fail;
+
+    if (result <= 0) {
+	h->eof = 1;
+	if (result < 0 && !h->error)
+	    h->error = error;
+	return 1;
+    }
+
+    if (!rpc_get (sock, RPC_BLOCK, result, h->buf + h->buf_len, RPC_END))
+	goto fail;
+    h->buf_len += result;
+    if (result == MCFS_READ_CHUNK && h->window < MCFS_READ_AHEAD)
+	h->window *= 2;
+    return 1;
+
+  fail:
+    h->ahead = 0;
+    h->eof = 1;
+    h->error = EIO;
+    return 0;
+}
+
+/* Answers come in the order of the requests, so the reads in flight
+   are taken in before anything else is asked on the connection.  The
+   data is kept for the handle they were sent for */
+static void
+mcfs_sync (mcfs_connection *mc)
+{
+    mcfs_handle *h = mc->reading;
+
+    mc->reading = NULL;
+    while (h && h->ahead)
+	mcfs_read_reply (h);
+}
+
 static char *
 mcfs_get_path (mcfs_connection **mc, const char *path)
 {
@@ -400,6 +483,8 @@ mcfs_get_path (mcfs_connection **mc, const char *path)
     if (!remote_path)
 	return NULL;
 
+    mcfs_sync (*mc);
+
     /* NOTE: tildes are deprecated. See ftpfs.c */
     {
 	int f = !strcmp (remote_path, "/~");
@@ -543,13 +628,57 @@ mcfs_open (struct vfs_class *me, const char *file, int flags, int mode)
     if (mcfs_is_error (result, error_num))
 	return 0;
 
-    remote_handle = g_new (mcfs_handle, 2);
+    remote_handle = g_new0 (mcfs_handle, 1);
     remote_handle->handle = result;
     remote_handle->conn = mc;
+    if ((flags & O_ACCMODE) == O_RDONLY) {
+	remote_handle->read_ahead = 1;
+	remote_handle->window = 1;
+	remote_handle->buf = g_malloc (MCFS_READ_AHEAD * MCFS_READ_CHUNK);
+    }
 
     return remote_handle;
 }
 
+/* Keeps several reads on the wire, so that a copy is not slowed down
+   by waiting for each answer in turn */
+static int
+mcfs_read_ahead (mcfs_handle *info, char *buffer, int count)
+{
+    mcfs_connection *mc = info->conn;
+
+    if (mc->reading != info)
+	mcfs_sync (mc);
+
+    if (info->buf_pos == info->buf_len) {
+	info->buf_pos = info->buf_len = 0;
+	while (!info->eof && info->ahead < info->window) {
+	    rpc_send (mc->sock, RPC_INT, MC_READ, RPC_INT, info->handle,
+		      RPC_INT, MCFS_READ_CHUNK, RPC_END);
+	    info->ahead++;
+	}
+	if (info->ahead) {
+	    mc->reading = info;
+	    mcfs_read_reply (info);
+	}
+    }
+
+    if (info->buf_pos == info->buf_len) {
+	if (info->error) {
+	    my_errno = info->error;
+	    info->error = 0;
+	    return -1;
+	}
+	return 0;
+    }
+
+    if (count > info->buf_len - info->buf_pos)
+	count = info->buf_len - info->buf_pos;
+    memcpy (buffer, info->buf + info->buf_pos, count);
+    info->buf_pos += count;
+    return count;
+}
+
 static int
 mcfs_read (void *data, char *buffer, int count)
 {
@@ -558,8 +687,12 @@ mcfs_read (void *data, char *buffer, int count)
     int handle;
     mcfs_connection *mc;
 
+    if (info->read_ahead)
+	return mcfs_read_ahead (info, buffer, count);
+
     mc = info->conn;
     handle = info->handle;
+    mcfs_sync (mc);
 
     rpc_send (mc->sock, RPC_INT, MC_READ, RPC_INT, handle,
 	      RPC_INT, count, RPC_END);
@@ -586,6 +719,7 @@ mcfs_write (void *data, const char *buf, int nbyte)
 
     mc = info->conn;
     handle = info->handle;
+    mcfs_sync (mc);
 
     rpc_send (mc->sock,
 	      RPC_INT, MC_WRITE,
@@ -607,6 +741,9 @@ mcfs_close (void *data)
 
     handle = info->handle;
     mc = info->conn;
+    mcfs_sync (mc);
+    g_free (info->buf);
+    g_free (data);
 
     rpc_send (mc->sock, RPC_INT, MC_CLOSE, RPC_INT, handle, RPC_END);
 
@@ -616,7 +753,6 @@ mcfs_close (void *data)
 
     mcfs_is_error (result, error);
 
-    g_free (data);
     return result;
 }
 
@@ -637,11 +773,118 @@ typedef struct dir_entry {
 
 typedef struct {
     mcfs_connection *conn;
-    int handle;
+    int handle;			/* 0 if the listing came with MC_READDIRPLUS */
     dir_entry *entries;
     dir_entry *current;
 } opendir_info;
 
+static int mcfs_get_stat_info (mcfs_connection * mc, struct stat *buf);
+static void mcfs_free_dir (dir_entry *de);
+
+/* 32 bits in network order from the MC_READDIRPLUS block */
+static int
+mcfs_get_plus_int (unsigned char **p, unsigned char *end, long *n)
+{
+    unsigned char *b = *p;
+
+    if (end - b < 4)
+	return 0;
+    *n = (long) ((unsigned long) b[0] << 24 | (unsigned long) b[1] << 16
+		 | (unsigned long) b[2] << 8 | b[3]);
+    *p = b + 4;
+    return 1;
+}
+
+static int
+mcfs_get_plus_stat (unsigned char **p, unsigned char *end,
+		    struct stat *buf)
+{
+    long n[12];
+    int i;
+
+    for (i = 0; i < 12; i++)
+	if (!mcfs_get_plus_int (p, end, &n[i]))
+	    return 0;
+
+    buf->st_dev = 0;
+#ifdef HAVE_STRUCT_STAT_ST_RDEV
+    buf->st_rdev = n[0];
+#endif
+    buf->st_ino = n[1];
+    buf->st_mode = n[2];
+    buf->st_nlink = n[3];
+    buf->st_uid = n[4];
+    buf->st_gid = n[5];
+    buf->st_size = ((off_t) (unsigned long) n[6] << 16 << 16)
+	| (unsigned long) n[7];
+#ifdef HAVE_STRUCT_STAT_ST_BLOCKS
+    buf->st_blocks = n[8];
+#endif
+    buf->st_atime = (int) n[9];
+    buf->st_mtime = (int) n[10];
+    buf->st_ctime = (int) n[11];
+    return 1;
+}
+
+/* Gets the whole listing with the lstat information in one round trip.
+   Returns 0 on failure */
+static int
+mcfs_load_plus (opendir_info *mcfs_info, const char *remote_dir)
+{
+    int sock = mcfs_info->conn->sock;
+    int status, error, len;
+    unsigned char *block, *p, *end;
+    dir_entry **tail = &mcfs_info->entries;
+
+    rpc_send (sock, RPC_INT, MC_READDIRPLUS, RPC_STRING, remote_dir,
+	      RPC_END);
+
+    if (!rpc_get (sock, RPC_INT, &status, RPC_INT, &error, RPC_END)) {
+	mcfs_set_error (-1, EIO);
+	return 0;
+    }
+    if (mcfs_is_error (status, error))
+	return 0;
+
+    if (!rpc_get (sock, RPC_INT, &len, RPC_END) || len < 0) {
+	mcfs_set_error (-1, EIO);
+	return 0;
+    }
+    block = g_malloc (len + 1);
+    if (!rpc_get (sock, RPC_BLOCK, len, block, RPC_END)) {
+	g_free (block);
+	mcfs_set_error (-1, EIO);
+	return 0;
+    }
+
+    for (p = block, end = block + len; p < end;) {
+	long name_len, status, error;
+	dir_entry *new_entry;
+
+	if (!mcfs_get_plus_int (&p, end, &name_len)
+	    || name_len < 0 || end - p < name_len)
+	    break;
+
+	new_entry = g_new0 (dir_entry, 1);
+	new_entry->text = g_strndup ((char *) p, name_len);
+	p += name_len;
+	*tail = new_entry;
+	tail = &new_entry->next;
+
+	if (!mcfs_get_plus_int (&p, end, &status)
+	    || !mcfs_get_plus_int (&p, end, &error))
+	    break;
+	if (status < 0)
+	    new_entry->merrno = error;
+	else if (!mcfs_get_plus_stat (&p, end, &new_entry->my_stat))
+	    break;
+    }
+    g_free (block);
+
+    mcfs_info->current = mcfs_info->entries;
+    return 1;
+}
+
 static void *
 mcfs_opendir (struct vfs_class *me, const char *dirname)
 {
@@ -656,6 +899,19 @@ mcfs_opendir (struct vfs_class *me, const char *dirname)
     if (!(remote_dir = mcfs_get_path (&mc, dirname)))
 	return 0;
 
+    if (mc->version >= 3) {
+	mcfs_info = g_new0 (opendir_info, 1);
+	mcfs_info->conn = mc;
+	result = mcfs_load_plus (mcfs_info, remote_dir);
+	g_free (remote_dir);
+	if (!result) {
+	    mcfs_free_dir (mcfs_info->entries);
+	    g_free (mcfs_info);
+	    return 0;
+	}
+	return mcfs_info;
+    }
+
     rpc_send (mc->sock, RPC_INT, MC_OPENDIR, RPC_STRING, remote_dir,
 	      RPC_END);
     g_free (remote_dir);
@@ -678,8 +934,6 @@ mcfs_opendir (struct vfs_class *me, const char *dirname)
     return mcfs_info;
 }
 
-static int mcfs_get_stat_info (mcfs_connection * mc, struct stat *buf);
-
 static int
 mcfs_loaddir (opendir_info *mcfs_info)
 {
@@ -688,6 +942,7 @@ mcfs_loaddir (opendir_info *mcfs_info)
     int link = mc->sock;
     int first = 1;
 
+    mcfs_sync (mc);
     rpc_send (link, RPC_INT, MC_READDIR, RPC_INT, mcfs_info->handle,
 	      RPC_END);
 
@@ -760,7 +1015,7 @@ mcfs_readdir (void *info)
 
     mcfs_info = (opendir_info *) info;
 
-    if (!mcfs_info->entries)
+    if (!mcfs_info->entries && mcfs_info->handle)
 	if (!mcfs_loaddir (mcfs_info))
 	    return NULL;
 
@@ -786,8 +1041,9 @@ mcfs_closedir (void *info)
     opendir_info *mcfs_info = (opendir_info *) info;
     dir_entry *p, *q;
 
-    rpc_send (mcfs_info->conn->sock, RPC_INT, MC_CLOSEDIR,
-	      RPC_INT, mcfs_info->handle, RPC_END);
+    if (mcfs_info->handle)
+	rpc_send (mcfs_info->conn->sock, RPC_INT, MC_CLOSEDIR,
+		  RPC_INT, mcfs_info->handle, RPC_END);
 
     for (p = mcfs_info->entries; p;) {
 	q = p;
@@ -921,6 +1177,7 @@ mcfs_fstat (void *data, struct stat *buf)
     int result, error;
     int handle, sock;
 
+    mcfs_sync (info->conn);
     sock = info->conn->sock;
     handle = info->handle;
 
@@ -1074,9 +1331,17 @@ mcfs_lseek (void *data, off_t offset, int whence)
     mcfs_handle *info = (mcfs_handle *) data;
     int handle, sock;
 
+    mcfs_sync (info->conn);
     sock = info->conn->sock;
     handle = info->handle;
 
+    /* The server is ahead by what came in and was not read yet */
+    if (whence == SEEK_CUR)
+	offset -= info->buf_len - info->buf_pos;
+    info->buf_pos = info->buf_len = 0;
+    info->eof = info->error = 0;
+    info->window = 1;
+
     /* FIXME: off_t may be too long to fit */
     rpc_send (sock, RPC_INT, MC_LSEEK, RPC_INT, handle, RPC_INT,
 	      (int) offset, RPC_INT, whence, RPC_END);
@@ -1148,6 +1413,9 @@ mcfs_forget (const char *path)
 
 	    /* close socket: the child owns it now */
 	    close (mcfs_connections[i].sock);
+	    if (mcfs_connections[i].reading)
+		mcfs_connections[i].reading->ahead = 0;
+	    mcfs_connections[i].reading = NULL;
 
 	    /* reopen the connection */
 	    mcfs_connections[i].sock =
@@ -1220,6 +1488,9 @@ mcfs_free_bucket (int bucket)
     mcfs_connections[bucket].host =
 	mcfs_connections[bucket].user = mcfs_connections[bucket].home = 0;
     mcfs_connections[bucket].sock = mcfs_connections[bucket].version = 0;
+    if (mcfs_connections[bucket].reading)
+	mcfs_connections[bucket].reading->ahead = 0;
+    mcfs_connections[bucket].reading = NULL;
 }
 
 static int
@@ -5,7 +5,7 @@
 
 /* This number was registered for program "mcfs" with rpc@Sun.COM */
 #define RPC_PROGNUM 300516
-#define RPC_PROGVER 2
+#define RPC_PROGVER 3
 
 /* this constants must be kept in sync with mcserv.c commands */
 /* They are the messages sent on the link connection */
@@ -42,6 +42,9 @@ enum {
     MC_UTIME,			/* it has to go here for compatibility with old
 				   servers/clients. sigh ... */
 
+    MC_READDIRPLUS,		/* version 3: opendir, readdir with lstat
+				   and closedir in one go */
+
     MC_INVALID_PASS = 0x1000,
     MC_NEED_PASSWORD,
     MC_LOGINOK,
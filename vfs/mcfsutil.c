@@ -89,11 +89,40 @@ socket_write_block (int sock, const char *buffer, int len)
     return 1;
 }
 
+int (*rpc_read_block) (int sock, char *dest, int len) = socket_read_block;
+int (*rpc_write_block) (int sock, const char *buffer, int len) =
+    socket_write_block;
+
+/* A message is gathered here and goes out with one write, not one
+   write per argument */
+static char rpc_buffer[8192];
+static int rpc_buffer_len;
+
+static int
+rpc_put (int sock, const char *data, int len)
+{
+    int ok = 1;
+
+    if (rpc_buffer_len + len > (int) sizeof (rpc_buffer)) {
+	ok = (*rpc_write_block) (sock, rpc_buffer, rpc_buffer_len);
+	rpc_buffer_len = 0;
+	/* Big blocks are not copied */
+	if (ok && len > (int) sizeof (rpc_buffer))
+	    return (*rpc_write_block) (sock, data, len);
+    }
+    if (ok) {
+	memcpy (rpc_buffer + rpc_buffer_len, data, len);
+	rpc_buffer_len += len;
+    }
+    return ok;
+}
+
 int
 rpc_send (int sock, ...)
 {
     long int tmp, len, cmd;
     char *text;
+    int ok = 1;
     va_list ap;
 
     va_start (ap, sock);
@@ -103,30 +132,28 @@ rpc_send (int sock, ...)
 	switch (cmd) {
 	case RPC_END:
 	    va_end (ap);
-	    return 1;
+	    if (ok && rpc_buffer_len)
+		ok = (*rpc_write_block) (sock, rpc_buffer, rpc_buffer_len);
+	    rpc_buffer_len = 0;
+	    return ok;
 
 	case RPC_INT:
 	    tmp = htonl (va_arg (ap, int));
-	    write (sock, &tmp, sizeof (tmp));
-	    CHECK_SIG_PIPE (sock);
+	    ok = ok && rpc_put (sock, (char *) &tmp, sizeof (tmp));
 	    break;
 
 	case RPC_STRING:
 	    text = va_arg (ap, char *);
 	    len = strlen (text);
 	    tmp = htonl (len);
-	    write (sock, &tmp, sizeof (tmp));
-	    CHECK_SIG_PIPE (sock);
-	    write (sock, text, len);
-	    CHECK_SIG_PIPE (sock);
+	    ok = ok && rpc_put (sock, (char *) &tmp, sizeof (tmp));
+	    ok = ok && rpc_put (sock, text, len);
 	    break;
 
 	case RPC_BLOCK:
 	    len = va_arg (ap, int);
 	    text = va_arg (ap, char *);
-	    tmp = htonl (len);
-	    write (sock, text, len);
-	    CHECK_SIG_PIPE (sock);
+	    ok = ok && rpc_put (sock, text, len);
 	    break;
 
 	default:
@@ -153,7 +180,7 @@ rpc_get (int sock, ...)
 	    return 1;
 
 	case RPC_INT:
-	    if (socket_read_block (sock, (char *) &tmp, sizeof (tmp)) == 0) {
+	    if ((*rpc_read_block) (sock, (char *) &tmp, sizeof (tmp)) == 0) {
 		va_end (ap);
 		return 0;
 	    }
@@ -164,7 +191,7 @@ rpc_get (int sock, ...)
 	    /* returns an allocated string */
 	case RPC_LIMITED_STRING:
 	case RPC_STRING:
-	    if (socket_read_block (sock, (char *) &tmp, sizeof (tmp)) == 0) {
+	    if ((*rpc_read_block) (sock, (char *) &tmp, sizeof (tmp)) == 0) {
 		va_end (ap);
 		return 0;
 	    }
@@ -179,7 +206,7 @@ rpc_get (int sock, ...)
 
 	    /* Don't use glib functions here - this code is used by mcserv */
 	    text = malloc (len + 1);
-	    if (socket_read_block (sock, text, len) == 0) {
+	    if ((*rpc_read_block) (sock, text, len) == 0) {
 		free (text);
 		va_end (ap);
 		return 0;
@@ -193,7 +220,7 @@ rpc_get (int sock, ...)
 	case RPC_BLOCK:
 	    len = va_arg (ap, int);
 	    text = va_arg (ap, char *);
-	    if (socket_read_block (sock, text, len) == 0) {
+	    if ((*rpc_read_block) (sock, text, len) == 0) {
 		va_end (ap);
 		return 0;
 	    }
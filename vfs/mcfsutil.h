@@ -21,4 +21,9 @@ int rpc_send (int sock, ...);
 int socket_read_block (int sock, char *dest, int len);
 int socket_write_block (int sock, const char *buffer, int len);
 
+/* What rpc_get and rpc_send use for the socket I/O.  mcserv points them
+   at its own buffers when it serves several clients at once */
+extern int (*rpc_read_block) (int sock, char *dest, int len);
+extern int (*rpc_write_block) (int sock, const char *buffer, int len);
+
 #endif
@@ -62,7 +62,9 @@
 
 /* Network include files */
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #ifdef HAVE_ARPA_INET_H
 #include <arpa/inet.h>
@@ -165,6 +167,9 @@ int portnum = 0;
 /* if the server will use rcmd based authentication (hosts.equiv .rhosts) */
 int r_auth = 0;
 
+/* Serve all the clients of a user from one process */
+int multiplex = 0;
+
 #define OPENDIR_HANDLES 8
 
 #define DO_QUIT_VOID() \
@@ -187,6 +192,12 @@ int debug = 1;
 static int quit_server;
 static int return_code;
 
+/* The client being served when there are several */
+static struct mux_conn *mux_current;
+
+/* Which of them has the file handle open */
+static struct mux_conn *handle_owner[FD_SETSIZE];
+
 /* }}} */
 
 /* {{{ Misc routines */
@@ -198,6 +209,16 @@ send_status (int status, int errno_number)
     errno = 0;
 }
 
+/* Clients sharing the process only get at their own files */
+static int
+handle_ok (int handle)
+{
+    if (!mux_current)
+	return 1;
+    return handle >= 0 && handle < FD_SETSIZE
+	&& handle_owner[handle] == mux_current;
+}
+
 /* }}} */
 
 /* {{{ File with handle operations */
@@ -212,6 +233,14 @@ do_open (void)
 	     RPC_END);
 
     handle = open (arg, flags, mode);
+    if (handle != -1 && mux_current) {
+	if (handle >= FD_SETSIZE) {
+	    close (handle);
+	    handle = -1;
+	    errno = EMFILE;
+	} else
+	    handle_owner[handle] = mux_current;
+    }
     send_status (handle, errno);
     g_free (arg);
 }
@@ -219,15 +248,29 @@ do_open (void)
 static void
 do_read (void)
 {
+    /* Kept from one read to the next */
+    static char *data;
+    static int data_size;
     int handle, count, n;
-    void *data;
 
     rpc_get (msock, RPC_INT, &handle, RPC_INT, &count, RPC_END);
-    data = malloc (count);
-    if (!data) {
-	send_status (-1, ENOMEM);
+    if (!handle_ok (handle)) {
+	send_status (-1, EBADF);
+	return;
+    }
+    if (count < 0) {
+	send_status (-1, EINVAL);
 	return;
     }
+    if (count > data_size) {
+	g_free (data);
+	data_size = 0;
+	if (!(data = malloc (count))) {
+	    send_status (-1, ENOMEM);
+	    return;
+	}
+	data_size = count;
+    }
     if (verbose)
 	printf ("count=%d\n", count);
     n = read (handle, data, count);
@@ -237,38 +280,38 @@ do_read (void)
 	send_status (-1, errno);
 	return;
     }
-    send_status (n, 0);
-    rpc_send (msock, RPC_BLOCK, n, data, RPC_END);
-
-    g_free (data);
+    rpc_send (msock, RPC_INT, n, RPC_INT, 0, RPC_BLOCK, n, data, RPC_END);
 }
 
 static void
 do_write (void)
 {
-    int handle, count, status, written = 0;
+    int handle, count, status, written = 0, error = 0, failed = 0;
     char buf[8192];
 
     rpc_get (msock, RPC_INT, &handle, RPC_INT, &count, RPC_END);
+    if (!handle_ok (handle))
+	handle = -1;
     status = 0;
-    while (count) {
+    while (count > 0) {
 	int nbytes = count > 8192 ? 8192 : count;
 
 	rpc_get (msock, RPC_BLOCK, nbytes, buf, RPC_END);
+	count -= nbytes;
+	/* After a failure the rest of the data is only taken off the
+	   wire, or it would be read as the next command */
+	if (failed)
+	    continue;
 	status = write (handle, buf, nbytes);
-	if (status < 0) {
-	    send_status (status, errno);
-	    return;
-	}
 	/* FIXED: amount written must be returned to caller */
-	written += status;
+	if (status > 0)
+	    written += status;
 	if (status < nbytes) {
-	    send_status (written, errno);
-	    return;
+	    error = errno;
+	    failed = 1;
 	}
-	count -= nbytes;
     }
-    send_status (written, errno);
+    send_status (status < 0 ? status : written, error);
 }
 
 static void
@@ -278,6 +321,8 @@ do_lseek (void)
 
     rpc_get (msock, RPC_INT, &handle, RPC_INT, &offset, RPC_INT, &whence,
 	     RPC_END);
+    if (!handle_ok (handle))
+	handle = -1;
     status = lseek (handle, offset, whence);
     send_status (status, errno);
 }
@@ -288,6 +333,10 @@ do_close (void)
     int handle, status;
 
     rpc_get (msock, RPC_INT, &handle, RPC_END);
+    if (!handle_ok (handle))
+	handle = -1;
+    else if (mux_current)
+	handle_owner[handle] = NULL;
     status = close (handle);
     send_status (status, errno);
 }
@@ -391,6 +440,8 @@ do_fstat (void)
     struct stat st;
 
     rpc_get (msock, RPC_INT, &handle, RPC_END);
+    if (!handle_ok (handle))
+	handle = -1;
     n = fstat (handle, &st);
     send_status (n, errno);
     if (n < 0)
@@ -419,7 +470,7 @@ do_stat (void)
 
 /* {{{ Directory lookup operations */
 
-static struct {
+static struct dir_handles {
     int used;
     DIR *dirs[OPENDIR_HANDLES];
     char *names[OPENDIR_HANDLES];
@@ -525,6 +576,128 @@ do_readdir (void)
     rpc_send (msock, RPC_INT, 0, RPC_END);
 }
 
+/* The listing of do_readdirplus is built here */
+static struct {
+    unsigned char *data;
+    int len, size;
+} plus;
+
+static void
+plus_put (const void *data, int len)
+{
+    /* Out of memory already */
+    if (plus.size < 0)
+	return;
+    if (plus.len + len > plus.size) {
+	int size = plus.size ? plus.size * 2 : 65536;
+	unsigned char *p;
+
+	while (size < plus.len + len)
+	    size *= 2;
+	if (!(p = realloc (plus.data, size))) {
+	    plus.size = -1;
+	    return;
+	}
+	plus.data = p;
+	plus.size = size;
+    }
+    memcpy (plus.data + plus.len, data, len);
+    plus.len += len;
+}
+
+/* 32 bits in network order, like RPC_INT */
+static void
+plus_int (unsigned long n)
+{
+    unsigned char b[4];
+
+    b[0] = n >> 24;
+    b[1] = n >> 16;
+    b[2] = n >> 8;
+    b[3] = n;
+    plus_put (b, 4);
+}
+
+static void
+plus_stat (struct stat *st)
+{
+#ifdef HAVE_STRUCT_STAT_ST_RDEV
+    plus_int (st->st_rdev);
+#else
+    plus_int (0);
+#endif
+    plus_int (st->st_ino);
+    plus_int (st->st_mode);
+    plus_int (st->st_nlink);
+    plus_int (st->st_uid);
+    plus_int (st->st_gid);
+    /* The size is sent as two halves */
+    plus_int ((unsigned long) (st->st_size >> 16 >> 16));
+    plus_int ((unsigned long) st->st_size);
+#ifdef HAVE_STRUCT_STAT_ST_BLOCKS
+    plus_int (st->st_blocks);
+#else
+    plus_int (st->st_size / 1024);
+#endif
+    plus_int (st->st_atime);
+    plus_int (st->st_mtime);
+    plus_int (st->st_ctime);
+}
+
+/* Sends the complete listing of a directory with the lstat information
+   as a single block.  Each entry is the name length, the name, the
+   lstat status and errno and, if it succeeded, the stat fields */
+static void
+do_readdirplus (void)
+{
+    struct dirent *dirent;
+    struct stat st;
+    char *arg, *fname;
+    DIR *dir;
+    int n, count = 0;
+
+    rpc_get (msock, RPC_STRING, &arg, RPC_END);
+
+    if (!(dir = opendir (arg))) {
+	send_status (-1, errno);
+	g_free (arg);
+	return;
+    }
+
+    plus.len = 0;
+    while ((dirent = readdir (dir))) {
+	int length = NLENGTH (dirent);
+	int fname_len = strlen (arg) + length + 2;
+
+	fname = malloc (fname_len);
+	snprintf (fname, fname_len, "%s/%s", arg, dirent->d_name);
+	n = lstat (fname, &st);
+	g_free (fname);
+
+	plus_int (length);
+	plus_put (dirent->d_name, length);
+	plus_int (n);
+	plus_int (n < 0 ? errno : 0);
+	if (n >= 0)
+	    plus_stat (&st);
+	if (plus.size < 0)
+	    break;
+	count++;
+    }
+    closedir (dir);
+    g_free (arg);
+
+    if (plus.size < 0) {
+	g_free (plus.data);
+	plus.data = NULL;
+	plus.size = 0;
+	send_status (-1, ENOMEM);
+	return;
+    }
+    rpc_send (msock, RPC_INT, count, RPC_INT, 0, RPC_INT, plus.len,
+	      RPC_BLOCK, plus.len, plus.data, RPC_END);
+}
+
 static void
 do_closedir (void)
 {
@@ -1104,35 +1277,39 @@ do_login (void)
 static const struct _command {
     const char *command;
     void (*callback) (void);
+    const char *args;		/* The arguments on the wire: I for an int,
+				   S for a string, B for a block of as many
+				   bytes as the int before it says */
 } commands[] = {
     {
-    "open", do_open}, {
-    "close", do_close}, {
-    "read", do_read}, {
-    "write", do_write}, {
-    "opendir", do_opendir}, {
-    "readdir", do_readdir}, {
-    "closedir", do_closedir}, {
-    "stat ", do_stat}, {
-    "lstat ", do_lstat}, {
-    "fstat", do_fstat}, {
-    "chmod", do_chmod}, {
-    "chown", do_chown}, {
-    "readlink ", do_readlink}, {
-    "unlink", do_unlink}, {
-    "rename", do_rename}, {
-    "chdir ", do_chdir}, {
-    "lseek", do_lseek}, {
-    "rmdir", do_rmdir}, {
-    "symlink", do_symlink}, {
-    "mknod", do_mknod}, {
-    "mkdir", do_mkdir}, {
-    "link", do_link}, {
-    "gethome", do_gethome}, {
-    "getupdir", do_getupdir}, {
-    "login", do_login}, {
-    "quit", do_quit}, {
-"utime", do_utime}};
+    "open", do_open, "SII"}, {
+    "close", do_close, "I"}, {
+    "read", do_read, "II"}, {
+    "write", do_write, "IIB"}, {
+    "opendir", do_opendir, "S"}, {
+    "readdir", do_readdir, "I"}, {
+    "closedir", do_closedir, "I"}, {
+    "stat ", do_stat, "S"}, {
+    "lstat ", do_lstat, "S"}, {
+    "fstat", do_fstat, "I"}, {
+    "chmod", do_chmod, "SI"}, {
+    "chown", do_chown, "SII"}, {
+    "readlink ", do_readlink, "S"}, {
+    "unlink", do_unlink, "S"}, {
+    "rename", do_rename, "SS"}, {
+    "chdir ", do_chdir, "S"}, {
+    "lseek", do_lseek, "III"}, {
+    "rmdir", do_rmdir, "S"}, {
+    "symlink", do_symlink, "SS"}, {
+    "mknod", do_mknod, "SII"}, {
+    "mkdir", do_mkdir, "SI"}, {
+    "link", do_link, "SS"}, {
+    "gethome", do_gethome, ""}, {
+    "getupdir", do_getupdir, ""}, {
+    "login", do_login, "SS"}, {
+    "quit", do_quit, ""}, {
+    "utime", do_utime, "SSS"}, {
+"readdirplus", do_readdirplus, "S"}};
 
 static int ncommands = sizeof (commands) / sizeof (struct _command);
 
@@ -1172,6 +1349,494 @@ tcp_invalidate_socket (int sock)
     DO_QUIT_VOID ();
 }
 
+/* }}} */
+
+/* {{{ Serving all the clients of a user from one process */
+
+/*
+ * With -m, a client that has logged in is handed to the process that
+ * already serves its user, through a datagram socket in a directory
+ * only that user can enter.  The first client of a user makes its
+ * process the one.  It reads the requests of all its clients as they
+ * come, runs each once it is complete and queues the answer, so no
+ * client waits for the network of another.  The state the commands
+ * keep in globals is switched with the client.  It is per user since
+ * the process runs with the user's ids.
+ */
+
+/* Stop reading a client while this much is not sent to it yet */
+#define MUX_OUT_MAX (256 * 1024)
+
+struct mux_conn {
+    int sock;
+    int cwd;			/* Its working directory, open */
+    int version;
+    char *home_dir;
+    char *up_dir;
+    struct dir_handles dirs;
+    char *in;			/* Received, not run yet */
+    int in_pos, in_len, in_size;
+    char *out;			/* Answers, not sent yet */
+    int out_pos, out_len, out_size;
+    struct mux_conn *next;
+};
+
+static struct mux_conn *mux_conns;
+
+/* The working directory of the process */
+static int mux_cwd = -1;
+
+static int
+mux_grow (char **buf, int *size, int need)
+{
+    int n = *size ? *size : 16384;
+    char *p;
+
+    if (need <= *size)
+	return 1;
+    while (n < need)
+	n *= 2;
+    if (!(p = realloc (*buf, n)))
+	return 0;
+    *buf = p;
+    *size = n;
+    return 1;
+}
+
+/* rpc_get reads the current request from the buffer.  It is all there */
+static int
+mux_read_block (int sock, char *dest, int len)
+{
+    struct mux_conn *c = mux_current;
+
+    (void) sock;
+
+    if (len < 0 || c->in_len - c->in_pos < len) {
+	quit_server = 1;
+	return 0;
+    }
+    memcpy (dest, c->in + c->in_pos, len);
+    c->in_pos += len;
+    return 1;
+}
+
+/* rpc_send queues the answer */
+static int
+mux_write_block (int sock, const char *buffer, int len)
+{
+    struct mux_conn *c = mux_current;
+
+    (void) sock;
+
+    if (!mux_grow (&c->out, &c->out_size, c->out_len + len)) {
+	quit_server = 1;
+	return 0;
+    }
+    memcpy (c->out + c->out_len, buffer, len);
+    c->out_len += len;
+    return 1;
+}
+
+static void
+mux_enter (struct mux_conn *c)
+{
+    mux_current = c;
+    msock = c->sock;
+    clnt_version = c->version;
+    home_dir = c->home_dir;
+    up_dir = c->up_dir;
+    mcfs_DIR = c->dirs;
+    quit_server = 0;
+    if (mux_cwd != c->cwd && fchdir (c->cwd) == 0)
+	mux_cwd = c->cwd;
+}
+
+static void
+mux_leave (struct mux_conn *c)
+{
+    c->dirs = mcfs_DIR;
+    mux_current = NULL;
+}
+
+static int
+mux_get_int (unsigned char **p, unsigned char *end, long *n)
+{
+    long tmp;
+
+    if (end - *p < (int) sizeof (tmp))
+	return 0;
+    memcpy (&tmp, *p, sizeof (tmp));
+    *p += sizeof (tmp);
+    *n = (int) ntohl (tmp);
+    return 1;
+}
+
+/* 1 if the next request has come in whole, 0 if not yet, -1 if it makes
+   no sense */
+static int
+mux_request_ready (struct mux_conn *c)
+{
+    unsigned char *p = (unsigned char *) c->in + c->in_pos;
+    unsigned char *end = (unsigned char *) c->in + c->in_len;
+    const char *arg;
+    long command, n = 0;
+
+    if (!mux_get_int (&p, end, &command))
+	return 0;
+
+    /* The client has logged in already */
+    if (command < 0 || command >= ncommands || command == MC_LOGIN)
+	return -1;
+
+    for (arg = commands[command].args; *arg; arg++) {
+	if (*arg == 'I') {
+	    if (!mux_get_int (&p, end, &n))
+		return 0;
+	    continue;
+	}
+	if (*arg == 'S') {
+	    if (!mux_get_int (&p, end, &n))
+		return 0;
+	    /* rpc_get would abort */
+	    if (n > 128 * 1024)
+		return -1;
+	}
+	if (n < 0)
+	    return -1;
+	if (end - p < n)
+	    return 0;
+	p += n;
+    }
+    return 1;
+}
+
+/* Runs the requests that are in.  0 if the client is done */
+static int
+mux_run (struct mux_conn *c)
+{
+    int command, ready = 1;
+
+    mux_enter (c);
+    while (!quit_server && c->out_len - c->out_pos < MUX_OUT_MAX
+	   && (ready = mux_request_ready (c)) > 0) {
+	rpc_get (c->sock, RPC_INT, &command, RPC_END);
+	exec_command (command);
+	if (command == MC_CHDIR) {
+	    int fd = open (".", O_RDONLY);
+
+	    if (fd != -1) {
+		close (c->cwd);
+		c->cwd = mux_cwd = fd;
+	    }
+	}
+    }
+    mux_leave (c);
+
+    if (c->in_pos) {
+	memmove (c->in, c->in + c->in_pos, c->in_len - c->in_pos);
+	c->in_len -= c->in_pos;
+	c->in_pos = 0;
+    }
+    return !quit_server && ready >= 0;
+}
+
+/* 0 if the client has gone */
+static int
+mux_input (struct mux_conn *c)
+{
+    int n;
+
+    if (!mux_grow (&c->in, &c->in_size, c->in_len + 16384))
+	return 0;
+    n = read (c->sock, c->in + c->in_len, c->in_size - c->in_len);
+    if (n == 0)
+	return 0;
+    if (n < 0)
+	return errno == EINTR || errno == EAGAIN;
+    c->in_len += n;
+    return 1;
+}
+
+static int
+mux_output (struct mux_conn *c)
+{
+    int n;
+
+    while (c->out_pos < c->out_len) {
+	n = write (c->sock, c->out + c->out_pos, c->out_len - c->out_pos);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return errno == EAGAIN;
+	}
+	c->out_pos += n;
+    }
+    c->out_pos = c->out_len = 0;
+    return 1;
+}
+
+static void
+mux_add (int sock, int cwd, int version, const char *home, const char *up)
+{
+    struct mux_conn *c;
+
+    if (sock >= FD_SETSIZE || !(c = calloc (1, sizeof (struct mux_conn)))) {
+	close (sock);
+	close (cwd);
+	return;
+    }
+    fcntl (sock, F_SETFL, fcntl (sock, F_GETFL) | O_NONBLOCK);
+    c->sock = sock;
+    c->cwd = cwd;
+    c->version = version;
+    c->home_dir = home ? strdup (home) : NULL;
+    c->up_dir = up ? strdup (up) : NULL;
+    c->next = mux_conns;
+    mux_conns = c;
+    if (verbose)
+	printf ("Serving client on %d\n", sock);
+}
+
+static void
+mux_remove (struct mux_conn *c)
+{
+    struct mux_conn **p;
+    int i;
+
+    for (p = &mux_conns; *p != c; p = &(*p)->next);
+    *p = c->next;
+
+    for (i = 0; i < FD_SETSIZE; i++)
+	if (handle_owner[i] == c) {
+	    close (i);
+	    handle_owner[i] = NULL;
+	}
+    for (i = 0; i < OPENDIR_HANDLES; i++) {
+	if (c->dirs.dirs[i])
+	    closedir (c->dirs.dirs[i]);
+	g_free (c->dirs.names[i]);
+    }
+    if (mux_cwd == c->cwd)
+	mux_cwd = -1;
+    close (c->cwd);
+    close (c->sock);
+    g_free (c->home_dir);
+    g_free (c->up_dir);
+    g_free (c->in);
+    g_free (c->out);
+    free (c);
+    if (verbose)
+	printf ("Connection closed\n");
+}
+
+/* Takes a client handed over by mux_handoff: its socket and working
+   directory come as descriptors, the protocol version, home and upper
+   directory in the data.  0 if none was waiting */
+static int
+mux_adopt (int lsock)
+{
+    char data[sizeof (int) + 2 * MC_MAXPATHLEN];
+    char control[CMSG_SPACE (2 * sizeof (int))];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    int fds[2], n, version;
+    char *home, *up, *end;
+
+    memset (&msg, 0, sizeof (msg));
+    iov.iov_base = data;
+    iov.iov_len = sizeof (data);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof (control);
+
+    if ((n = recvmsg (lsock, &msg, 0)) < 0)
+	return errno == EINTR;
+
+    cmsg = CMSG_FIRSTHDR (&msg);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS
+	|| cmsg->cmsg_len != CMSG_LEN (2 * sizeof (int)))
+	return 1;
+    memcpy (fds, CMSG_DATA (cmsg), sizeof (fds));
+
+    home = data + sizeof (int);
+    end = data + n;
+    if (n < (int) sizeof (int)
+	|| !(up = memchr (home, '\0', end - home))
+	|| !memchr (up + 1, '\0', end - up - 1)) {
+	close (fds[0]);
+	close (fds[1]);
+	return 1;
+    }
+    up++;
+    memcpy (&version, data, sizeof (int));
+    mux_add (fds[0], fds[1], version, *home ? home : NULL,
+	     *up ? up : NULL);
+    return 1;
+}
+
+/* Hands the client over to the process at path.  1 if it has it now */
+static int
+mux_handoff (const char *path)
+{
+    char control[CMSG_SPACE (2 * sizeof (int))];
+    struct sockaddr_un addr;
+    struct msghdr msg;
+    struct iovec iov[3];
+    struct cmsghdr *cmsg;
+    int fds[2], sock, ok;
+    const char *home = home_dir ? home_dir : "";
+    const char *up = up_dir ? up_dir : "";
+
+    if ((sock = socket (AF_UNIX, SOCK_DGRAM, 0)) == -1)
+	return 0;
+    if ((fds[1] = open (".", O_RDONLY)) == -1) {
+	close (sock);
+	return 0;
+    }
+    fds[0] = msock;
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    snprintf (addr.sun_path, sizeof (addr.sun_path), "%s", path);
+
+    iov[0].iov_base = (char *) &clnt_version;
+    iov[0].iov_len = sizeof (int);
+    iov[1].iov_base = (char *) home;
+    iov[1].iov_len = strlen (home) + 1;
+    iov[2].iov_base = (char *) up;
+    iov[2].iov_len = strlen (up) + 1;
+
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_name = (void *) &addr;
+    msg.msg_namelen = sizeof (addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 3;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof (control);
+    cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN (2 * sizeof (int));
+    memcpy (CMSG_DATA (cmsg), fds, sizeof (fds));
+
+    ok = sendmsg (sock, &msg, 0) != -1;
+    close (sock);
+    close (fds[1]);
+    return ok;
+}
+
+static void
+mux_loop (int lsock, const char *path)
+{
+    struct mux_conn *c, *next;
+    fd_set rfds, wfds;
+    int maxfd, ok, keep;
+
+    while (mux_conns || lsock != -1) {
+	if (!mux_conns) {
+	    /* The last client has gone.  Those handed over meanwhile are
+	       still served, new ones start another process */
+	    unlink (path);
+	    fcntl (lsock, F_SETFL, fcntl (lsock, F_GETFL) | O_NONBLOCK);
+	    while (mux_adopt (lsock));
+	    close (lsock);
+	    lsock = -1;
+	    continue;
+	}
+
+	FD_ZERO (&rfds);
+	FD_ZERO (&wfds);
+	maxfd = lsock;
+	if (lsock != -1)
+	    FD_SET (lsock, &rfds);
+	for (c = mux_conns; c; c = c->next) {
+	    if (c->out_len - c->out_pos < MUX_OUT_MAX)
+		FD_SET (c->sock, &rfds);
+	    if (c->out_pos < c->out_len)
+		FD_SET (c->sock, &wfds);
+	    if (c->sock > maxfd)
+		maxfd = c->sock;
+	}
+
+	if (select (maxfd + 1, &rfds, &wfds, NULL, NULL) == -1) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+
+	if (lsock != -1 && FD_ISSET (lsock, &rfds))
+	    mux_adopt (lsock);
+
+	for (c = mux_conns; c; c = next) {
+	    next = c->next;
+	    ok = keep = 1;
+	    if (FD_ISSET (c->sock, &rfds))
+		ok = mux_input (c);
+	    if (ok && c->in_len)
+		keep = mux_run (c);
+	    if (!ok || !mux_output (c) || !keep)
+		mux_remove (c);
+	}
+    }
+}
+
+/* Called once the client has logged in.  Either hands it over to the
+   process serving its user or becomes that process */
+static void
+mux_server (void)
+{
+    char path[MC_MAXPATHLEN];
+    struct sockaddr_un addr;
+    struct stat st;
+    int lsock = -1, tries;
+
+    /* Not again for this client, whatever happens */
+    multiplex = 0;
+
+    snprintf (path, sizeof (path), "/tmp/mcserv-%d", (int) getuid ());
+    if (mkdir (path, 0700) == -1 && errno != EEXIST)
+	return;
+    if (lstat (path, &st) == -1 || !S_ISDIR (st.st_mode)
+	|| st.st_uid != getuid () || (st.st_mode & 077))
+	return;
+    strcat (path, "/socket");
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    snprintf (addr.sun_path, sizeof (addr.sun_path), "%s", path);
+
+    for (tries = 0; tries < 2 && lsock == -1; tries++) {
+	if (mux_handoff (path)) {
+	    quit_server = 1;
+	    return;
+	}
+	/* Nobody there.  Lost a race if the bind fails */
+	unlink (path);
+	lsock = socket (AF_UNIX, SOCK_DGRAM, 0);
+	if (lsock != -1
+	    && bind (lsock, (struct sockaddr *) &addr, sizeof (addr)) == -1) {
+	    close (lsock);
+	    lsock = -1;
+	}
+    }
+    if (lsock == -1)
+	return;
+
+    signal (SIGPIPE, SIG_IGN);
+    rpc_read_block = mux_read_block;
+    rpc_write_block = mux_write_block;
+    mux_cwd = open (".", O_RDONLY);
+    mux_add (msock, mux_cwd, clnt_version, home_dir, up_dir);
+    mux_loop (lsock, path);
+    quit_server = 1;
+}
+
+/* }}} */
+
+/* {{{ Serving a client */
+
 static void
 server (int sock)
 {
@@ -1179,12 +1844,22 @@ server (int sock)
 
     msock = sock;
     quit_server = 0;
+#ifdef TCP_NODELAY
+    {
+	/* Replies are small and the client waits for them */
+	int yes = 1;
+	setsockopt (sock, IPPROTO_TCP, TCP_NODELAY, (char *) &yes,
+		    sizeof (yes));
+    }
+#endif
 
     check_version ();
     do {
 	if (rpc_get (sock, RPC_INT, &command, RPC_END)
 	    && (logged_in || command == MC_LOGIN))
 	    exec_command (command);
+	if (logged_in && multiplex)
+	    mux_server ();
     } while (!quit_server);
 }
 
@@ -1315,7 +1990,7 @@ main (int argc, char *argv[])
     const char *result;
     int c;
 
-    while ((c = getopt (argc, argv, "fdiqp:v")) != -1) {
+    while ((c = getopt (argc, argv, "fdimqp:v")) != -1) {
 	switch (c) {
 	case 'd':
 	    isDaemon = 1;
@@ -1342,6 +2017,10 @@ main (int argc, char *argv[])
 	    inetd_started = 1;
 	    break;
 
+	case 'm':
+	    multiplex = 1;
+	    break;
+
 	case 'r':
 	    r_auth = 1;
 	    break;
@@ -1355,6 +2034,7 @@ main (int argc, char *argv[])
 #ifndef HAVE_PAM
 		     "-f  force ftp authentication\n"
 #endif
+		     "-m  serve all clients of a user from one process\n"
 		     "-v  verbose mode\n"
 		     "-p  to specify a port number to listen\n");
 	    exit (0);
@@ -38,6 +38,12 @@
 #include "gc.h"		/* vfs_rmstamp */
 #include "xdirentry.h"
 
+#ifdef HAVE_LIBZ
+#define free_func z_free_func	/* slib/hash.h has its own free_func */
+#include <zlib.h>
+#undef free_func
+#endif
+
 static struct vfs_class vfs_tarfs_ops;
 
 enum {
@@ -200,40 +206,374 @@ static off_t tar_from_oct (int digs, char *where)
     return value;
 }
 
+#ifdef HAVE_LIBZ
+/* {{{ gzip checkpoint index */
+
+/*
+ * Gzip compressed archives are inflated in-process rather than through
+ * the #ugz filter, which would decompress the whole archive into a
+ * temporary file before the first header could be read.  While the
+ * headers are scanned, the inflater state is saved at a deflate block
+ * boundary every TAR_Z_SPAN bytes of output, so that tar_read() can
+ * resume from the nearest checkpoint before a member.
+ */
+
+#define TAR_Z_SPAN	(8 * 1024 * 1024)	/* output between checkpoints */
+#define TAR_Z_WINSIZE	32768			/* deflate history */
+#define TAR_Z_CHUNK	16384
+
+struct tar_zpoint {
+    off_t out;			/* uncompressed offset */
+    off_t in;			/* offset of the first whole compressed byte */
+    int bits;			/* unused bits of the byte before `in' */
+    uLongf wlen;
+    Bytef *window;		/* preceding 32K of output, deflated */
+};
+
+struct tar_zindex {
+    int fd;
+    z_stream strm;
+    int raw;			/* resumed at a checkpoint, no gzip header */
+    int member;			/* just started a concatenated member */
+    int eof;
+    off_t in;			/* compressed offset of the next read */
+    off_t out;			/* uncompressed bytes inflated so far */
+    unsigned int wpos;		/* where the next output goes in window */
+    unsigned int have;		/* inflated bytes before wpos not returned yet */
+    struct tar_zpoint *points;
+    int count, size;
+    Bytef input[TAR_Z_CHUNK];
+    Bytef window[TAR_Z_WINSIZE];
+};
+
+static struct tar_zindex *
+tar_z_new (int fd)
+{
+    struct tar_zindex *z = g_new0 (struct tar_zindex, 1);
+
+    if (inflateInit2 (&z->strm, 15 + 16) != Z_OK) {
+	g_free (z);
+	return NULL;
+    }
+    z->fd = fd;
+    return z;
+}
+
+static void
+tar_z_free (struct tar_zindex *z)
+{
+    int i;
+
+    inflateEnd (&z->strm);
+    for (i = 0; i < z->count; i++)
+	g_free (z->points[i].window);
+    g_free (z->points);
+    g_free (z);
+}
+
+static int
+tar_z_input (struct tar_zindex *z)
+{
+    int n;
+
+    n = mc_read (z->fd, (char *) z->input, TAR_Z_CHUNK);
+    if (n <= 0)
+	return n;
+    z->strm.next_in = z->input;
+    z->strm.avail_in = n;
+    z->in += n;
+    return n;
+}
+
+/* Save a checkpoint if the stream sits on a block boundary far enough
+   past the last one.  `produced' is the output of the current fill */
+static void
+tar_z_mark (struct tar_zindex *z, unsigned int produced)
+{
+    struct tar_zpoint *p;
+    Bytef *flat;
+    unsigned int head;
+    off_t out = z->out + produced;
+
+    if (out - (z->count ? z->points[z->count - 1].out : 0) < TAR_Z_SPAN)
+	return;
+
+    if (z->count == z->size) {
+	z->size = z->size ? z->size * 2 : 16;
+	z->points = g_realloc (z->points, z->size * sizeof (struct tar_zpoint));
+    }
+
+    /* Unroll the circular window, oldest byte first */
+    head = (z->wpos + produced) % TAR_Z_WINSIZE;
+    flat = g_malloc (TAR_Z_WINSIZE);
+    memcpy (flat, z->window + head, TAR_Z_WINSIZE - head);
+    memcpy (flat + TAR_Z_WINSIZE - head, z->window, head);
+
+    p = &z->points[z->count];
+    p->wlen = compressBound (TAR_Z_WINSIZE);
+    p->window = g_malloc (p->wlen);
+    if (compress2 (p->window, &p->wlen, flat, TAR_Z_WINSIZE, 1) != Z_OK) {
+	g_free (p->window);
+	g_free (flat);
+	return;
+    }
+    p->window = g_realloc (p->window, p->wlen);
+    p->out = out;
+    p->in = z->in - z->strm.avail_in;
+    p->bits = z->strm.data_type & 7;
+    z->count++;
+    g_free (flat);
+}
+
+/* Step over the end of a gzip member.  Returns -1 on error */
+static int
+tar_z_next_member (struct tar_zindex *z)
+{
+    /* A raw inflater leaves the gzip trailer in the input */
+    unsigned int skip = z->raw ? 8 : 0;
+    unsigned int n;
+    Bytef *next_in;
+    uInt avail_in;
+
+    for (;;) {
+	if (z->strm.avail_in == 0) {
+	    int got = tar_z_input (z);
+
+	    if (got < 0)
+		return -1;
+	    if (got == 0) {
+		z->eof = 1;
+		return 0;
+	    }
+	}
+	if (skip == 0)
+	    break;
+	n = MIN (skip, z->strm.avail_in);
+	z->strm.next_in += n;
+	z->strm.avail_in -= n;
+	skip -= n;
+    }
+
+    next_in = z->strm.next_in;
+    avail_in = z->strm.avail_in;
+    inflateEnd (&z->strm);
+    if (inflateInit2 (&z->strm, 15 + 16) != Z_OK)
+	return -1;
+    z->strm.next_in = next_in;
+    z->strm.avail_in = avail_in;
+    z->raw = 0;
+    z->member = 1;
+    return 0;
+}
+
+/* Inflate the next piece of output into the window.
+   Returns the number of new bytes, 0 at the end, -1 on error */
+static int
+tar_z_fill (struct tar_zindex *z)
+{
+    unsigned int room;
+    int ret, n;
+
+    if (z->wpos == TAR_Z_WINSIZE)
+	z->wpos = 0;
+    room = TAR_Z_WINSIZE - z->wpos;
+    z->strm.next_out = z->window + z->wpos;
+    z->strm.avail_out = room;
+
+    while (!z->eof && z->strm.avail_out == room) {
+	if (z->strm.avail_in == 0) {
+	    n = tar_z_input (z);
+	    if (n < 0)
+		return -1;
+	    if (n == 0) {
+		/* Truncated archive, let the tar code notice */
+		z->eof = 1;
+		break;
+	    }
+	}
+	ret = inflate (&z->strm, Z_BLOCK);
+	if (ret == Z_STREAM_END) {
+	    if (tar_z_next_member (z) == -1)
+		return -1;
+	    continue;
+	}
+	if (ret != Z_OK && ret != Z_BUF_ERROR) {
+	    /* Trailing garbage after a member is ignored, like gzip does */
+	    if (z->member && z->strm.total_out == 0) {
+		z->eof = 1;
+		break;
+	    }
+	    return -1;
+	}
+	z->member = 0;
+	if ((z->strm.data_type & 128) && !(z->strm.data_type & 64))
+	    tar_z_mark (z, room - z->strm.avail_out);
+    }
+
+    n = room - z->strm.avail_out;
+    z->wpos += n;
+    z->out += n;
+    z->have = n;
+    return n;
+}
+
+/* Restart the inflater at checkpoint `p', or at the beginning of the
+   archive if `p' is NULL */
+static int
+tar_z_restore (struct tar_zindex *z, struct tar_zpoint *p)
+{
+    off_t in = p ? p->in - (p->bits ? 1 : 0) : 0;
+    uLongf len = TAR_Z_WINSIZE;
+
+    z->eof = 1;
+    z->have = 0;
+    if (mc_lseek (z->fd, in, SEEK_SET) != in)
+	return -1;
+    inflateEnd (&z->strm);
+    z->strm.next_in = Z_NULL;
+    z->strm.avail_in = 0;
+    if (inflateInit2 (&z->strm, p ? -15 : 15 + 16) != Z_OK)
+	return -1;
+
+    z->in = in;
+    z->out = p ? p->out : 0;
+    z->wpos = 0;
+    z->raw = p != NULL;
+    z->member = 0;
+    if (p != NULL) {
+	if (p->bits) {
+	    if (tar_z_input (z) <= 0)
+		return -1;
+	    z->strm.next_in++;
+	    z->strm.avail_in--;
+	    inflatePrime (&z->strm, p->bits,
+			  z->input[0] >> (8 - p->bits));
+	}
+	if (uncompress (z->window, &len, p->window, p->wlen) != Z_OK
+	    || len != TAR_Z_WINSIZE)
+	    return -1;
+	inflateSetDictionary (&z->strm, z->window, TAR_Z_WINSIZE);
+    }
+    z->eof = 0;
+    return 0;
+}
+
+/* Position the stream at uncompressed offset `offset' */
+static int
+tar_z_seek (struct tar_zindex *z, off_t offset)
+{
+    off_t pos = z->out - z->have;
+    unsigned int n;
+
+    if (offset < pos || offset - pos > TAR_Z_SPAN) {
+	int lo = 0, hi = z->count;
+
+	/* Last checkpoint at or before `offset' */
+	while (lo < hi) {
+	    int mid = (lo + hi) / 2;
+
+	    if (z->points[mid].out <= offset)
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+	if (lo > 0 && (offset < pos || z->points[lo - 1].out > pos)) {
+	    if (tar_z_restore (z, &z->points[lo - 1]) == -1)
+		return -1;
+	} else if (offset < pos) {
+	    if (tar_z_restore (z, NULL) == -1)
+		return -1;
+	}
+	pos = z->out - z->have;
+    }
+
+    while (pos < offset) {
+	if (z->have == 0 && tar_z_fill (z) <= 0)
+	    return -1;
+	n = MIN ((off_t) z->have, offset - pos);
+	z->have -= n;
+	pos += n;
+    }
+    return 0;
+}
+
+static int
+tar_z_read (struct tar_zindex *z, char *buffer, int count)
+{
+    int done = 0, n;
+
+    while (done < count) {
+	if (z->have == 0) {
+	    n = tar_z_fill (z);
+	    if (n < 0)
+		return -1;
+	    if (n == 0)
+		break;
+	}
+	n = MIN ((int) z->have, count - done);
+	memcpy (buffer + done, z->window + z->wpos - z->have, n);
+	z->have -= n;
+	done += n;
+    }
+    return done;
+}
+
+/* Only real gzip streams, not the other formats gzip understands */
+static int
+tar_z_magic (int fd)
+{
+    unsigned char magic[2];
+
+    mc_lseek (fd, 0, SEEK_SET);
+    if (mc_read (fd, (char *) magic, 2) != 2)
+	return 0;
+    mc_lseek (fd, 0, SEEK_SET);
+    return magic[0] == 037 && magic[1] == 0213;
+}
+
+/* }}} */
+#endif				/* HAVE_LIBZ */
+
 static void tar_free_archive (struct vfs_class *me, struct vfs_s_super *archive)
 {
     (void) me;
 
+#ifdef HAVE_LIBZ
+    if (archive->u.arch.zindex != NULL)
+	tar_z_free (archive->u.arch.zindex);
+    archive->u.arch.zindex = NULL;
+#endif
     if (archive->u.arch.fd != -1)
 	mc_close(archive->u.arch.fd);
+    vfs_s_catalog_free (archive);
 }
 
 /* As we open one archive at a time, it is safe to have this static */
 static off_t current_tar_position = 0;
 
-/* Returns fd of the open tar file */
+/* Open the archive file, through a decompressor if it is compressed.
+   Returns the fd, which is also kept in the superblock */
 static int
-tar_open_archive_int (struct vfs_class *me, const char *name,
-		      struct vfs_s_super *archive)
+tar_open_fd (struct vfs_class *me, struct vfs_s_super *archive)
 {
     int result, type;
-    mode_t mode;
-    struct vfs_s_inode *root;
 
-    result = mc_open (name, O_RDONLY);
+    result = mc_open (archive->name, O_RDONLY);
     if (result == -1) {
-	message (1, MSG_ERROR, _("Cannot open tar archive\n%s"), name);
+	message (1, MSG_ERROR, _("Cannot open tar archive\n%s"), archive->name);
 	ERRNOR (ENOENT, -1);
     }
 
-    archive->name = g_strdup (name);
-    mc_stat (name, &(archive->u.arch.st));
-    archive->u.arch.fd = -1;
-    archive->u.arch.type = TAR_UNKNOWN;
-
     /* Find out the method to handle this tar file */
     type = get_compression_type (result);
     mc_lseek (result, 0, SEEK_SET);
+#ifdef HAVE_LIBZ
+    if (type == COMPRESSION_GZIP && tar_z_magic (result)) {
+	archive->u.arch.zindex = tar_z_new (result);
+	if (archive->u.arch.zindex != NULL)
+	    type = COMPRESSION_NONE;
+    }
+#endif
     if (type != COMPRESSION_NONE) {
 	char *s;
 	mc_close (result);
@@ -247,6 +587,21 @@ tar_open_archive_int (struct vfs_class *me, const char *name,
     }
 
     archive->u.arch.fd = result;
+    return result;
+}
+
+static void
+tar_open_archive_int (struct vfs_class *me, const char *name,
+		      struct vfs_s_super *archive)
+{
+    mode_t mode;
+    struct vfs_s_inode *root;
+
+    archive->name = g_strdup (name);
+    mc_stat (name, &(archive->u.arch.st));
+    archive->u.arch.fd = -1;
+    archive->u.arch.type = TAR_UNKNOWN;
+
     mode = archive->u.arch.st.st_mode & 07777;
     if (mode & 0400)
 	mode |= 0100;
@@ -263,8 +618,6 @@ tar_open_archive_int (struct vfs_class *me, const char *name,
     root->st.st_dev = MEDATA->rdev++;
 
     archive->root = root;
-
-    return result;
 }
 
 static union record rec_buf;
@@ -274,9 +627,12 @@ tar_get_next_record (struct vfs_s_super *archive, int tard)
 {
     int n;
 
-    (void) archive;
-
-    n = mc_read (tard, rec_buf.charptr, RECORDSIZE);
+#ifdef HAVE_LIBZ
+    if (archive->u.arch.zindex != NULL)
+	n = tar_z_read (archive->u.arch.zindex, rec_buf.charptr, RECORDSIZE);
+    else
+#endif
+	n = mc_read (tard, rec_buf.charptr, RECORDSIZE);
     if (n != RECORDSIZE)
 	return NULL;		/* An error has occurred */
     current_tar_position += RECORDSIZE;
@@ -285,9 +641,13 @@ tar_get_next_record (struct vfs_s_super *archive, int tard)
 
 static void tar_skip_n_records (struct vfs_s_super *archive, int tard, off_t n)
 {
-    (void) archive;
-
-    mc_lseek (tard, n * RECORDSIZE, SEEK_CUR);
+#ifdef HAVE_LIBZ
+    if (archive->u.arch.zindex != NULL)
+	tar_z_seek (archive->u.arch.zindex,
+		    current_tar_position + n * RECORDSIZE);
+    else
+#endif
+	mc_lseek (tard, n * RECORDSIZE, SEEK_CUR);
     current_tar_position += n * RECORDSIZE;
 }
 
@@ -649,8 +1009,14 @@ tar_open_archive (struct vfs_class *me, struct vfs_s_super *archive,
     (void) op;
 
     current_tar_position = 0;
+    tar_open_archive_int (me, name, archive);
+
+    /* The archive is opened on demand if the listing is known */
+    if (vfs_s_catalog_load (me, archive))
+	return 0;
+
     /* Open for reading */
-    if ((tard = tar_open_archive_int (me, name, archive)) == -1)
+    if ((tard = tar_open_fd (me, archive)) == -1)
 	return -1;
 
     for (;;) {
@@ -705,6 +1071,7 @@ tar_open_archive (struct vfs_class *me, struct vfs_s_super *archive,
 	}
 	break;
     };
+    vfs_s_catalog_save (me, archive);
     return 0;
 }
 
@@ -751,11 +1118,22 @@ static int tar_read (void *fh, char *buffer, int count)
     int fd = FH_SUPER->u.arch.fd;
     struct vfs_class *me = FH_SUPER->me;
 
+    count = MIN(count, FH->ino->st.st_size - FH->pos);
+
+#ifdef HAVE_LIBZ
+    if (FH_SUPER->u.arch.zindex != NULL) {
+	struct tar_zindex *z = FH_SUPER->u.arch.zindex;
+
+	if (tar_z_seek (z, begin + FH->pos) == -1) ERRNOR (EIO, -1);
+	if ((count = tar_z_read (z, buffer, count)) == -1) ERRNOR (EIO, -1);
+	FH->pos += count;
+	return count;
+    }
+#endif
+
     if (mc_lseek (fd, begin + FH->pos, SEEK_SET) != 
         begin + FH->pos) ERRNOR (EIO, -1);
 
-    count = MIN(count, FH->ino->st.st_size - FH->pos);
-
     if ((count = mc_read (fd, buffer, count)) == -1) ERRNOR (errno, -1);
 
     FH->pos += count;
@@ -764,10 +1142,11 @@ static int tar_read (void *fh, char *buffer, int count)
 
 static int tar_fh_open (struct vfs_class *me, struct vfs_s_fh *fh, int flags, int mode)
 {
-    (void) fh;
     (void) mode;
 
     if ((flags & O_ACCMODE) != O_RDONLY) ERRNOR (EROFS, -1);
+    if (FH_SUPER->u.arch.fd == -1 && tar_open_fd (me, FH_SUPER) == -1)
+	return -1;
     return 0;
 }
 
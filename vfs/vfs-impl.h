@@ -136,6 +136,10 @@ void init_fish (void);
 void init_sfs (void);
 void init_tarfs (void);
 void init_undelfs (void);
+void init_zipfs (void);
+
+int extfs_copyout (const char *prefix, const char *archive,
+		   const char *file, const char *local);
 
 #endif /* USE_VFS */
 
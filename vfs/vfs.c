@@ -882,6 +882,9 @@ vfs_init (void)
     init_sfs ();
     init_tarfs ();
     init_cpiofs ();
+#ifdef HAVE_LIBZ
+    init_zipfs ();
+#endif /* HAVE_LIBZ */
 
 #ifdef USE_EXT2FSLIB
     init_undelfs ();
@@ -47,7 +47,8 @@ int mc_setctl (const char *path, int ctlop, void *arg);
 
 /* Operations for mc_ctl - on open file */
 enum {
-    VFS_CTL_IS_NOTREADY
+    VFS_CTL_IS_NOTREADY,
+    VFS_CTL_GETFD	/* store the local file descriptor in *(int *) arg */
 };
 
 /* Operations for mc_setctl - on path */
@@ -59,7 +60,19 @@ enum {
 
     /* Setting this makes vfs layer give out potentially incorrect data,
        but it also makes some operations much faster. Use with caution. */
-    VFS_SETCTL_STALE_DATA
+    VFS_SETCTL_STALE_DATA,
+
+    /* arg is a NULL terminated list of names in path that are about
+       to be read, so that they can be fetched in one go */
+    VFS_SETCTL_PREFETCH,
+
+    /* Returns nonzero if the vfs queues the chmod, chown, unlink,
+       mkdir, rmdir and rename calls on path from now on and reports
+       them successful.  They are sent in one go at the latest by
+       VFS_SETCTL_BATCH_END, whose arg is a GList ** receiving the
+       paths of those which failed (or NULL) */
+    VFS_SETCTL_BATCH_BEGIN,
+    VFS_SETCTL_BATCH_END
 };
 
 #define O_ALL (O_CREAT | O_EXCL | O_NOCTTY | O_NDELAY | O_SYNC | O_WRONLY | O_RDWR | O_RDONLY)
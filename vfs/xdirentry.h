@@ -43,6 +43,10 @@ struct vfs_s_super {
 	    char *host, *user;
 	    char *password;
 	    int flags;
+	    struct fish_pending *pending;	/* Requests sent ahead, whose
+						   replies are not read yet */
+	    struct fish_batch *batch;	/* Operations queued by
+					   VFS_SETCTL_BATCH_BEGIN */
 	} fish;
 	struct {
 	    int sock;
@@ -61,13 +65,21 @@ struct vfs_s_super {
 	    int strict;		/* ftp server doesn't understand 
 				   "LIST -la <path>"; use "CWD <path>"/
 				   "LIST" instead */
+	    int use_mlsd;	/* server lists directories with MLSD */
 	    int ctl_connection_busy;
+	    struct ftpfs_conn *idle;	/* Extra control connections */
+	    int conns;			/* Number of them open */
+	    int conns_refused;		/* Server doesn't want more */
+	    struct ftpfs_xfer *xfers;	/* Transfers on extra connections */
 	} ftp;
 	struct {
 	    int fd;
 	    struct stat st;
 	    int type;		/* Type of the archive */
 	    struct defer_inode *deferred;	/* List of inodes for which another entries may appear */
+	    struct tar_zindex *zindex;	/* tarfs: checkpoints into a gzip stream */
+	    struct vfs_s_catalog *catalog;	/* Listing taken from the cache */
+	    off_t shift;	/* zipfs: bytes before the archive, e.g. an SFX stub */
 	} arch;
     } u;
 };
@@ -81,6 +93,7 @@ struct vfs_s_entry {
     struct vfs_s_inode *dir;	/* Directory we are in, i.e. our parent */
     char *name;			/* Name of this entry */
     struct vfs_s_inode *ino;	/* ... and its inode */
+    struct vfs_s_entry *hash_next;	/* Chain in dir->hash */
 };
 
 /* Single virtual file - inode */
@@ -90,6 +103,13 @@ struct vfs_s_inode {
 				   use only for directories because they
 				   cannot be hardlinked */
     struct vfs_s_entry *subdir; /* If this is a directory, its entry */
+    struct vfs_s_entry **subdir_tail;	/* Where to append, NULL if empty */
+    int subdir_count;		/* Number of entries in subdir */
+    struct vfs_s_entry **hash;	/* Index of subdir by name, built lazily
+				   for big directories */
+    unsigned int hash_size;	/* Number of buckets, a power of 2 */
+    unsigned int catalog;	/* Catalog number + 1 of a directory whose
+				   entries are not created yet */
     struct stat st;		/* Parameters of this inode */
     char *linkname;		/* Symlink's contents */
     char *localname;		/* Filename of local file, if we have one */
@@ -111,7 +131,11 @@ struct vfs_s_fh {
 	} fish;
 	struct {
 	    int sock, append;
+	    struct ftpfs_split *split;	/* File read in parallel ranges */
 	} ftp;
+	struct {
+	    struct zip_stream *stream;
+	} zip;
     } u;
 };
 
@@ -167,6 +191,7 @@ struct vfs_s_inode *vfs_s_new_inode (struct vfs_class *me,
 struct vfs_s_entry *vfs_s_new_entry (struct vfs_class *me, const char *name,
 				     struct vfs_s_inode *inode);
 void vfs_s_free_entry (struct vfs_class *me, struct vfs_s_entry *ent);
+void vfs_s_free_inode (struct vfs_class *me, struct vfs_s_inode *ino);
 void vfs_s_insert_entry (struct vfs_class *me, struct vfs_s_inode *dir,
 			 struct vfs_s_entry *ent);
 struct stat *vfs_s_default_stat (struct vfs_class *me, mode_t mode);
@@ -179,6 +204,8 @@ struct vfs_s_inode *vfs_s_find_inode (struct vfs_class *me,
 				      const char *path, int follow, int flags);
 struct vfs_s_inode *vfs_s_find_root (struct vfs_class *me,
 				     struct vfs_s_entry *entry);
+struct vfs_s_entry *vfs_s_lookup (struct vfs_s_inode *dir, const char *name,
+				  size_t len);
 
 /* outside interface */
 void vfs_s_init_class (struct vfs_class *vclass,
@@ -186,6 +213,8 @@ void vfs_s_init_class (struct vfs_class *vclass,
 const char *vfs_s_get_path_mangle (struct vfs_class *me, char *inname,
 			     struct vfs_s_super **archive, int flags);
 void vfs_s_invalidate (struct vfs_class *me, struct vfs_s_super *super);
+int vfs_s_setctl (struct vfs_class *me, const char *path, int ctlop,
+		  void *arg);
 char *vfs_s_fullpath (struct vfs_class *me, struct vfs_s_inode *ino);
 
 /* network filesystems support */
@@ -195,6 +224,12 @@ int vfs_s_get_line (struct vfs_class *me, int sock, char *buf, int buf_len,
 int vfs_s_get_line_interruptible (struct vfs_class *me, char *buffer,
 				  int size, int fd);
 
+/* archive catalog cache */
+int vfs_s_catalog_load (struct vfs_class *me, struct vfs_s_super *super);
+void vfs_s_catalog_save (struct vfs_class *me, struct vfs_s_super *super);
+void vfs_s_catalog_expand (struct vfs_s_inode *dir);
+void vfs_s_catalog_free (struct vfs_s_super *super);
+
 /* misc */
 int vfs_s_retrieve_file (struct vfs_class *me, struct vfs_s_inode *ino);
 
@@ -0,0 +1,706 @@
+/* Virtual File System: zip file system.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public License
+   as published by the Free Software Foundation; either version 2 of
+   the License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public
+   License along with this program; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.  */
+
+/* Namespace: init_zipfs */
+
+/*
+ * The listing is taken straight from the central directory at the end
+ * of the archive, so opening even a big jar is a couple of reads and
+ * no helper process.  Stored members are read in place, deflated ones
+ * are inflated on demand.  The archive is read-only and has its own
+ * "zip" prefix: "uzip" stays with the extfs script, which can also
+ * modify an archive.  The script is used as well when mc is built
+ * without zlib, and for members that are encrypted or use other methods.
+ *
+ * data_offset of an inode is the position of its central directory
+ * record, which is read again when the file is opened.  Offsets stored
+ * in the archive are relative to its start, which is not the start of
+ * the file in a self-extracting archive; u.arch.shift tells the
+ * difference.
+ */
+
+#include <config.h>
+
+#ifdef HAVE_LIBZ
+
+#include <sys/types.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "../src/global.h"
+#include "../src/wtools.h"	/* message() */
+#include "utilvfs.h"
+#include "vfs-impl.h"
+#include "gc.h"		/* vfs_rmstamp */
+#include "xdirentry.h"
+
+#define free_func z_free_func	/* slib/hash.h has its own free_func */
+#include <zlib.h>
+#undef free_func
+
+static struct vfs_class vfs_zipfs_ops;
+
+#define ZIP_LOCAL_SIG		0x04034b50
+#define ZIP_CENTRAL_SIG		0x02014b50
+#define ZIP_END_SIG		0x06054b50
+#define ZIP64_END_SIG		0x06064b50
+#define ZIP64_LOCATOR_SIG	0x07064b50
+
+#define ZIP_LOCAL_LEN		30
+#define ZIP_CENTRAL_LEN		46
+#define ZIP_END_LEN		22
+#define ZIP64_END_LEN		56
+#define ZIP64_LOCATOR_LEN	20
+#define ZIP_COMMENT_MAX		65535
+
+#define ZIP_STORED		0
+#define ZIP_DEFLATED		8
+#define ZIP_COPYOUT		-1	/* extracted by the uzip script */
+
+#define ZIP_FLAG_ENCRYPTED	1
+#define ZIP_HOST_UNIX		3
+
+#define ZIP_EXTRA_ZIP64		0x0001
+#define ZIP_EXTRA_TIME		0x5455
+
+#define ZIP_CHUNK		16384
+
+#define ZIP_U16(p)	((unsigned int) (p)[0] | ((unsigned int) (p)[1] << 8))
+#define ZIP_U32(p)	((unsigned long) ZIP_U16 (p) | ((unsigned long) ZIP_U16 ((p) + 2) << 16))
+#define ZIP_U64(p)	((off_t) ZIP_U32 (p) | ((off_t) ZIP_U32 ((p) + 4) << 32))
+
+/* Central directory record of one member */
+struct zip_member {
+    unsigned int host;		/* system that made the archive */
+    unsigned int flags;
+    unsigned int method;
+    time_t mtime;
+    off_t csize;		/* compressed size */
+    off_t size;
+    off_t header;		/* offset of the local header */
+    unsigned long attr;		/* external attributes */
+    unsigned char *name;	/* not terminated */
+    unsigned int name_len;
+    unsigned int length;	/* of the whole record */
+};
+
+/* Data of an open member */
+struct zip_stream {
+    int method;
+    int fd;			/* ZIP_COPYOUT: the extracted member */
+    off_t start;		/* offset of the data in the archive */
+    off_t csize;
+    off_t in;			/* compressed bytes read so far */
+    off_t out;			/* position in the inflated data */
+    z_stream strm;
+    Bytef input[ZIP_CHUNK];
+};
+
+/* Read exactly `len' bytes at `offset' of the archive */
+static int
+zip_pread (struct vfs_s_super *super, off_t offset, void *buf, int len)
+{
+    if (mc_lseek (super->u.arch.fd, offset, SEEK_SET) != offset)
+	return -1;
+    if (mc_read (super->u.arch.fd, buf, len) != len)
+	return -1;
+    return 0;
+}
+
+static time_t
+zip_dos_time (unsigned int date, unsigned int time)
+{
+    struct tm tm;
+
+    memset (&tm, 0, sizeof (tm));
+    tm.tm_year = ((date >> 9) & 0x7f) + 80;
+    tm.tm_mon = ((date >> 5) & 0x0f) - 1;
+    tm.tm_mday = date & 0x1f;
+    tm.tm_hour = (time >> 11) & 0x1f;
+    tm.tm_min = (time >> 5) & 0x3f;
+    tm.tm_sec = (time & 0x1f) * 2;
+    tm.tm_isdst = -1;
+    return mktime (&tm);
+}
+
+/* Decode the central directory record at `p', which has `len' bytes
+   available.  Returns -1 if it is not a valid record */
+static int
+zip_parse_member (const unsigned char *p, size_t len, struct zip_member *m)
+{
+    const unsigned char *extra, *end;
+    unsigned int extra_len;
+
+    if (len < ZIP_CENTRAL_LEN || ZIP_U32 (p) != ZIP_CENTRAL_SIG)
+	return -1;
+
+    m->name_len = ZIP_U16 (p + 28);
+    extra_len = ZIP_U16 (p + 30);
+    m->length = ZIP_CENTRAL_LEN + m->name_len + extra_len + ZIP_U16 (p + 32);
+    if (m->length > len)
+	return -1;
+
+    m->host = p[5];
+    m->flags = ZIP_U16 (p + 8);
+    m->method = ZIP_U16 (p + 10);
+    m->mtime = zip_dos_time (ZIP_U16 (p + 14), ZIP_U16 (p + 12));
+    m->csize = ZIP_U32 (p + 20);
+    m->size = ZIP_U32 (p + 24);
+    m->attr = ZIP_U32 (p + 38);
+    m->header = ZIP_U32 (p + 42);
+    m->name = (unsigned char *) p + ZIP_CENTRAL_LEN;
+
+    /* Sizes and offsets that do not fit are in the zip64 extra field */
+    extra = p + ZIP_CENTRAL_LEN + m->name_len;
+    end = extra + extra_len;
+    while (extra + 4 <= end) {
+	unsigned int id = ZIP_U16 (extra);
+	const unsigned char *data = extra + 4;
+	const unsigned char *next = data + ZIP_U16 (extra + 2);
+
+	if (next > end)
+	    break;
+	if (id == ZIP_EXTRA_ZIP64) {
+	    if (m->size == 0xffffffffUL && data + 8 <= next) {
+		m->size = ZIP_U64 (data);
+		data += 8;
+	    }
+	    if (m->csize == 0xffffffffUL && data + 8 <= next) {
+		m->csize = ZIP_U64 (data);
+		data += 8;
+	    }
+	    if (m->header == 0xffffffffUL && data + 8 <= next)
+		m->header = ZIP_U64 (data);
+	} else if (id == ZIP_EXTRA_TIME && data + 5 <= next && (data[0] & 1)) {
+	    m->mtime = (time_t) ZIP_U32 (data + 1);
+	}
+	extra = next;
+    }
+    return 0;
+}
+
+static void
+zip_free_archive (struct vfs_class *me, struct vfs_s_super *super)
+{
+    (void) me;
+
+    if (super->u.arch.fd != -1)
+	mc_close (super->u.arch.fd);
+    super->u.arch.fd = -1;
+}
+
+static int
+zip_open_fd (struct vfs_class *me, struct vfs_s_super *super)
+{
+    (void) me;
+
+    super->u.arch.fd = mc_open (super->name, O_RDONLY);
+    if (super->u.arch.fd == -1) {
+	message (1, MSG_ERROR, _("Cannot open zip archive\n%s"), super->name);
+	return -1;
+    }
+    return 0;
+}
+
+static void
+zip_open_zip_file (struct vfs_class *me, struct vfs_s_super *super,
+		   const char *name)
+{
+    mode_t mode;
+    struct vfs_s_inode *root;
+
+    super->name = g_strdup (name);
+    super->u.arch.fd = -1;
+    mc_stat (name, &(super->u.arch.st));
+
+    mode = super->u.arch.st.st_mode & 07777;
+    mode |= (mode & 0444) >> 2;	/* set eXec where Read is */
+    mode |= S_IFDIR;
+
+    root = vfs_s_new_inode (me, super, &(super->u.arch.st));
+    root->st.st_mode = mode;
+    root->data_offset = -1;
+    root->st.st_nlink++;
+    root->st.st_dev = MEDATA->rdev++;
+
+    super->root = root;
+}
+
+/* Find the central directory and set u.arch.shift.  Returns its size,
+   or -1 if the file is not a zip archive */
+static off_t
+zip_find_central (struct vfs_s_super *super, off_t *offset)
+{
+    unsigned char *buf, *p;
+    unsigned char z64[ZIP64_END_LEN];
+    off_t size = super->u.arch.st.st_size;
+    off_t start, end, cd_size = -1;
+    int len;
+
+    if (size < ZIP_END_LEN)
+	return -1;
+
+    /* The end record is followed by a comment of up to 64K */
+    len = MIN (size, ZIP_END_LEN + ZIP_COMMENT_MAX);
+    start = size - len;
+    buf = g_malloc (len);
+    if (zip_pread (super, start, buf, len) == -1) {
+	g_free (buf);
+	return -1;
+    }
+
+    for (p = buf + len - ZIP_END_LEN; p >= buf; p--) {
+	if (ZIP_U32 (p) != ZIP_END_SIG
+	    || p + ZIP_END_LEN + ZIP_U16 (p + 20) > buf + len)
+	    continue;
+
+	end = start + (p - buf);
+	cd_size = ZIP_U32 (p + 12);
+	*offset = ZIP_U32 (p + 16);
+
+	/* A zip64 archive has a locator right before the end record */
+	if (p - buf >= ZIP64_LOCATOR_LEN
+	    && ZIP_U32 (p - ZIP64_LOCATOR_LEN) == ZIP64_LOCATOR_SIG) {
+	    off_t where = ZIP_U64 (p - ZIP64_LOCATOR_LEN + 8);
+
+	    /* The stored position is off by the stub of an SFX archive,
+	       the record is usually right before the locator then */
+	    if ((zip_pread (super, where, z64, ZIP64_END_LEN) == 0
+		 && ZIP_U32 (z64) == ZIP64_END_SIG)
+		|| ((where = end - ZIP64_LOCATOR_LEN - ZIP64_END_LEN) >= 0
+		    && zip_pread (super, where, z64, ZIP64_END_LEN) == 0
+		    && ZIP_U32 (z64) == ZIP64_END_SIG)) {
+		end = where;
+		cd_size = ZIP_U64 (z64 + 40);
+		*offset = ZIP_U64 (z64 + 48);
+	    }
+	}
+
+	/* The central directory ends where the end record starts */
+	super->u.arch.shift = end - cd_size - *offset;
+	*offset += super->u.arch.shift;
+	break;
+    }
+    g_free (buf);
+
+    if (cd_size < 0 || cd_size > INT_MAX || *offset < 0
+	|| *offset + cd_size > size)
+	return -1;
+    return cd_size;
+}
+
+/* Have the uzip script extract a member we cannot decode */
+static struct zip_stream *
+zip_stream_copyout (struct vfs_s_super *super, const struct zip_member *m)
+{
+    struct vfs_class *me = super->me;
+    struct zip_stream *s;
+    char *local, *member, *tmp;
+    int fd;
+
+    if ((fd = mc_mkstemps (&tmp, "zip", NULL)) == -1)
+	return NULL;
+    close (fd);
+
+    fd = -1;
+    if ((local = mc_getlocalcopy (super->name)) != NULL) {
+	member = g_strndup ((char *) m->name, m->name_len);
+	if (extfs_copyout ("uzip", local, member, tmp) == 0)
+	    fd = open (tmp, O_RDONLY);
+	g_free (member);
+	mc_ungetlocalcopy (super->name, local, 0);
+    }
+    unlink (tmp);
+    g_free (tmp);
+    if (fd == -1)
+	ERRNOR (EIO, NULL);
+
+    s = g_new0 (struct zip_stream, 1);
+    s->method = ZIP_COPYOUT;
+    s->fd = fd;
+    return s;
+}
+
+static struct zip_stream *
+zip_stream_open (struct vfs_class *me, struct vfs_s_inode *ino)
+{
+    struct vfs_s_super *super = ino->super;
+    unsigned char head[ZIP_CENTRAL_LEN], *rec;
+    struct zip_member m;
+    struct zip_stream *s;
+    size_t len;
+
+    if (zip_pread (super, ino->data_offset, head, ZIP_CENTRAL_LEN) == -1
+	|| ZIP_U32 (head) != ZIP_CENTRAL_SIG)
+	ERRNOR (EIO, NULL);
+    len = ZIP_CENTRAL_LEN + ZIP_U16 (head + 28) + ZIP_U16 (head + 30)
+	+ ZIP_U16 (head + 32);
+    rec = g_malloc (len);
+    if (zip_pread (super, ino->data_offset, rec, len) == -1
+	|| zip_parse_member (rec, len, &m) == -1) {
+	g_free (rec);
+	ERRNOR (EIO, NULL);
+    }
+
+    if ((m.flags & ZIP_FLAG_ENCRYPTED)
+	|| (m.method != ZIP_STORED && m.method != ZIP_DEFLATED)) {
+	s = zip_stream_copyout (super, &m);
+	g_free (rec);
+	return s;
+    }
+    g_free (rec);
+
+    m.header += super->u.arch.shift;
+    if (zip_pread (super, m.header, head, ZIP_LOCAL_LEN) == -1
+	|| ZIP_U32 (head) != ZIP_LOCAL_SIG)
+	ERRNOR (EIO, NULL);
+
+    s = g_new0 (struct zip_stream, 1);
+    s->method = m.method;
+    s->start = m.header + ZIP_LOCAL_LEN + ZIP_U16 (head + 26)
+	+ ZIP_U16 (head + 28);
+    s->csize = m.csize;
+    if (s->method == ZIP_DEFLATED && inflateInit2 (&s->strm, -MAX_WBITS) != Z_OK) {
+	g_free (s);
+	ERRNOR (ENOMEM, NULL);
+    }
+    return s;
+}
+
+static void
+zip_stream_close (struct zip_stream *s)
+{
+    if (s->method == ZIP_DEFLATED)
+	inflateEnd (&s->strm);
+    else if (s->method == ZIP_COPYOUT)
+	close (s->fd);
+    g_free (s);
+}
+
+/* Inflate up to `len' bytes of the member.  Returns the number of
+   bytes produced, or -1 on error */
+static int
+zip_inflate (struct vfs_s_super *super, struct zip_stream *s,
+	     Bytef *buf, int len)
+{
+    int ret;
+
+    s->strm.next_out = buf;
+    s->strm.avail_out = len;
+    while (s->strm.avail_out != 0) {
+	if (s->strm.avail_in == 0) {
+	    int n = MIN (ZIP_CHUNK, s->csize - s->in);
+
+	    if (n <= 0)
+		break;
+	    /* Other open members share the descriptor */
+	    if (zip_pread (super, s->start + s->in, s->input, n) == -1)
+		return -1;
+	    s->in += n;
+	    s->strm.next_in = s->input;
+	    s->strm.avail_in = n;
+	}
+	ret = inflate (&s->strm, Z_NO_FLUSH);
+	if (ret == Z_STREAM_END)
+	    break;
+	if (ret != Z_OK && ret != Z_BUF_ERROR)
+	    return -1;
+    }
+    len -= s->strm.avail_out;
+    s->out += len;
+    return len;
+}
+
+/* Read `count' bytes at position `pos' of the member */
+static int
+zip_stream_read (struct vfs_s_super *super, struct zip_stream *s,
+		 off_t pos, char *buffer, int count)
+{
+    Bytef skip[ZIP_CHUNK];
+    int n;
+
+    if (s->method == ZIP_COPYOUT) {
+	if (lseek (s->fd, pos, SEEK_SET) != pos)
+	    return -1;
+	return read (s->fd, buffer, count);
+    }
+    if (s->method == ZIP_STORED) {
+	count = MIN (count, s->csize - pos);
+	if (count <= 0)
+	    return 0;
+	if (mc_lseek (super->u.arch.fd, s->start + pos, SEEK_SET) != s->start + pos)
+	    return -1;
+	return mc_read (super->u.arch.fd, buffer, count);
+    }
+
+    /* Deflate has no random access, going back means starting over */
+    if (pos < s->out) {
+	inflateReset (&s->strm);
+	s->strm.avail_in = 0;
+	s->in = 0;
+	s->out = 0;
+    }
+    while (s->out < pos) {
+	n = zip_inflate (super, s, skip, MIN (ZIP_CHUNK, pos - s->out));
+	if (n <= 0)
+	    return n;
+    }
+    return zip_inflate (super, s, (Bytef *) buffer, count);
+}
+
+/* Symlink targets are stored as the contents of the member */
+static void
+zip_read_link (struct vfs_class *me, struct vfs_s_inode *ino)
+{
+    struct zip_stream *s;
+    int len = MIN (ino->st.st_size, MC_MAXPATHLEN);
+    int n;
+
+    ino->linkname = g_malloc (len + 1);
+    ino->linkname[0] = '\0';
+    if ((s = zip_stream_open (me, ino)) == NULL)
+	return;
+    n = zip_stream_read (ino->super, s, 0, ino->linkname, len);
+    ino->linkname[n > 0 ? n : 0] = '\0';
+    zip_stream_close (s);
+}
+
+static void
+zip_create_entry (struct vfs_class *me, struct vfs_s_super *super,
+		  struct zip_member *m, off_t offset)
+{
+    struct vfs_s_inode *inode, *parent;
+    struct vfs_s_entry *entry;
+    struct stat st;
+    char *name, *p, *tn;
+
+    name = g_strndup ((char *) m->name, m->name_len);
+
+    /* Leading slashes, "./" and "../" are ignored, as unzip does */
+    for (p = name;;) {
+	if (*p == PATH_SEP)
+	    p++;
+	else if (p[0] == '.' && p[1] == PATH_SEP)
+	    p += 2;
+	else if (p[0] == '.' && p[1] == '.' && p[2] == PATH_SEP)
+	    p += 3;
+	else
+	    break;
+    }
+
+    memset (&st, 0, sizeof (st));
+    if (m->host == ZIP_HOST_UNIX && (m->attr >> 16) != 0) {
+	st.st_mode = m->attr >> 16;
+	if (!(st.st_mode & S_IFMT))
+	    st.st_mode |= S_IFREG;
+    } else if ((m->attr & 0x10) || (*p && p[strlen (p) - 1] == PATH_SEP))
+	st.st_mode = S_IFDIR | 0755;
+    else
+	st.st_mode = S_IFREG | ((m->attr & 1) ? 0444 : 0644);
+    if (*p && p[strlen (p) - 1] == PATH_SEP && !S_ISDIR (st.st_mode))
+	st.st_mode = S_IFDIR | (st.st_mode & 07777);
+    st.st_uid = getuid ();
+    st.st_gid = getgid ();
+    st.st_size = S_ISDIR (st.st_mode) ? 0 : m->size;
+    st.st_atime = st.st_mtime = st.st_ctime = m->mtime;
+
+    for (tn = p + strlen (p) - 1; tn >= p && *tn == PATH_SEP; tn--)
+	*tn = 0;
+    if (*p == '\0') {
+	g_free (name);
+	return;
+    }
+
+    if ((tn = strrchr (p, PATH_SEP))) {
+	*tn = 0;
+	parent = vfs_s_find_inode (me, super, p, LINK_FOLLOW, FL_MKDIR);
+	*tn = PATH_SEP;
+	tn++;
+    } else {
+	parent = super->root;
+	tn = p;
+    }
+    if (parent == NULL) {
+	g_free (name);
+	return;
+    }
+
+    entry = MEDATA->find_entry (me, parent, tn, LINK_FOLLOW, FL_NONE);
+    if (entry) {
+	/* The directory was made up for an earlier member */
+	if (S_ISDIR (entry->ino->st.st_mode) && S_ISDIR (st.st_mode)) {
+	    entry->ino->st.st_mode = st.st_mode;
+	    entry->ino->st.st_atime = st.st_atime;
+	    entry->ino->st.st_mtime = st.st_mtime;
+	    entry->ino->st.st_ctime = st.st_ctime;
+	}
+	g_free (name);
+	return;
+    }
+
+    inode = vfs_s_new_inode (me, super, &st);
+    inode->data_offset = offset;
+    entry = vfs_s_new_entry (me, tn, inode);
+    vfs_s_insert_entry (me, parent, entry);
+
+    if (S_ISLNK (st.st_mode))
+	zip_read_link (me, inode);
+
+    g_free (name);
+}
+
+static int
+zip_open_archive (struct vfs_class *me, struct vfs_s_super *super,
+		  const char *name, char *op)
+{
+    unsigned char *cd;
+    struct zip_member m;
+    off_t offset, cd_size, pos;
+
+    (void) op;
+
+    zip_open_zip_file (me, super, name);
+    if (zip_open_fd (me, super) == -1)
+	return -1;
+
+    cd_size = zip_find_central (super, &offset);
+    if (cd_size == -1) {
+	message (1, MSG_ERROR, _("Not a zip archive\n%s"), name);
+	zip_free_archive (me, super);
+	return -1;
+    }
+
+    cd = g_malloc (cd_size);
+    if (zip_pread (super, offset, cd, cd_size) == -1) {
+	message (1, MSG_ERROR, _("Cannot read zip archive\n%s"), name);
+	g_free (cd);
+	zip_free_archive (me, super);
+	return -1;
+    }
+
+    /* The entry count of the end record is not trusted, some archivers
+       get it wrong when there are more than 65535 members */
+    for (pos = 0; pos < cd_size; pos += m.length) {
+	if (zip_parse_member (cd + pos, cd_size - pos, &m) == -1) {
+	    message (1, MSG_ERROR, _("Corrupted zip archive\n%s"), name);
+	    break;
+	}
+	zip_create_entry (me, super, &m, offset + pos);
+    }
+
+    g_free (cd);
+    return 0;
+}
+
+/* Remaining functions are exactly same as for tarfs */
+static void *
+zip_super_check (struct vfs_class *me, const char *archive_name, char *op)
+{
+    static struct stat sb;
+
+    (void) me;
+    (void) op;
+
+    if (mc_stat (archive_name, &sb))
+	return NULL;
+    return &sb;
+}
+
+static int
+zip_super_same (struct vfs_class *me, struct vfs_s_super *parc,
+		const char *archive_name, char *op, void *cookie)
+{
+    struct stat *archive_stat = cookie;	/* stat of main archive */
+
+    (void) me;
+    (void) op;
+
+    if (strcmp (parc->name, archive_name))
+	return 0;
+
+    /* Has the cached archive been changed on the disk? */
+    if (parc->u.arch.st.st_mtime < archive_stat->st_mtime) {
+	/* Yes, reload! */
+	(*vfs_zipfs_ops.free) ((vfsid) parc);
+	vfs_rmstamp (&vfs_zipfs_ops, (vfsid) parc);
+	return 2;
+    }
+    /* Hasn't been modified, give it a new timeout */
+    vfs_stamp (&vfs_zipfs_ops, (vfsid) parc);
+    return 1;
+}
+
+static int
+zip_read (void *fh, char *buffer, int count)
+{
+    struct vfs_class *me = FH_SUPER->me;
+
+    count = MIN (count, FH->ino->st.st_size - FH->pos);
+    if (count <= 0)
+	return 0;
+
+    count = zip_stream_read (FH_SUPER, FH->u.zip.stream, FH->pos,
+			     buffer, count);
+    if (count == -1)
+	ERRNOR (EIO, -1);
+
+    FH->pos += count;
+    return count;
+}
+
+static int
+zip_fh_open (struct vfs_class *me, struct vfs_s_fh *fh, int flags, int mode)
+{
+    (void) mode;
+
+    if ((flags & O_ACCMODE) != O_RDONLY)
+	ERRNOR (EROFS, -1);
+    if ((fh->u.zip.stream = zip_stream_open (me, fh->ino)) == NULL)
+	return -1;
+    return 0;
+}
+
+static int
+zip_fh_close (struct vfs_class *me, struct vfs_s_fh *fh)
+{
+    (void) me;
+
+    zip_stream_close (fh->u.zip.stream);
+    return 0;
+}
+
+void
+init_zipfs (void)
+{
+    static struct vfs_s_subclass zip_subclass;
+
+    zip_subclass.flags = VFS_S_READONLY;
+    zip_subclass.archive_check = zip_super_check;
+    zip_subclass.archive_same = zip_super_same;
+    zip_subclass.open_archive = zip_open_archive;
+    zip_subclass.free_archive = zip_free_archive;
+    zip_subclass.fh_open = zip_fh_open;
+    zip_subclass.fh_close = zip_fh_close;
+
+    vfs_s_init_class (&vfs_zipfs_ops, &zip_subclass);
+    vfs_zipfs_ops.name = "zipfs";
+    vfs_zipfs_ops.prefix = "zip";
+    vfs_zipfs_ops.read = zip_read;
+    vfs_zipfs_ops.setctl = NULL;
+    vfs_register_class (&vfs_zipfs_ops);
+}
+
+#endif				/* HAVE_LIBZ */